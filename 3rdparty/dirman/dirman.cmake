@@ -7,10 +7,22 @@ set(DIRMANAGER_SRCS)
 
 list(APPEND DIRMANAGER_SRCS
     ${CMAKE_CURRENT_LIST_DIR}/src/dirman.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/src/dirman_walker.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/src/dirman_watcher.cpp
     ${CMAKE_CURRENT_LIST_DIR}/include/DirManager/dirman.h
     ${CMAKE_CURRENT_LIST_DIR}/src/dirman_private.h
+    ${CMAKE_CURRENT_LIST_DIR}/src/dirman_walker.h
+    ${CMAKE_CURRENT_LIST_DIR}/src/dirman_watcher.h
 )
 
+# Threads of the parallel walker, link with ${DIRMANAGER_LIBS}
+set(DIRMANAGER_LIBS)
+set(THREADS_PREFER_PTHREAD_FLAG ON)
+find_package(Threads)
+if(Threads_FOUND)
+    list(APPEND DIRMANAGER_LIBS Threads::Threads)
+endif()
+
 if(WIN32)
     message("-- DirMan for Windows")
     list(APPEND DIRMANAGER_SRCS ${CMAKE_CURRENT_LIST_DIR}/src/dirman_winapi.cpp)
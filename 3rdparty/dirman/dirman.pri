@@ -7,8 +7,15 @@ win32:{
 }
 
 SOURCES += \
-    $$PWD/src/dirman.cpp
+    $$PWD/src/dirman.cpp \
+    $$PWD/src/dirman_walker.cpp \
+    $$PWD/src/dirman_watcher.cpp
 
 HEADERS += \
     $$PWD/include/DirManager/dirman.h \
-    $$PWD/src/dirman_private.h
+    $$PWD/src/dirman_private.h \
+    $$PWD/src/dirman_walker.h \
+    $$PWD/src/dirman_watcher.h
+
+# Threads of the parallel walker
+CONFIG += thread
@@ -159,6 +159,25 @@ public:
      */
     bool        beginWalking(const std::vector<std::string> &suffix_filters = std::vector<std::string>());
 
+    /**
+     * @brief Starts directory walking by several threads
+     * @param suffix_filters list of suffix (filename ends) filters (if not defined, look for all files)
+     * @param threads number of worker threads (0 to choose by the number of CPU cores)
+     * @param ordered return directories in the stable order: parents before children, sorted by names
+     * @return true if Walker successfully initialized
+     *
+     * Directories get read concurrently and fetchListFromWalker() returns them as they are ready.
+     * Workers pause while too many read directories wait for the fetch, so memory stays bounded.
+     * Unreadable directories are skipped. Without threading support this is beginWalking().
+     */
+    bool        beginWalkingParallel(const std::vector<std::string> &suffix_filters = std::vector<std::string>(),
+                                     unsigned threads = 0, bool ordered = false);
+
+    /**
+     * @brief Stop directory walking before it's completed (stops the threads of the parallel walking)
+     */
+    void        endWalking();
+
     /**
      * @brief Fetch list of files of the next directory
      * @param curPath Current directory path
@@ -166,6 +185,52 @@ public:
      * @return false when directory walking has been completed
      */
     bool        fetchListFromWalker(std::string &curPath, std::vector<std::string> &list);
+
+    enum WatchEventType
+    {
+        //! File has been written and closed, or moved into the tree
+        WATCH_ADDED = 0,
+        //! File has been deleted, or moved out of the tree
+        WATCH_REMOVED,
+        //! File or directory has been renamed inside of the tree
+        WATCH_RENAMED
+    };
+
+    struct WatchEvent
+    {
+        WatchEventType  type;
+        //! Full path (old one for the rename)
+        std::string     path;
+        //! New full path (rename only)
+        std::string     newPath;
+        //! Event is about the directory
+        bool            isDir;
+    };
+
+    /**
+     * @brief Start watching the directory tree for changes
+     * @param suffix_filters list of suffix (filename ends) filters (if not defined, look for all files)
+     * @return true if watching has been started, false if it's not supported here or the directory can't be read
+     *
+     * The tree is read once at the start (as by the walker), changes after that are delivered by fetchWatchEvents().
+     * Files of added and removed directories are reported one by one, the renamed directory is reported
+     * once with everything inside of it. Directories over the system's limit of watches, and the whole tree
+     * after the queue overflow, get rescanned: only directories whose modification time has changed are read.
+     */
+    bool        beginWatching(const std::vector<std::string> &suffix_filters = std::vector<std::string>());
+
+    /**
+     * @brief Stop watching
+     */
+    void        endWatching();
+
+    /**
+     * @brief Fetch changes happened since the previous call
+     * @param events List of changes in order they happened
+     * @param timeoutMs How long to wait for changes (0 - don't wait, negative - wait until anything happens)
+     * @return false if watching isn't started
+     */
+    bool        fetchWatchEvents(std::vector<WatchEvent> &events, int timeoutMs = 0);
 #endif // #ifndef PGE_FILES_PRESENT
 };
 
@@ -24,6 +24,8 @@
 
 #include "../include/DirManager/dirman.h"
 #include "dirman_private.h"
+#include "dirman_walker.h"
+#include "dirman_watcher.h"
 
 #ifdef PGE_FILES_PRESENT
 #    include "Utils/files.h"
@@ -143,9 +145,26 @@ bool DirMan::rmpath(const std::string &dirPath)
 }
 
 #ifndef PGE_FILES_PRESENT
-bool DirMan::beginWalking(const std::vector<std::string> &suffix_filters)
+static std::vector<std::string> lowerSuffixFilters(const std::vector<std::string> &suffix_filters)
 {
     std::locale loc;
+    std::vector<std::string> ret;
+
+    ret.reserve(suffix_filters.size());
+    for(const std::string &filter : suffix_filters)
+    {
+        std::string f;
+        f.reserve(filter.size());
+        for(const char &c : filter)
+            f.push_back(std::tolower(c, loc));
+        ret.push_back(f);
+    }
+
+    return ret;
+}
+
+bool DirMan::beginWalking(const std::vector<std::string> &suffix_filters)
+{
     #ifdef _WIN32
     std::wstring             &m_dirPath    = d->m_dirPathW;
     #else
@@ -154,28 +173,100 @@ bool DirMan::beginWalking(const std::vector<std::string> &suffix_filters)
     DirMan_private::DirWalkerState &m_walkerState   = d->m_walkerState;
 
     // Clear previous state
-    while(!m_walkerState.digStack.empty())
-        m_walkerState.digStack.pop();
+    endWalking();
 
     // Initialize suffix filters
-    m_walkerState.suffix_filters.clear();
-    m_walkerState.suffix_filters.reserve(suffix_filters.size());
-    for(const std::string &filter : suffix_filters)
-    {
-        std::string f;
-        f.reserve(filter.size());
-        for(const char &c : filter)
-            f.push_back(std::tolower(c, loc));
-        m_walkerState.suffix_filters.push_back(f);
-    }
+    m_walkerState.suffix_filters = lowerSuffixFilters(suffix_filters);
 
     // Push initial path
     m_walkerState.digStack.push(m_dirPath);
     return true;
 }
 
+bool DirMan::beginWalkingParallel(const std::vector<std::string> &suffix_filters, unsigned threads, bool ordered)
+{
+    if(!beginWalking(suffix_filters))
+        return false;
+
+#ifdef DIRMAN_HAS_PARALLEL_WALKER
+#   ifdef _WIN32
+    const std::wstring &root = d->m_dirPathW;
+
+    if(root.empty())
+        return true; // Archive paths aren't walked on Windows, keep the sequential state
+#   else
+    const std::string &root = d->m_dirPath;
+#   endif
+
+    // The sequential state isn't needed
+    while(!d->m_walkerState.digStack.empty())
+        d->m_walkerState.digStack.pop();
+
+    d->m_parallelWalker = std::make_shared<DirMan_private::ParallelWalker>(root, d->m_walkerState.suffix_filters, threads, ordered);
+#else
+    (void)threads;
+    (void)ordered;
+#endif
+
+    return true;
+}
+
+void DirMan::endWalking()
+{
+#ifdef DIRMAN_HAS_PARALLEL_WALKER
+    d->m_parallelWalker.reset();
+#endif
+
+    while(!d->m_walkerState.digStack.empty())
+        d->m_walkerState.digStack.pop();
+}
+
 bool DirMan::fetchListFromWalker(std::string &curPath, std::vector<std::string> &list)
 {
+#ifdef DIRMAN_HAS_PARALLEL_WALKER
+    if(d->m_parallelWalker)
+        return d->m_parallelWalker->fetch(curPath, list);
+#endif
+
     return d->fetchListFromWalker(curPath, list);
 }
+
+bool DirMan::beginWatching(const std::vector<std::string> &suffix_filters)
+{
+    endWatching();
+
+#ifdef DIRMAN_HAS_WATCHER
+    std::shared_ptr<DirMan_private::Watcher> watcher = std::make_shared<DirMan_private::Watcher>();
+
+    if(!watcher->start(d->m_dirPath, lowerSuffixFilters(suffix_filters)))
+        return false;
+
+    d->m_watcher = watcher;
+    return true;
+#else
+    (void)suffix_filters;
+    return false;
+#endif
+}
+
+void DirMan::endWatching()
+{
+#ifdef DIRMAN_HAS_WATCHER
+    d->m_watcher.reset();
+#endif
+}
+
+bool DirMan::fetchWatchEvents(std::vector<WatchEvent> &events, int timeoutMs)
+{
+    events.clear();
+
+#ifdef DIRMAN_HAS_WATCHER
+    if(d->m_watcher)
+        return d->m_watcher->fetch(events, timeoutMs);
+#else
+    (void)timeoutMs;
+#endif
+
+    return false;
+}
 #endif // #ifndef PGE_FILES_PRESENT
@@ -28,6 +28,7 @@
 #include <sys/types.h>
 #include <dirent.h>
 #include <sys/stat.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <memory.h>
 
@@ -42,6 +43,82 @@
 #   include "Archives/archives.h"
 #endif
 
+enum DirManEntryType
+{
+    //! Can't get the type
+    ENTRY_UNKNOWN = 0,
+    ENTRY_FILE,
+    ENTRY_DIR,
+    //! Symbolic link (only when not following)
+    ENTRY_LINK,
+    //! Devices, sockets, pipes
+    ENTRY_OTHER
+};
+
+/**
+ * @brief Type of the directory entry
+ * @param dir Directory being read
+ * @param dent Entry of it
+ * @param follow Report the type of the symlink's target rather than of the symlink itself
+ * @return type of the entry
+ *
+ * The d_type given by readdir() is trusted when the file system reports it, so only
+ * entries of unknown type and followed symlinks cost the fstatat() call.
+ */
+static DirManEntryType dirman_entry_type(DIR *dir, const dirent *dent, bool follow)
+{
+#ifdef DIRMAN_HAS_FSSTATAT
+    struct stat st;
+
+#   ifdef DT_UNKNOWN // Not every system has d_type
+    switch(dent->d_type)
+    {
+    case DT_REG:
+        return ENTRY_FILE;
+    case DT_DIR:
+        return ENTRY_DIR;
+    case DT_LNK:
+        if(!follow)
+            return ENTRY_LINK;
+        break; // Need the target's type
+    case DT_UNKNOWN:
+        break;
+    default:
+        return ENTRY_OTHER;
+    }
+#   endif
+
+    if(fstatat(dirfd(dir), dent->d_name, &st, follow ? 0 : AT_SYMLINK_NOFOLLOW) < 0)
+        return ENTRY_UNKNOWN;
+
+    if(S_ISREG(st.st_mode))
+        return ENTRY_FILE;
+    else if(S_ISDIR(st.st_mode))
+        return ENTRY_DIR;
+    else if(S_ISLNK(st.st_mode))
+        return ENTRY_LINK;
+
+    return ENTRY_OTHER;
+#else
+    (void)dir;
+    (void)follow;
+
+    switch(dent->d_type)
+    {
+    case DT_REG:
+        return ENTRY_FILE;
+    case DT_DIR:
+        return ENTRY_DIR;
+    case DT_LNK:
+        return ENTRY_LINK; // Can't follow without stat
+    case DT_UNKNOWN:
+        return ENTRY_UNKNOWN;
+    default:
+        return ENTRY_OTHER;
+    }
+#endif
+}
+
 #ifdef __WIIU__
 // Workaround to avoid the EIO error on virtual directories
 
@@ -145,29 +222,14 @@ bool DirMan::DirMan_private::getListOfFiles(std::vector<std::string> &list, cons
 
     while((dent = readdir(srcdir)) != nullptr)
     {
-#ifdef DIRMAN_HAS_FSSTATAT
-        struct stat st = {};
-#endif
-
         if(strcmp(dent->d_name, ".") == 0 || strcmp(dent->d_name, "..") == 0)
             continue;
 
-#ifdef DIRMAN_HAS_FSSTATAT
-        if(fstatat(dirfd(srcdir), dent->d_name, &st, 0) < 0)
-            continue;
-
-        if(S_ISREG(st.st_mode))
+        if(dirman_entry_type(srcdir, dent, true) == ENTRY_FILE)
         {
             if(matchSuffixFilters(dent->d_name, suffix_filters))
                 list.emplace_back(dent->d_name);
         }
-#else
-        if(dent->d_type == DT_REG)
-        {
-            if(matchSuffixFilters(dent->d_name, suffix_filters))
-                list.emplace_back(dent->d_name);
-        }
-#endif
     }
 
     closedir(srcdir);
@@ -203,28 +265,14 @@ bool DirMan::DirMan_private::getListOfFolders(std::vector<std::string>& list, co
 
     while((dent = readdir(srcdir)) != nullptr)
     {
-#ifdef DIRMAN_HAS_FSSTATAT
-        struct stat st = {};
-#endif
         if(strcmp(dent->d_name, ".") == 0 || strcmp(dent->d_name, "..") == 0)
             continue;
 
-#ifdef DIRMAN_HAS_FSSTATAT
-        if(fstatat(dirfd(srcdir), dent->d_name, &st, 0) < 0)
-            continue;
-
-        if(S_ISDIR(st.st_mode))
+        if(dirman_entry_type(srcdir, dent, true) == ENTRY_DIR)
         {
             if(matchSuffixFilters(dent->d_name, suffix_filters))
                 list.emplace_back(dent->d_name);
         }
-#else
-        if(dent->d_type == DT_DIR)
-        {
-            if(matchSuffixFilters(dent->d_name, suffix_filters))
-                list.emplace_back(dent->d_name);
-        }
-#endif
     }
 
     closedir(srcdir);
@@ -232,60 +280,83 @@ bool DirMan::DirMan_private::getListOfFolders(std::vector<std::string>& list, co
     return true;
 }
 
-bool DirMan::DirMan_private::fetchListFromWalker(std::string &curPath, std::vector<std::string> &list)
+bool DirMan::DirMan_private::walkerReadDir(const PathString &path, const std::vector<std::string> &suffix_filters,
+                                           std::vector<PathString> &dirs, std::vector<std::string> &files)
 {
-    PUT_THREAD_GUARD();
-
 #ifdef PGE_USE_ARCHIVES
-    // unsupported for now
-    if(Archives::has_prefix(m_dirPath))
-        return false;
-#endif // PGE_USE_ARCHIVES
-
-    if(m_walkerState.digStack.empty())
-        return false;
+    if(Archives::has_prefix(path))
+    {
+        // The root keeps its trailing slash ("@pack.zip:/")
+        std::string prefix = (!path.empty() && path[path.size() - 1] == '/') ? path : path + "/";
 
-    list.clear();
+        for(auto& ent : Archives::list_dir(path.c_str()))
+        {
+            if(ent.type == Archives::PATH_DIR)
+                dirs.push_back(prefix + ent.name);
+            else if(ent.type == Archives::PATH_FILE)
+            {
+                if(matchSuffixFilters(ent.name, suffix_filters))
+                    files.push_back(std::move(ent.name));
+            }
+        }
 
-    std::string path = m_walkerState.digStack.top();
-    m_walkerState.digStack.pop();
+        return true;
+    }
+#endif // PGE_USE_ARCHIVES
 
     dirent *dent = nullptr;
     DIR *srcdir = opendir(path.c_str());
-    if(srcdir == nullptr) //Can't read this directory. Continue
-        return true;
+    if(srcdir == nullptr)
+        return false;
 
     while((dent = readdir(srcdir)) != nullptr)
     {
-#ifdef DIRMAN_HAS_FSSTATAT
-        struct stat st;
-#endif
+        DirManEntryType type;
+
         if(strcmp(dent->d_name, ".") == 0 || strcmp(dent->d_name, "..") == 0)
             continue;
 
-#ifdef DIRMAN_HAS_FSSTATAT
-        if(fstatat(dirfd(srcdir), dent->d_name, &st, 0) < 0)
-            continue;
+        type = dirman_entry_type(srcdir, dent, true);
 
-        if(S_ISDIR(st.st_mode))
-            m_walkerState.digStack.push(path + "/" + dent->d_name);
-        else if(S_ISREG(st.st_mode))
-        {
-            if(matchSuffixFilters(dent->d_name, m_walkerState.suffix_filters))
-                list.emplace_back(dent->d_name);
-        }
-#else
-        if(dent->d_type == DT_DIR)
-            m_walkerState.digStack.push(path + "/" + dent->d_name);
-        else if(dent->d_type == DT_REG)
+        if(type == ENTRY_DIR)
+            dirs.push_back(path + "/" + dent->d_name);
+        else if(type == ENTRY_FILE)
         {
-            if(matchSuffixFilters(dent->d_name, m_walkerState.suffix_filters))
-                list.emplace_back(dent->d_name);
+            if(matchSuffixFilters(dent->d_name, suffix_filters))
+                files.emplace_back(dent->d_name);
         }
-#endif
     }
 
     closedir(srcdir);
+
+    return true;
+}
+
+std::string DirMan::DirMan_private::walkerPathString(const PathString &path)
+{
+    return path;
+}
+
+bool DirMan::DirMan_private::fetchListFromWalker(std::string &curPath, std::vector<std::string> &list)
+{
+    PUT_INSTANCE_GUARD();
+
+    std::vector<PathString> dirs;
+
+    if(m_walkerState.digStack.empty())
+        return false;
+
+    list.clear();
+
+    std::string path = m_walkerState.digStack.top();
+    m_walkerState.digStack.pop();
+
+    if(!walkerReadDir(path, m_walkerState.suffix_filters, dirs, list))
+        return true; //Can't read this directory. Continue
+
+    for(auto &d : dirs)
+        m_walkerState.digStack.push(std::move(d));
+
     curPath = path;
 
     return true;
@@ -293,8 +364,6 @@ bool DirMan::DirMan_private::fetchListFromWalker(std::string &curPath, std::vect
 
 bool DirMan::exists(const std::string &dirPath)
 {
-    PUT_THREAD_GUARD();
-
 #ifdef PGE_USE_ARCHIVES
     if(Archives::has_prefix(dirPath))
         return Archives::exists(dirPath.c_str()) == Archives::PATH_DIR;
@@ -312,8 +381,6 @@ bool DirMan::exists(const std::string &dirPath)
 
 bool DirMan::mkAbsDir(const std::string &dirPath)
 {
-    PUT_THREAD_GUARD();
-
 #ifdef PGE_USE_ARCHIVES
     if(Archives::has_prefix(dirPath))
         return false;
@@ -324,8 +391,6 @@ bool DirMan::mkAbsDir(const std::string &dirPath)
 
 bool DirMan::rmAbsDir(const std::string &dirPath)
 {
-    PUT_THREAD_GUARD();
-
 #ifdef PGE_USE_ARCHIVES
     if(Archives::has_prefix(dirPath))
         return false;
@@ -336,8 +401,6 @@ bool DirMan::rmAbsDir(const std::string &dirPath)
 
 bool DirMan::mkAbsPath(const std::string &dirPath)
 {
-    PUT_THREAD_GUARD();
-
 #ifdef PGE_USE_ARCHIVES
     if(Archives::has_prefix(dirPath))
         return false;
@@ -380,8 +443,6 @@ bool DirMan::mkAbsPath(const std::string &dirPath)
 
 bool DirMan::rmAbsPath(const std::string &dirPath)
 {
-    PUT_THREAD_GUARD();
-
 #ifdef PGE_USE_ARCHIVES
     if(Archives::has_prefix(dirPath))
         return false;
@@ -408,27 +469,19 @@ bool DirMan::rmAbsPath(const std::string &dirPath)
         {
             while((e->p = readdir(e->d)) != nullptr)
             {
-#ifdef DIRMAN_HAS_FSSTATAT
-                struct stat st = {};
-#endif
+                DirManEntryType type;
+
                 if(strcmp(e->p->d_name, ".") == 0 || strcmp(e->p->d_name, "..") == 0)
                     continue;
 
-#ifdef DIRMAN_HAS_FSSTATAT
-                if(fstatat(dirfd(e->d), e->p->d_name, &st, 0) < 0)
-                    continue;
-#else
-                if(e->p->d_type == DT_UNKNOWN)
+                // Symlinks get removed themselves, never walked into
+                type = dirman_entry_type(e->d, e->p, false);
+                if(type == ENTRY_UNKNOWN)
                     continue;
-#endif
 
                 std::string path = e->path + "/" + e->p->d_name;
 
-#ifdef DIRMAN_HAS_FSSTATAT
-                if(S_ISDIR(st.st_mode))
-#else
-                if(e->p->d_type == DT_DIR)
-#endif
+                if(type == ENTRY_DIR)
                 {
                     closedir(e->d);
                     e->d = nullptr;
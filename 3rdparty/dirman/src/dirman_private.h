@@ -28,6 +28,7 @@
 #include <string>
 #include <stack>
 #include <vector>
+#include <memory>
 #include <stdlib.h>
 
 #include "../include/DirManager/dirman.h"
@@ -38,6 +39,10 @@ typedef std::wstring    PathString;
 typedef std::string     PathString;
 #endif
 
+/*
+ * PUT_INSTANCE_GUARD() guards the state of one DirMan, PUT_THREAD_GUARD() is process-wide
+ * and is kept only for static calls of the platforms whose file API isn't known to be thread-safe.
+ */
 #ifndef PGE_NO_THREADING
 #   ifdef PGE_SDL_MUTEX
 #   include <SDL2/SDL_mutex.h>
@@ -66,6 +71,10 @@ public:
     MutexLocker guard(g_dirManMutex); \
     (void)guard
 
+#define PUT_INSTANCE_GUARD() \
+    MutexLocker instanceGuard(m_mutex); \
+    (void)instanceGuard
+
 #   else /*PGE_SDL_MUTEX*/
 #   include <mutex>
 static std::mutex g_dirManMutex;
@@ -74,11 +83,26 @@ static std::mutex g_dirManMutex;
     std::lock_guard<std::mutex> guard(g_dirManMutex);\
     (void)guard
 
+#define PUT_INSTANCE_GUARD() \
+    std::lock_guard<std::mutex> instanceGuard(m_mutex);\
+    (void)instanceGuard
+
 #   endif /*PGE_SDL_MUTEX*/
 #else /*PGE_NO_THREADING*/
 #   define PUT_THREAD_GUARD() (void)0
+#   define PUT_INSTANCE_GUARD() (void)0
 #endif /*PGE_NO_THREADING*/
 
+// The parallel walker needs std::thread
+#if !defined(PGE_NO_THREADING) && !defined(PGE_SDL_MUTEX) && !defined(PGE_FILES_PRESENT)
+#   define DIRMAN_HAS_PARALLEL_WALKER
+#endif
+
+// Live watching is backed by inotify
+#if defined(__linux__) && !defined(PGE_FILES_PRESENT)
+#   define DIRMAN_HAS_WATCHER
+#endif
+
 
 template<class CHAR>
 static inline void delEnd(std::basic_string<CHAR> &dirPath, CHAR ch)
@@ -100,17 +124,51 @@ class DirMan::DirMan_private
     std::wstring    m_dirPathW;
 #endif
 
+#ifndef PGE_NO_THREADING
+    //! Guards the state of this instance, independent instances don't block each other
+#   ifdef PGE_SDL_MUTEX
+    SDL_mutex      *m_mutex = nullptr;
+#   else
+    std::mutex      m_mutex;
+#   endif
+#endif
+
     struct DirWalkerState
     {
         std::stack<PathString>      digStack;
         std::vector<std::string>    suffix_filters;
     } m_walkerState;
 
+#ifdef DIRMAN_HAS_PARALLEL_WALKER
+    class ParallelWalker;
+    //! Walker started by beginWalkingParallel(), used instead of m_walkerState when set
+    std::shared_ptr<ParallelWalker> m_parallelWalker;
+#endif
+
+#ifdef DIRMAN_HAS_WATCHER
+    class Watcher;
+    //! Watcher started by beginWatching()
+    std::shared_ptr<Watcher> m_watcher;
+#endif
+
     void setPath(const std::string &dirPath);
     bool getListOfFiles(std::vector<std::string> &list, const std::vector<std::string> &suffix_filters);
     bool getListOfFolders(std::vector<std::string> &list, const std::vector<std::string> &suffix_filters);
     bool fetchListFromWalker(std::string &curPath, std::vector<std::string> &list);
 
+    /**
+     * @brief Read one directory of the walk, doesn't touch any state (safe to call from several threads)
+     * @param path Path of the directory
+     * @param suffix_filters lower-cased suffix filters of files
+     * @param dirs Paths of subdirectories (appended)
+     * @param files Names of matching files (appended)
+     * @return false if directory can't be read
+     */
+    static bool walkerReadDir(const PathString &path, const std::vector<std::string> &suffix_filters,
+                              std::vector<PathString> &dirs, std::vector<std::string> &files);
+    //! Path of the walk as UTF-8
+    static std::string walkerPathString(const PathString &path);
+
 public:
 #if !defined(PGE_NO_THREADING) && defined(PGE_SDL_MUTEX)
     DirMan_private()
@@ -118,10 +176,12 @@ public:
         if(SDL_AtomicGet(&g_dirManCounter) == 0 && g_dirManMutex == nullptr)
             g_dirManMutex = SDL_CreateMutex();
         SDL_AtomicAdd(&g_dirManCounter, 1);
+        m_mutex = SDL_CreateMutex();
     }
 
     DirMan_private(const DirMan_private &o)
     {
+        m_mutex = SDL_CreateMutex();
         m_dirPath = o.m_dirPath;
 #ifdef _WIN32
         m_dirPathW = o.m_dirPathW;
@@ -132,6 +192,7 @@ public:
 
     ~DirMan_private()
     {
+        SDL_DestroyMutex(m_mutex);
         SDL_AtomicAdd(&g_dirManCounter, -1);
         if(SDL_AtomicGet(&g_dirManCounter) <= 0 && g_dirManMutex != nullptr)
         {
@@ -141,7 +202,15 @@ public:
     }
 #else
     DirMan_private() = default;
-    DirMan_private(const DirMan_private &) = default;
+
+    DirMan_private(const DirMan_private &o) :
+        m_dirPath(o.m_dirPath),
+#ifdef _WIN32
+        m_dirPathW(o.m_dirPathW),
+#endif
+        m_walkerState(o.m_walkerState)
+    {}
+
     ~DirMan_private() = default;
 #endif
 };
@@ -63,7 +63,7 @@ static constexpr const SceMode gSceDirMode = 0777;
 
 void DirMan::DirMan_private::setPath(const std::string &dirPath)
 {
-    PUT_THREAD_GUARD();
+    PUT_INSTANCE_GUARD();
 #ifdef PGE_USE_ARCHIVES
     if(Archives::has_prefix(dirPath))
     {
@@ -98,7 +98,7 @@ static inline int hasEndSlash(char* string)
 
 bool DirMan::DirMan_private::getListOfFiles(std::vector<std::string> &list, const std::vector<std::string> &suffix_filters)
 {
-    PUT_THREAD_GUARD();
+    PUT_INSTANCE_GUARD();
     list.clear();
 
 #ifdef PGE_USE_ARCHIVES
@@ -196,7 +196,7 @@ static inline int quick_stat_folders(
 
 bool DirMan::DirMan_private::getListOfFolders(std::vector<std::string>& list, const std::vector<std::string>& suffix_filters)
 {
-    PUT_THREAD_GUARD();
+    PUT_INSTANCE_GUARD();
     list.clear();
 
  #ifdef PGE_USE_ARCHIVES
@@ -288,9 +288,25 @@ bool DirMan::DirMan_private::getListOfFolders(std::vector<std::string>& list, co
     return true;
 }
 
+bool DirMan::DirMan_private::walkerReadDir(const PathString &path, const std::vector<std::string> &suffix_filters,
+                                           std::vector<PathString> &dirs, std::vector<std::string> &files)
+{
+    // unsupported for now, see fetchListFromWalker()
+    (void)path;
+    (void)suffix_filters;
+    (void)dirs;
+    (void)files;
+    return false;
+}
+
+std::string DirMan::DirMan_private::walkerPathString(const PathString &path)
+{
+    return path;
+}
+
 bool DirMan::DirMan_private::fetchListFromWalker(std::string &curPath, std::vector<std::string> &list)
 {
-    PUT_THREAD_GUARD();
+    PUT_INSTANCE_GUARD();
 
 #ifdef PGE_USE_ARCHIVES
     // unsupported for now
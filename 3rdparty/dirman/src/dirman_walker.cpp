@@ -0,0 +1,229 @@
+/*
+ * DirMan - A small crossplatform class to manage directories
+ *
+ * Copyright (c) 2017-2025 Vitaliy Novichkov <admin@wohlnet.ru>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "dirman_walker.h"
+
+#ifdef DIRMAN_HAS_PARALLEL_WALKER
+
+#include <algorithm>
+#include <system_error>
+
+DirMan::DirMan_private::ParallelWalker::ParallelWalker(const PathString &root,
+                                                       const std::vector<std::string> &suffix_filters,
+                                                       unsigned threads, bool ordered) :
+    m_filters(suffix_filters),
+    m_ordered(ordered)
+{
+    NodePtr rootNode = std::make_shared<Node>();
+    rootNode->path = root;
+
+    m_work.push_back(rootNode);
+    if(m_ordered)
+        m_emit.push_back(rootNode);
+
+    if(threads == 0)
+        threads = std::thread::hardware_concurrency();
+    if(threads == 0)
+        threads = 4;
+    if(threads > DIRMAN_WALKER_MAX_THREADS)
+        threads = DIRMAN_WALKER_MAX_THREADS;
+
+    for(unsigned i = 0; i < threads; ++i)
+    {
+        try
+        {
+            m_threads.emplace_back(&ParallelWalker::worker, this);
+        }
+        catch(const std::system_error &)
+        {
+            break; // fetch() reads directories itself when there are no workers
+        }
+    }
+}
+
+DirMan::DirMan_private::ParallelWalker::~ParallelWalker()
+{
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        m_quit = true;
+    }
+
+    m_workCond.notify_all();
+
+    for(auto &t : m_threads)
+        t.join();
+}
+
+void DirMan::DirMan_private::ParallelWalker::read(Node &n, std::vector<PathString> &dirs) const
+{
+    n.ok = walkerReadDir(n.path, m_filters, dirs, n.files);
+
+    if(m_ordered)
+    {
+        std::sort(dirs.begin(), dirs.end());
+        std::sort(n.files.begin(), n.files.end());
+    }
+}
+
+void DirMan::DirMan_private::ParallelWalker::finish(const NodePtr &n, std::vector<PathString> &dirs,
+                                                    bool byWorker)
+{
+    // Pushed in reverse, so the first subdirectory is the first to pop
+    for(auto it = dirs.rbegin(); it != dirs.rend(); ++it)
+    {
+        NodePtr child = std::make_shared<Node>();
+        child->path = std::move(*it);
+        m_work.push_back(child);
+        if(m_ordered)
+            n->children.push_back(child);
+    }
+
+    n->done = true;
+
+    if(byWorker && (m_ordered || n->ok))
+    {
+        n->buffered = true;
+        m_buffered++;
+    }
+
+    if(byWorker && !m_ordered && n->ok)
+        m_results.push_back(n);
+
+    if(!dirs.empty())
+        m_workCond.notify_all();
+    m_resultCond.notify_all();
+}
+
+void DirMan::DirMan_private::ParallelWalker::worker()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    std::vector<PathString> dirs;
+
+    while(!m_quit)
+    {
+        NodePtr n;
+
+        if(m_work.empty() || m_buffered >= DIRMAN_WALKER_MAX_BUFFERED)
+        {
+            m_workCond.wait(lock);
+            continue;
+        }
+
+        n = m_work.back();
+        m_work.pop_back();
+
+        if(n->taken)
+            continue; // Already read by fetch()
+
+        n->taken = true;
+        m_active++;
+
+        lock.unlock();
+        dirs.clear();
+        read(*n, dirs);
+        lock.lock();
+
+        m_active--;
+        finish(n, dirs, true);
+    }
+}
+
+bool DirMan::DirMan_private::ParallelWalker::fetch(std::string &curPath, std::vector<std::string> &list)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    std::vector<PathString> dirs;
+    NodePtr n;
+
+    list.clear();
+
+    while(!n)
+    {
+        if(m_ordered)
+        {
+            if(m_emit.empty())
+                return false;
+
+            n = m_emit.back();
+            m_emit.pop_back();
+        }
+        else
+        {
+            m_resultCond.wait(lock, [this]
+            {
+                return !m_results.empty() || (m_work.empty() && m_active == 0) || m_threads.empty();
+            });
+
+            if(!m_results.empty())
+            {
+                n = m_results.front();
+                m_results.pop_front();
+            }
+            else if(!m_work.empty())
+            {
+                n = m_work.back(); // No workers, read it here
+                m_work.pop_back();
+            }
+            else
+                return false;
+        }
+
+        if(!n->taken)
+        {
+            // Nobody reads it yet: read here rather than wait, workers might be stopped by the full buffer
+            n->taken = true;
+            lock.unlock();
+            dirs.clear();
+            read(*n, dirs);
+            lock.lock();
+            finish(n, dirs, false);
+        }
+        else
+            m_resultCond.wait(lock, [&n] { return n->done; });
+
+        if(n->buffered)
+        {
+            n->buffered = false;
+            m_buffered--;
+            m_workCond.notify_all();
+        }
+
+        if(m_ordered)
+        {
+            for(auto it = n->children.rbegin(); it != n->children.rend(); ++it)
+                m_emit.push_back(*it);
+            n->children.clear();
+        }
+
+        if(!n->ok)
+            n.reset(); // Can't read this directory. Continue
+    }
+
+    curPath = walkerPathString(n->path);
+    list = std::move(n->files);
+
+    return true;
+}
+
+#endif // DIRMAN_HAS_PARALLEL_WALKER
@@ -0,0 +1,121 @@
+/*
+ * DirMan - A small crossplatform class to manage directories
+ *
+ * Copyright (c) 2017-2025 Vitaliy Novichkov <admin@wohlnet.ru>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef DIRMAN_WALKER_H
+#define DIRMAN_WALKER_H
+
+#include "dirman_private.h"
+
+#ifdef DIRMAN_HAS_PARALLEL_WALKER
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+//! Most worker threads of the parallel walker
+#define DIRMAN_WALKER_MAX_THREADS 16
+//! Most read directories kept waiting for the fetch
+#define DIRMAN_WALKER_MAX_BUFFERED 64
+
+/**
+ * Reads directories of the walk by several threads
+ *
+ * Directories to read are kept as a stack, so the walk goes deep first and the
+ * list of pending directories stays short. Workers stop reading when too many
+ * read directories wait for the fetch. In the ordered mode directories are
+ * returned parent first, and entries of every directory are sorted by names.
+ */
+class DirMan::DirMan_private::ParallelWalker
+{
+    struct Node
+    {
+        PathString                  path;
+        std::vector<std::string>    files;
+        //! Subdirectories in order of the return (ordered mode only)
+        std::vector<std::shared_ptr<Node>> children;
+        //! Reading has been started
+        bool    taken = false;
+        //! Reading has been finished
+        bool    done = false;
+        //! Directory has been read successfully
+        bool    ok = false;
+        //! Counted at m_buffered
+        bool    buffered = false;
+    };
+
+    typedef std::shared_ptr<Node> NodePtr;
+
+    std::vector<std::string>    m_filters;
+    bool                        m_ordered;
+
+    std::mutex                  m_mutex;
+    //! Workers wait for directories to read and for the space to keep results
+    std::condition_variable     m_workCond;
+    //! Fetch waits for results
+    std::condition_variable     m_resultCond;
+    std::vector<std::thread>    m_threads;
+    bool                        m_quit = false;
+
+    //! Directories to read, the last one goes first
+    std::deque<NodePtr>         m_work;
+    //! Read directories in order of completion (unordered mode)
+    std::deque<NodePtr>         m_results;
+    //! Directories to return, the last one goes first (ordered mode)
+    std::vector<NodePtr>        m_emit;
+    //! Directories read by workers and not fetched yet
+    size_t                      m_buffered = 0;
+    //! Workers reading right now
+    unsigned                    m_active = 0;
+
+    void worker();
+    //! Read the directory, called without the lock
+    void read(Node &n, std::vector<PathString> &dirs) const;
+    //! Queue subdirectories of the just read directory, called with the lock
+    void finish(const NodePtr &n, std::vector<PathString> &dirs, bool byWorker);
+
+public:
+    /**
+     * @brief Start workers
+     * @param root Directory to walk
+     * @param suffix_filters lower-cased suffix filters
+     * @param threads Number of workers (0 - by the number of CPU cores)
+     * @param ordered Return directories in the stable order
+     */
+    ParallelWalker(const PathString &root, const std::vector<std::string> &suffix_filters,
+                 unsigned threads, bool ordered);
+    ~ParallelWalker();
+
+    ParallelWalker(const ParallelWalker &) = delete;
+    ParallelWalker &operator=(const ParallelWalker &) = delete;
+
+    //! Same as DirMan::fetchListFromWalker(), unreadable directories are skipped
+    bool fetch(std::string &curPath, std::vector<std::string> &list);
+};
+
+#endif // DIRMAN_HAS_PARALLEL_WALKER
+
+#endif // DIRMAN_WALKER_H
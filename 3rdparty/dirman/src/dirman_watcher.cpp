@@ -0,0 +1,529 @@
+/*
+ * DirMan - A small crossplatform class to manage directories
+ *
+ * Copyright (c) 2017-2025 Vitaliy Novichkov <admin@wohlnet.ru>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "dirman_watcher.h"
+
+#ifdef DIRMAN_HAS_WATCHER
+
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <poll.h>
+#include <unistd.h>
+#include <time.h>
+
+#ifdef PGE_USE_ARCHIVES
+#   include "Archives/archives.h"
+#endif
+
+#define DIRMAN_WATCHER_MASK (IN_CREATE | IN_CLOSE_WRITE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+                             IN_DELETE_SELF | IN_ONLYDIR)
+
+//! Modification time of the directory in nanoseconds, -1 if it's not a directory
+static int64_t watcher_dir_mtime(const std::string &path, struct stat &st)
+{
+    if(stat(path.c_str(), &st) != 0 || !S_ISDIR(st.st_mode))
+        return -1;
+
+    return (int64_t)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+}
+
+static uint64_t watcher_clock_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static std::string watcher_join(const std::string &dir, const std::string &name)
+{
+    return (!dir.empty() && dir[dir.size() - 1] == '/') ? dir + name : dir + "/" + name;
+}
+
+static std::string watcher_name(const std::string &path)
+{
+    size_t slash = path.rfind('/');
+    return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+static void watcher_event(std::vector<DirMan::WatchEvent> &events, DirMan::WatchEventType type,
+                          const std::string &path, bool isDir, const std::string &newPath = std::string())
+{
+    DirMan::WatchEvent e;
+    e.type = type;
+    e.path = path;
+    e.newPath = newPath;
+    e.isDir = isDir;
+    events.push_back(std::move(e));
+}
+
+DirMan::DirMan_private::Watcher::Watcher()
+{}
+
+DirMan::DirMan_private::Watcher::~Watcher()
+{
+    if(m_fd >= 0)
+        close(m_fd); // Removes all watches
+}
+
+bool DirMan::DirMan_private::Watcher::start(const std::string &root, const std::vector<std::string> &suffix_filters)
+{
+    struct stat st;
+
+#ifdef PGE_USE_ARCHIVES
+    if(Archives::has_prefix(root))
+        return false; // Archives don't change
+#endif
+
+    m_filters = suffix_filters;
+    m_root = root;
+    while(m_root.size() > 1 && m_root[m_root.size() - 1] == '/')
+        m_root.resize(m_root.size() - 1);
+
+    if(watcher_dir_mtime(m_root, st) < 0)
+        return false;
+
+    m_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(m_fd < 0)
+        return false;
+
+    addTree(m_root, nullptr);
+    m_lastPoll = watcher_clock_ms();
+
+    return m_dirs.find(m_root) != m_dirs.end();
+}
+
+void DirMan::DirMan_private::Watcher::addTree(const std::string &path, std::vector<DirMan::WatchEvent> *events)
+{
+    std::vector<std::string> queue;
+    std::vector<PathString> subDirs;
+    std::vector<std::string> files;
+    struct stat st;
+
+    queue.push_back(path);
+
+    for(size_t i = 0; i < queue.size(); ++i)
+    {
+        const std::string cur = queue[i];
+        int wd;
+        int64_t mtime;
+
+        if(m_dirs.find(cur) != m_dirs.end())
+            continue; // Already known (reported twice by the event and by the read)
+
+        // Watch before reading, so nothing gets lost between
+        wd = inotify_add_watch(m_fd, cur.c_str(), DIRMAN_WATCHER_MASK);
+
+        mtime = watcher_dir_mtime(cur, st);
+        if(mtime < 0 || !m_inodes.insert(std::make_pair((uint64_t)st.st_dev, (uint64_t)st.st_ino)).second)
+        {
+            // Gone, or the same directory by another path (symlink loop), the watch belongs to the first one
+            if(wd >= 0 && m_byWd.find(wd) == m_byWd.end())
+                inotify_rm_watch(m_fd, wd);
+            continue;
+        }
+
+        Dir &d = m_dirs[cur];
+        d.path = cur;
+        d.wd = wd;
+        d.mtime = mtime;
+        d.dev = (uint64_t)st.st_dev;
+        d.inode = (uint64_t)st.st_ino;
+
+        if(wd >= 0)
+            m_byWd[wd] = cur;
+        else
+            m_unwatched++; // Over the limit of watches, gets polled
+
+        subDirs.clear();
+        files.clear();
+        walkerReadDir(cur, m_filters, subDirs, files);
+
+        if(events && i > 0)
+            watcher_event(*events, DirMan::WATCH_ADDED, cur, true);
+
+        for(auto &f : files)
+        {
+            if(d.files.insert(f).second && events)
+                watcher_event(*events, DirMan::WATCH_ADDED, watcher_join(cur, f), false);
+        }
+
+        for(auto &s : subDirs)
+        {
+            std::string name = watcher_name(s);
+            d.dirs.insert(name);
+            queue.push_back(watcher_join(cur, name));
+        }
+    }
+}
+
+void DirMan::DirMan_private::Watcher::removeTree(const std::string &path, std::vector<DirMan::WatchEvent> *events)
+{
+    std::string prefix = watcher_join(path, std::string());
+    std::vector<std::string> paths;
+
+    if(m_dirs.find(path) != m_dirs.end())
+        paths.push_back(path);
+
+    for(auto it = m_dirs.lower_bound(prefix); it != m_dirs.end() && it->first.compare(0, prefix.size(), prefix) == 0; ++it)
+        paths.push_back(it->first);
+
+    for(const auto &p : paths)
+    {
+        auto it = m_dirs.find(p);
+        Dir &d = it->second;
+
+        if(events)
+        {
+            for(const auto &f : d.files)
+                watcher_event(*events, DirMan::WATCH_REMOVED, watcher_join(p, f), false);
+            watcher_event(*events, DirMan::WATCH_REMOVED, p, true);
+        }
+
+        if(d.wd >= 0)
+        {
+            inotify_rm_watch(m_fd, d.wd); // Fails if the directory is already deleted, that's fine
+            m_byWd.erase(d.wd);
+        }
+        else
+            m_unwatched--;
+
+        m_inodes.erase(std::make_pair(d.dev, d.inode));
+        m_dirs.erase(it);
+    }
+}
+
+void DirMan::DirMan_private::Watcher::renameTree(const std::string &from, const std::string &to)
+{
+    std::string prefix = watcher_join(from, std::string());
+    std::vector<std::string> paths;
+
+    if(m_dirs.find(from) != m_dirs.end())
+        paths.push_back(from);
+
+    for(auto it = m_dirs.lower_bound(prefix); it != m_dirs.end() && it->first.compare(0, prefix.size(), prefix) == 0; ++it)
+        paths.push_back(it->first);
+
+    for(const auto &p : paths)
+    {
+        auto it = m_dirs.find(p);
+        Dir d = std::move(it->second);
+
+        m_dirs.erase(it);
+        d.path = to + p.substr(from.size());
+        if(d.wd >= 0)
+            m_byWd[d.wd] = d.path;
+        m_dirs[d.path] = std::move(d);
+    }
+}
+
+void DirMan::DirMan_private::Watcher::rescanDir(const std::string &path, std::vector<DirMan::WatchEvent> &events)
+{
+    auto it = m_dirs.find(path);
+    std::vector<PathString> subDirs;
+    std::vector<std::string> files;
+    std::set<std::string> newFiles, newDirs;
+    struct stat st;
+    int64_t mtime;
+
+    if(it == m_dirs.end())
+        return; // Removed by the rescan of the parent
+
+    Dir &d = it->second;
+
+    mtime = watcher_dir_mtime(path, st);
+    if(mtime < 0 || !walkerReadDir(path, m_filters, subDirs, files))
+    {
+        if(path == m_root)
+            removeTree(path, &events);
+        return; // Parent's rescan removes it
+    }
+
+    d.mtime = mtime;
+
+    for(auto &f : files)
+        newFiles.insert(std::move(f));
+    for(auto &s : subDirs)
+        newDirs.insert(watcher_name(s));
+
+    for(const auto &f : d.files)
+    {
+        if(newFiles.find(f) == newFiles.end())
+            watcher_event(events, DirMan::WATCH_REMOVED, watcher_join(path, f), false);
+    }
+
+    for(const auto &f : newFiles)
+    {
+        if(d.files.find(f) == d.files.end())
+            watcher_event(events, DirMan::WATCH_ADDED, watcher_join(path, f), false);
+    }
+
+    // Trees change the map, so the lists get swapped first
+    std::set<std::string> oldDirs;
+    oldDirs.swap(d.dirs);
+    d.files.swap(newFiles);
+    d.dirs = newDirs;
+
+    for(const auto &s : oldDirs)
+    {
+        if(newDirs.find(s) == newDirs.end())
+            removeTree(watcher_join(path, s), &events);
+    }
+
+    for(const auto &s : newDirs)
+    {
+        if(oldDirs.find(s) == oldDirs.end())
+            addTree(watcher_join(path, s), &events);
+    }
+}
+
+void DirMan::DirMan_private::Watcher::rescan(bool all, std::vector<DirMan::WatchEvent> &events)
+{
+    std::vector<std::string> paths;
+    struct stat st;
+
+    for(auto &it : m_dirs)
+    {
+        if(all || it.second.wd < 0)
+            paths.push_back(it.first);
+    }
+
+    // Parents go first, so removed subdirectories are skipped
+    for(const auto &p : paths)
+    {
+        auto it = m_dirs.find(p);
+
+        if(it == m_dirs.end())
+            continue;
+
+        Dir &d = it->second;
+
+        // Some watches may have been freed since
+        if(d.wd < 0)
+        {
+            int wd = inotify_add_watch(m_fd, p.c_str(), DIRMAN_WATCHER_MASK);
+            if(wd >= 0 && m_byWd.find(wd) == m_byWd.end())
+            {
+                d.wd = wd;
+                m_byWd[wd] = p;
+                m_unwatched--;
+            }
+        }
+
+        if(watcher_dir_mtime(p, st) != d.mtime)
+            rescanDir(p, events);
+    }
+}
+
+void DirMan::DirMan_private::Watcher::process(const char *buf, size_t size, std::vector<DirMan::WatchEvent> &events)
+{
+    const char *end = buf + size;
+
+    for(const char *ptr = buf; ptr < end; ptr += sizeof(inotify_event) + ((const inotify_event *)ptr)->len)
+    {
+        const inotify_event *ev = (const inotify_event *)ptr;
+        bool isDir = (ev->mask & IN_ISDIR) != 0;
+
+        if(ev->mask & IN_Q_OVERFLOW)
+        {
+            m_overflow = true;
+            continue;
+        }
+
+        auto w = m_byWd.find(ev->wd);
+        if(w == m_byWd.end())
+            continue; // Removed already
+
+        const std::string dirPath = w->second;
+        auto it = m_dirs.find(dirPath);
+        if(it == m_dirs.end())
+            continue;
+
+        Dir &d = it->second;
+
+        if(ev->mask & IN_IGNORED)
+        {
+            // Watch is gone (deleted or unmounted), the parent's event or the poll takes care of the rest
+            m_byWd.erase(w);
+            d.wd = -1;
+            m_unwatched++;
+            continue;
+        }
+
+        if(ev->mask & IN_DELETE_SELF)
+        {
+            if(dirPath == m_root)
+                removeTree(m_root, &events);
+            continue;
+        }
+
+        if(ev->len == 0)
+            continue;
+
+        const std::string name = ev->name;
+        const std::string path = watcher_join(dirPath, name);
+
+        if(ev->mask & IN_CREATE)
+        {
+            // Files are reported once they are written
+            if(isDir && d.dirs.insert(name).second)
+                addTree(path, &events);
+        }
+        else if(ev->mask & IN_CLOSE_WRITE)
+        {
+            if(!isDir && matchSuffixFilters(name, m_filters) && d.files.insert(name).second)
+                watcher_event(events, DirMan::WATCH_ADDED, path, false);
+        }
+        else if(ev->mask & IN_DELETE)
+        {
+            if(d.files.erase(name))
+                watcher_event(events, DirMan::WATCH_REMOVED, path, false);
+            if(d.dirs.erase(name)) // Also symlinks to directories
+                removeTree(path, &events);
+        }
+        else if(ev->mask & IN_MOVED_FROM)
+        {
+            MovedFrom m;
+            m.cookie = ev->cookie;
+            m.path = path;
+            m.isDir = isDir;
+            m.known = isDir ? d.dirs.erase(name) != 0 : d.files.erase(name) != 0;
+            m_moved.push_back(m);
+        }
+        else if(ev->mask & IN_MOVED_TO)
+        {
+            bool paired = false;
+            MovedFrom from;
+
+            for(auto m = m_moved.begin(); m != m_moved.end(); ++m)
+            {
+                if(m->cookie == ev->cookie)
+                {
+                    from = *m;
+                    m_moved.erase(m);
+                    paired = true;
+                    break;
+                }
+            }
+
+            if(isDir)
+            {
+                // Replaced directory was empty
+                if(d.dirs.insert(name).second == false)
+                    removeTree(path, &events);
+
+                if(paired && from.known)
+                {
+                    renameTree(from.path, path);
+                    watcher_event(events, DirMan::WATCH_RENAMED, from.path, true, path);
+                }
+                else
+                    addTree(path, &events);
+            }
+            else
+            {
+                bool match = matchSuffixFilters(name, m_filters);
+
+                if(match)
+                    d.files.insert(name);
+
+                if(paired && from.known && match)
+                    watcher_event(events, DirMan::WATCH_RENAMED, from.path, false, path);
+                else if(paired && from.known)
+                    watcher_event(events, DirMan::WATCH_REMOVED, from.path, false);
+                else if(match)
+                    watcher_event(events, DirMan::WATCH_ADDED, path, false);
+            }
+        }
+    }
+}
+
+void DirMan::DirMan_private::Watcher::flushMoved(std::vector<DirMan::WatchEvent> &events)
+{
+    for(const auto &m : m_moved)
+    {
+        if(!m.known)
+            continue;
+
+        if(m.isDir)
+            removeTree(m.path, &events);
+        else
+            watcher_event(events, DirMan::WATCH_REMOVED, m.path, false);
+    }
+
+    m_moved.clear();
+}
+
+bool DirMan::DirMan_private::Watcher::fetch(std::vector<DirMan::WatchEvent> &events, int timeoutMs)
+{
+    alignas(inotify_event) char buf[64 * 1024];
+
+    events.clear();
+
+    if(m_fd < 0)
+        return false;
+
+    do
+    {
+        struct pollfd p;
+        int timeout = timeoutMs;
+        uint64_t now;
+
+        // Unwatched directories have to be polled in time
+        if(m_unwatched > 0 && (timeout < 0 || timeout > DIRMAN_WATCHER_POLL_MS))
+            timeout = DIRMAN_WATCHER_POLL_MS;
+
+        p.fd = m_fd;
+        p.events = POLLIN;
+        p.revents = 0;
+
+        if(poll(&p, 1, timeout) > 0)
+        {
+            ssize_t got;
+
+            while((got = read(m_fd, buf, sizeof(buf))) > 0)
+                process(buf, (size_t)got, events);
+        }
+
+        flushMoved(events);
+
+        now = watcher_clock_ms();
+
+        if(m_overflow)
+        {
+            m_overflow = false;
+            m_lastPoll = now;
+            rescan(true, events);
+        }
+        else if(m_unwatched > 0 && now - m_lastPoll >= DIRMAN_WATCHER_POLL_MS)
+        {
+            m_lastPoll = now;
+            rescan(false, events);
+        }
+    } while(timeoutMs < 0 && events.empty());
+
+    return true;
+}
+
+#endif // DIRMAN_HAS_WATCHER
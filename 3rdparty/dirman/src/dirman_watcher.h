@@ -0,0 +1,133 @@
+/*
+ * DirMan - A small crossplatform class to manage directories
+ *
+ * Copyright (c) 2017-2025 Vitaliy Novichkov <admin@wohlnet.ru>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation the
+ * rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+ * sell copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef DIRMAN_WATCHER_H
+#define DIRMAN_WATCHER_H
+
+#include "dirman_private.h"
+
+#ifdef DIRMAN_HAS_WATCHER
+
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <utility>
+#include <stdint.h>
+
+//! How often directories left without watch get rescanned
+#define DIRMAN_WATCHER_POLL_MS 5000
+
+/**
+ * Watches the directory tree by inotify
+ *
+ * Every directory gets its own watch and remembers its matching files and subdirectories,
+ * so events can be filtered, and removed or renamed directories are known with everything
+ * inside of them. When the system's limit of watches is reached, the rest of directories
+ * are polled instead. The overflow of the event queue loses events of every watch,
+ * so then the whole tree is checked, and directories whose modification time has
+ * changed since they have been read are read again and compared with what was known.
+ */
+class DirMan::DirMan_private::Watcher
+{
+    struct Dir
+    {
+        std::string             path;
+        //! Watch descriptor, -1 if it's not watched
+        int                     wd = -1;
+        //! Modification time at the last read (in nanoseconds)
+        int64_t                 mtime = 0;
+        uint64_t                dev = 0;
+        uint64_t                inode = 0;
+        //! Matching files
+        std::set<std::string>   files;
+        //! Names of subdirectories
+        std::set<std::string>   dirs;
+    };
+
+    //! Entry moved out by IN_MOVED_FROM, waiting for the IN_MOVED_TO pair
+    struct MovedFrom
+    {
+        uint32_t    cookie;
+        std::string path;
+        bool        isDir;
+        //! Known file matching filters, or known directory
+        bool        known;
+    };
+
+    std::vector<std::string>    m_filters;
+    std::string                 m_root;
+    int                         m_fd = -1;
+
+    //! Directories by paths, so everything inside of the directory follows it
+    std::map<std::string, Dir>  m_dirs;
+    std::unordered_map<int, std::string> m_byWd;
+    //! Device and inode of every known directory, to skip symlink loops
+    std::set<std::pair<uint64_t, uint64_t> > m_inodes;
+
+    //! Directories which have no watch
+    size_t                      m_unwatched = 0;
+    uint64_t                    m_lastPoll = 0;
+    //! Events have been lost, the tree needs the rescan
+    bool                        m_overflow = false;
+
+    std::vector<MovedFrom>      m_moved;
+
+    //! Watch and read the directory and everything inside of it
+    void addTree(const std::string &path, std::vector<DirMan::WatchEvent> *events);
+    //! Forget the directory and everything inside of it
+    void removeTree(const std::string &path, std::vector<DirMan::WatchEvent> *events);
+    //! Rename the directory and everything inside of it
+    void renameTree(const std::string &from, const std::string &to);
+    //! Read the directory again and report the difference
+    void rescanDir(const std::string &path, std::vector<DirMan::WatchEvent> &events);
+    //! Rescan directories changed since they have been read (only unwatched ones, or all of them)
+    void rescan(bool all, std::vector<DirMan::WatchEvent> &events);
+    //! Handle events read from inotify
+    void process(const char *buf, size_t size, std::vector<DirMan::WatchEvent> &events);
+    //! Moves without the pair have left the tree
+    void flushMoved(std::vector<DirMan::WatchEvent> &events);
+
+public:
+    Watcher();
+    ~Watcher();
+
+    Watcher(const Watcher &) = delete;
+    Watcher &operator=(const Watcher &) = delete;
+
+    /**
+     * @brief Start watching
+     * @param root Directory to watch
+     * @param suffix_filters lower-cased suffix filters
+     * @return false if inotify is unavailable or the directory can't be read
+     */
+    bool start(const std::string &root, const std::vector<std::string> &suffix_filters);
+
+    //! Same as DirMan::fetchWatchEvents()
+    bool fetch(std::vector<DirMan::WatchEvent> &events, int timeoutMs);
+};
+
+#endif // DIRMAN_HAS_WATCHER
+
+#endif // DIRMAN_WATCHER_H
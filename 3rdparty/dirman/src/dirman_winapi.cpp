@@ -168,28 +168,15 @@ bool DirMan::DirMan_private::getListOfFolders(std::vector<std::string> &list, co
     return true;
 }
 
-bool DirMan::DirMan_private::fetchListFromWalker(std::string &curPath, std::vector<std::string> &list)
+bool DirMan::DirMan_private::walkerReadDir(const PathString &path, const std::vector<std::string> &suffix_filters,
+                                           std::vector<PathString> &dirs, std::vector<std::string> &files)
 {
-#ifdef PGE_USE_ARCHIVES
-    // unsupported for now
-    if(Archives::has_prefix(m_dirPath))
-        return false;
-#endif // PGE_USE_ARCHIVES
-
-    if(m_walkerState.digStack.empty())
-        return false;
-
-    list.clear();
-
-    std::wstring path = m_walkerState.digStack.top();
-    m_walkerState.digStack.pop();
-
     HANDLE hFind;
     WIN32_FIND_DATAW data;
 
     hFind = FindFirstFileW((path + L"/*").c_str(), &data);
     if(hFind == INVALID_HANDLE_VALUE)
-        return true; //Can't read this directory. Continue
+        return false;
     do
     {
         if((data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0)
@@ -197,18 +184,51 @@ bool DirMan::DirMan_private::fetchListFromWalker(std::string &curPath, std::vect
             if((wcscmp(data.cFileName, L"..") == 0) || (wcscmp(data.cFileName, L".") == 0))
                 continue;
 
-            m_walkerState.digStack.push(path + L"/" + data.cFileName);
+            dirs.push_back(path + L"/" + data.cFileName);
         }
         else
         {
             std::string fileNameU = WStr2Str(data.cFileName);
-            if(matchSuffixFilters(fileNameU, m_walkerState.suffix_filters))
-                list.push_back(fileNameU);
+            if(matchSuffixFilters(fileNameU, suffix_filters))
+                files.push_back(fileNameU);
         }
     }
     while(FindNextFileW(hFind, &data));
 
     FindClose(hFind);
+
+    return true;
+}
+
+std::string DirMan::DirMan_private::walkerPathString(const PathString &path)
+{
+    return WStr2Str(path);
+}
+
+bool DirMan::DirMan_private::fetchListFromWalker(std::string &curPath, std::vector<std::string> &list)
+{
+#ifdef PGE_USE_ARCHIVES
+    // unsupported for now
+    if(Archives::has_prefix(m_dirPath))
+        return false;
+#endif // PGE_USE_ARCHIVES
+
+    std::vector<std::wstring> dirs;
+
+    if(m_walkerState.digStack.empty())
+        return false;
+
+    list.clear();
+
+    std::wstring path = m_walkerState.digStack.top();
+    m_walkerState.digStack.pop();
+
+    if(!walkerReadDir(path, m_walkerState.suffix_filters, dirs, list))
+        return true; //Can't read this directory. Continue
+
+    for(auto &d : dirs)
+        m_walkerState.digStack.push(std::move(d));
+
     curPath = WStr2Str(path);
 
     return true;
@@ -30,6 +30,26 @@ int main(int , char *[])
         std::cout.flush();
     }
 
+    std::cout << "=============Running test 3.1 (walk in the subdirectories by several threads)=============" << std::endl;
+    size_t seqCount = 0, parCount = 0;
+
+    myDir.beginWalking(filters);
+    while(myDir.fetchListFromWalker(itPath, files))
+        seqCount += files.size();
+
+    myDir.beginWalkingParallel(filters, 4, true);
+    while(myDir.fetchListFromWalker(itPath, files))
+    {
+        for(std::string &file : files)
+            std::cout << itPath + "/" + file << std::endl;
+        parCount += files.size();
+    }
+
+    if(seqCount == parCount)
+        std::cout << "parallel walk Ok!" << std::endl;
+    else
+        std::cout << "parallel walk FAILED! (" << parCount << " files instead of " << seqCount << ")" << std::endl;
+
     std::cout << "=============Running test 4 (Create and delete single directory)=============" << std::endl;
     if(myDir.mkdir("Directory which must not exist!!!"))
         std::cout << "mkdir Ok!" << std::endl;
@@ -65,5 +85,42 @@ int main(int , char *[])
     else
         std::cout << "rmpath FAILED!" << std::endl;
 
+    std::cout << "=============Running test 6 (watch the directory for changes)=============" << std::endl;
+    myDir.mkpath("Watched directory which must not exist!!!/sub");
+    DirMan watched(myDir.absolutePath() + "/Watched directory which must not exist!!!");
+
+    if(watched.beginWatching(filters))
+    {
+        std::vector<DirMan::WatchEvent> events;
+        size_t got = 0;
+        const std::string base = watched.absolutePath();
+        const char *types[] = {"added", "removed", "renamed"};
+
+        FILE *f = fopen((base + "/sub/new.txt").c_str(), "w");
+        if(f)
+            fclose(f);
+        rename((base + "/sub/new.txt").c_str(), (base + "/renamed.txt").c_str());
+        rename((base + "/sub").c_str(), (base + "/moved").c_str());
+        remove((base + "/renamed.txt").c_str());
+
+        while(got < 4 && watched.fetchWatchEvents(events, 1000) && !events.empty())
+        {
+            for(auto &e : events)
+                std::cout << types[e.type] << (e.isDir ? " directory " : " ") << e.path << " " << e.newPath << std::endl;
+            got += events.size();
+        }
+
+        if(got == 4)
+            std::cout << "watch Ok!" << std::endl;
+        else
+            std::cout << "watch FAILED! (" << got << " events instead of 4)" << std::endl;
+
+        watched.endWatching();
+    }
+    else
+        std::cout << "watch is not supported" << std::endl;
+
+    myDir.rmpath("Watched directory which must not exist!!!");
+
     return 0;
 }
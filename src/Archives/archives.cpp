@@ -0,0 +1,150 @@
+#include <SDL2/SDL_error.h>
+
+#include <map>
+#include <memory>
+#include <mutex>
+
+#include "archives.h"
+#include "../zip_archive.h"
+
+namespace Archives
+{
+
+static std::mutex s_archivesMutex;
+//! Opened archives by path, failed ones are kept as nullptr to not retry them
+static std::map<std::string, std::shared_ptr<ZipArchive>> s_archives;
+
+/**
+ * @brief Split the path into the archive and the inner path
+ * @return true if path is valid
+ */
+static bool split_path(const std::string &path, std::string &archive, std::string &inner)
+{
+    size_t sep;
+
+    if(!has_prefix(path))
+        return false;
+
+    // Skip the drive letter ("@C:/...")
+    sep = path.find(':', path.size() > 3 && path[2] == ':' ? 3 : 1);
+    if(sep == std::string::npos || sep == 1)
+        return false;
+
+    archive = path.substr(1, sep - 1);
+    inner = path.substr(sep + 1);
+
+    return true;
+}
+
+static std::shared_ptr<ZipArchive> get_archive(const std::string &archive)
+{
+    std::lock_guard<std::mutex> guard(s_archivesMutex);
+    auto it = s_archives.find(archive);
+
+    if(it != s_archives.end())
+        return it->second;
+
+    std::shared_ptr<ZipArchive> a = std::make_shared<ZipArchive>();
+    if(!a->open(archive))
+        a.reset();
+
+    s_archives[archive] = a;
+
+    return a;
+}
+
+bool has_prefix(const std::string &path)
+{
+    return path.size() > 1 && path[0] == '@';
+}
+
+std::vector<dir_entry_t> list_dir(const char *path)
+{
+    std::vector<dir_entry_t> ret;
+    std::vector<std::string> files, dirs;
+    std::shared_ptr<ZipArchive> a;
+    std::string archive, inner;
+
+    if(!split_path(path, archive, inner) || !(a = get_archive(archive)))
+        return ret;
+
+    a->list(inner, files, dirs);
+    ret.reserve(files.size() + dirs.size());
+
+    for(auto &d : dirs)
+        ret.push_back(dir_entry_t{std::move(d), PATH_DIR});
+
+    for(auto &f : files)
+        ret.push_back(dir_entry_t{std::move(f), PATH_FILE});
+
+    return ret;
+}
+
+PathType exists(const char *path)
+{
+    std::shared_ptr<ZipArchive> a;
+    std::string archive, inner;
+
+    if(!split_path(path, archive, inner) || !(a = get_archive(archive)))
+        return PATH_NONE;
+
+    if(a->find(inner))
+        return PATH_FILE;
+
+    return a->isDir(inner) ? PATH_DIR : PATH_NONE;
+}
+
+SDL_RWops *open_file(const char *path)
+{
+    std::shared_ptr<ZipArchive> a;
+    std::string archive, inner;
+    const ZipArchive::Entry *e;
+
+    if(!split_path(path, archive, inner))
+    {
+        SDL_SetError("Invalid archive path %s", path);
+        return nullptr;
+    }
+
+    if(!(a = get_archive(archive)))
+    {
+        SDL_SetError("Can't open the archive %s", archive.c_str());
+        return nullptr;
+    }
+
+    if(!(e = a->find(inner)))
+    {
+        SDL_SetError("No file %s in the archive %s", inner.c_str(), archive.c_str());
+        return nullptr;
+    }
+
+    return a->openEntry(*e);
+}
+
+bool map_file(const char *path, const void **data, size_t *size)
+{
+    std::shared_ptr<ZipArchive> a;
+    std::string archive, inner;
+    const ZipArchive::Entry *e;
+    const uint8_t *p;
+
+    if(!split_path(path, archive, inner) || !(a = get_archive(archive)) || !(e = a->find(inner)))
+        return false;
+
+    if(!(p = a->storedData(*e)))
+        return false;
+
+    *data = p;
+    *size = (size_t)e->size;
+
+    return true;
+}
+
+void close_all()
+{
+    std::lock_guard<std::mutex> guard(s_archivesMutex);
+    // Entries being read keep their archives alive
+    s_archives.clear();
+}
+
+} // namespace Archives
@@ -0,0 +1,65 @@
+#ifndef ARCHIVES_H
+#define ARCHIVES_H
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+struct SDL_RWops;
+
+/**
+ * Access to files inside of ZIP archives
+ *
+ * Paths inside of archives look like "@/path/to/pack.zip:/dir/file.avi",
+ * archives get opened on the first access and stay open until close_all().
+ */
+namespace Archives
+{
+
+enum PathType
+{
+    PATH_NONE = 0,
+    PATH_FILE,
+    PATH_DIR
+};
+
+struct dir_entry_t
+{
+    std::string name;
+    PathType    type;
+};
+
+//! Does the path point inside of an archive
+bool has_prefix(const std::string &path);
+
+/**
+ * @brief List the directory inside of the archive
+ * @param path Path of the directory
+ * @return files and subdirectories
+ */
+std::vector<dir_entry_t> list_dir(const char *path);
+
+PathType exists(const char *path);
+
+/**
+ * @brief Open the file inside of the archive
+ * @param path Path of the file
+ * @return seekable RWops, or nullptr on error
+ */
+SDL_RWops *open_file(const char *path);
+
+/**
+ * @brief Get the file's data without copying (stored entries of memory-mapped archives only)
+ * @param path Path of the file
+ * @param data Pointer to the data, valid until close_all()
+ * @param size Size of the data
+ * @return true if data can be accessed directly
+ */
+bool map_file(const char *path, const void **data, size_t *size);
+
+//! Close all archives, data got by map_file() becomes invalid
+void close_all();
+
+} // namespace Archives
+
+#endif // ARCHIVES_H
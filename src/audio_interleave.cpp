@@ -0,0 +1,251 @@
+#include <string.h>
+
+#include "audio_interleave.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#   define AUDIO_INTERLEAVE_SSE2
+#   include <emmintrin.h>
+#endif
+
+static inline int16_t flt_to_s16(float v)
+{
+    float s = v * 32768.0f;
+
+    if(s >= 32767.0f)
+        return 32767;
+    else if(s <= -32768.0f)
+        return -32768;
+
+    return (int16_t)(s < 0.0f ? s - 0.5f : s + 0.5f);
+}
+
+/* ------------------------------------------------------------------------- */
+/*                        Generic kernels (any CPU)                          */
+/* ------------------------------------------------------------------------- */
+
+template<typename T, int CH>
+struct Interleave
+{
+    static void run(const T *const *src, T *dst, int samples)
+    {
+        for(int i = 0; i < samples; ++i)
+        {
+            for(int c = 0; c < CH; ++c)
+                *dst++ = src[c][i];
+        }
+    }
+};
+
+template<int CH>
+struct InterleaveFltS16
+{
+    static void run(const float *const *src, int16_t *dst, int samples)
+    {
+        for(int i = 0; i < samples; ++i)
+        {
+            for(int c = 0; c < CH; ++c)
+                *dst++ = flt_to_s16(src[c][i]);
+        }
+    }
+};
+
+template<typename T>
+struct Interleave<T, 1>
+{
+    static void run(const T *const *src, T *dst, int samples)
+    {
+        memcpy(dst, src[0], sizeof(T) * samples);
+    }
+};
+
+/* ------------------------------------------------------------------------- */
+/*                              SSE2 kernels                                 */
+/* ------------------------------------------------------------------------- */
+
+#ifdef AUDIO_INTERLEAVE_SSE2
+template<>
+struct Interleave<float, 2>
+{
+    static void run(const float *const *src, float *dst, int samples)
+    {
+        const float *l = src[0], *r = src[1];
+        int i = 0;
+
+        for(; i + 4 <= samples; i += 4)
+        {
+            __m128 vl = _mm_loadu_ps(l + i);
+            __m128 vr = _mm_loadu_ps(r + i);
+            _mm_storeu_ps(dst,     _mm_unpacklo_ps(vl, vr));
+            _mm_storeu_ps(dst + 4, _mm_unpackhi_ps(vl, vr));
+            dst += 8;
+        }
+
+        for(; i < samples; ++i)
+        {
+            *dst++ = l[i];
+            *dst++ = r[i];
+        }
+    }
+};
+
+template<>
+struct Interleave<int16_t, 2>
+{
+    static void run(const int16_t *const *src, int16_t *dst, int samples)
+    {
+        const int16_t *l = src[0], *r = src[1];
+        int i = 0;
+
+        for(; i + 8 <= samples; i += 8)
+        {
+            __m128i vl = _mm_loadu_si128((const __m128i*)(l + i));
+            __m128i vr = _mm_loadu_si128((const __m128i*)(r + i));
+            _mm_storeu_si128((__m128i*)dst,       _mm_unpacklo_epi16(vl, vr));
+            _mm_storeu_si128((__m128i*)(dst + 8), _mm_unpackhi_epi16(vl, vr));
+            dst += 16;
+        }
+
+        for(; i < samples; ++i)
+        {
+            *dst++ = l[i];
+            *dst++ = r[i];
+        }
+    }
+};
+
+template<>
+struct Interleave<float, 6>
+{
+    static void run(const float *const *src, float *dst, int samples)
+    {
+        int i = 0;
+
+        for(; i + 4 <= samples; i += 4)
+        {
+            __m128 c0 = _mm_loadu_ps(src[0] + i);
+            __m128 c1 = _mm_loadu_ps(src[1] + i);
+            __m128 c2 = _mm_loadu_ps(src[2] + i);
+            __m128 c3 = _mm_loadu_ps(src[3] + i);
+            __m128 c4 = _mm_loadu_ps(src[4] + i);
+            __m128 c5 = _mm_loadu_ps(src[5] + i);
+
+            // Channels 0-3 of every sample
+            _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+            // Channels 4-5 of samples 0-1 and 2-3
+            __m128 lo = _mm_unpacklo_ps(c4, c5);
+            __m128 hi = _mm_unpackhi_ps(c4, c5);
+
+            _mm_storeu_ps(dst, c0);
+            _mm_storel_pi((__m64*)(dst + 4), lo);
+            _mm_storeu_ps(dst + 6, c1);
+            _mm_storeh_pi((__m64*)(dst + 10), lo);
+            _mm_storeu_ps(dst + 12, c2);
+            _mm_storel_pi((__m64*)(dst + 16), hi);
+            _mm_storeu_ps(dst + 18, c3);
+            _mm_storeh_pi((__m64*)(dst + 22), hi);
+            dst += 24;
+        }
+
+        for(; i < samples; ++i)
+        {
+            for(int c = 0; c < 6; ++c)
+                *dst++ = src[c][i];
+        }
+    }
+};
+
+static inline __m128i flt_to_s16_x8(__m128 a, __m128 b)
+{
+    const __m128 scale = _mm_set1_ps(32768.0f);
+    // Saturation is done by the pack instruction
+    return _mm_packs_epi32(_mm_cvtps_epi32(_mm_mul_ps(a, scale)),
+                           _mm_cvtps_epi32(_mm_mul_ps(b, scale)));
+}
+
+template<>
+struct InterleaveFltS16<1>
+{
+    static void run(const float *const *src, int16_t *dst, int samples)
+    {
+        const float *m = src[0];
+        int i = 0;
+
+        for(; i + 8 <= samples; i += 8)
+        {
+            _mm_storeu_si128((__m128i*)dst, flt_to_s16_x8(_mm_loadu_ps(m + i), _mm_loadu_ps(m + i + 4)));
+            dst += 8;
+        }
+
+        for(; i < samples; ++i)
+            *dst++ = flt_to_s16(m[i]);
+    }
+};
+
+template<>
+struct InterleaveFltS16<2>
+{
+    static void run(const float *const *src, int16_t *dst, int samples)
+    {
+        const float *l = src[0], *r = src[1];
+        int i = 0;
+
+        for(; i + 8 <= samples; i += 8)
+        {
+            __m128i vl = flt_to_s16_x8(_mm_loadu_ps(l + i), _mm_loadu_ps(l + i + 4));
+            __m128i vr = flt_to_s16_x8(_mm_loadu_ps(r + i), _mm_loadu_ps(r + i + 4));
+            _mm_storeu_si128((__m128i*)dst,       _mm_unpacklo_epi16(vl, vr));
+            _mm_storeu_si128((__m128i*)(dst + 8), _mm_unpackhi_epi16(vl, vr));
+            dst += 16;
+        }
+
+        for(; i < samples; ++i)
+        {
+            *dst++ = flt_to_s16(l[i]);
+            *dst++ = flt_to_s16(r[i]);
+        }
+    }
+};
+#endif // AUDIO_INTERLEAVE_SSE2
+
+/* ------------------------------------------------------------------------- */
+
+template<int CH>
+static bool interleave_ch(enum AVSampleFormat in, enum AVSampleFormat out,
+                          const uint8_t *const *src, uint8_t *dst, int samples)
+{
+    if(in == AV_SAMPLE_FMT_FLTP && out == AV_SAMPLE_FMT_FLT)
+        Interleave<float, CH>::run((const float *const *)src, (float *)dst, samples);
+    else if(in == AV_SAMPLE_FMT_FLTP && out == AV_SAMPLE_FMT_S16)
+        InterleaveFltS16<CH>::run((const float *const *)src, (int16_t *)dst, samples);
+    else if(in == AV_SAMPLE_FMT_S16P && out == AV_SAMPLE_FMT_S16)
+        Interleave<int16_t, CH>::run((const int16_t *const *)src, (int16_t *)dst, samples);
+    else
+        return false;
+
+    return true;
+}
+
+bool audio_interleave_supported(enum AVSampleFormat in, enum AVSampleFormat out, int channels)
+{
+    if(channels != 1 && channels != 2 && channels != 6)
+        return false;
+
+    return (in == AV_SAMPLE_FMT_FLTP && (out == AV_SAMPLE_FMT_FLT || out == AV_SAMPLE_FMT_S16)) ||
+           (in == AV_SAMPLE_FMT_S16P && out == AV_SAMPLE_FMT_S16);
+}
+
+bool audio_interleave(enum AVSampleFormat in, enum AVSampleFormat out, int channels,
+                      const uint8_t *const *src, uint8_t *dst, int samples)
+{
+    switch(channels)
+    {
+    case 1:
+        return interleave_ch<1>(in, out, src, dst, samples);
+    case 2:
+        return interleave_ch<2>(in, out, src, dst, samples);
+    case 6:
+        return interleave_ch<6>(in, out, src, dst, samples);
+    default:
+        return false;
+    }
+}
@@ -0,0 +1,35 @@
+#ifndef AUDIO_INTERLEAVE_H
+#define AUDIO_INTERLEAVE_H
+
+#include <stdint.h>
+
+extern "C"
+{
+#include <libavutil/samplefmt.h>
+}
+
+/**
+ * @brief Check if there is a fast kernel to interleave planar samples
+ * @param in Planar format of the input
+ * @param out Interleaved format of the output
+ * @param channels Number of channels
+ * @return true if audio_interleave() can process this combination
+ */
+bool audio_interleave_supported(enum AVSampleFormat in, enum AVSampleFormat out, int channels);
+
+/**
+ * @brief Interleave planar samples without resampling (replacement for the swr_convert at trivial cases)
+ * @param in Planar format of the input
+ * @param out Interleaved format of the output
+ * @param channels Number of channels
+ * @param src Array of channel planes
+ * @param dst Output buffer, must fit samples * channels samples of output format
+ * @param samples Number of samples per channel
+ * @return false if the combination is not supported
+ *
+ * Supported combinations are FLTP to FLT or S16, and S16P to S16, with 1, 2 and 6 channels.
+ */
+bool audio_interleave(enum AVSampleFormat in, enum AVSampleFormat out, int channels,
+                      const uint8_t *const *src, uint8_t *dst, int samples);
+
+#endif // AUDIO_INTERLEAVE_H
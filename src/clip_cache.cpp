@@ -0,0 +1,249 @@
+#include <string.h>
+
+#include "clip_cache.h"
+
+//! Shortest run of unchanged bytes worth to break the literal
+#define CLIP_PACK_MIN_SKIP 4
+#define CLIP_PACK_MAX_RUN  0xFFFF
+
+/*
+ * Packed frame is a sequence of chunks:
+ * uint16 count of unchanged bytes, uint16 count of changed bytes, changed bytes XOR previous frame
+ */
+
+static inline void pack_put16(std::vector<uint8_t> &out, uint16_t v)
+{
+    out.push_back((uint8_t)(v & 0xFF));
+    out.push_back((uint8_t)(v >> 8));
+}
+
+static inline uint16_t pack_get16(const uint8_t *in)
+{
+    return (uint16_t)(in[0] | (in[1] << 8));
+}
+
+static bool pack_delta(const uint8_t *cur, const uint8_t *prev, size_t size, std::vector<uint8_t> &out)
+{
+    size_t i = 0;
+
+    out.clear();
+    out.reserve(size / 4);
+
+    while(i < size)
+    {
+        size_t skip = 0, lit = 0, litStart;
+
+        while(i < size && skip < CLIP_PACK_MAX_RUN && cur[i] == prev[i])
+        {
+            ++i;
+            ++skip;
+        }
+
+        litStart = i;
+
+        while(i < size && lit < CLIP_PACK_MAX_RUN)
+        {
+            if(cur[i] == prev[i])
+            {
+                size_t same = 0;
+
+                while(i + same < size && same < CLIP_PACK_MIN_SKIP && cur[i + same] == prev[i + same])
+                    ++same;
+
+                if(same >= CLIP_PACK_MIN_SKIP || i + same == size)
+                    break;
+            }
+
+            ++i;
+            ++lit;
+        }
+
+        pack_put16(out, (uint16_t)skip);
+        pack_put16(out, (uint16_t)lit);
+
+        for(size_t j = litStart; j < litStart + lit; ++j)
+            out.push_back(cur[j] ^ prev[j]);
+
+        if(out.size() >= size)
+            return false; // Not worth it, the frame changes too much
+    }
+
+    return true;
+}
+
+static void unpack_delta(const uint8_t *in, size_t inSize, uint8_t *pixels, size_t size)
+{
+    const uint8_t *end = in + inSize;
+    size_t pos = 0;
+
+    while(in + 4 <= end)
+    {
+        size_t skip = pack_get16(in);
+        size_t lit = pack_get16(in + 2);
+        in += 4;
+
+        pos += skip;
+
+        if(pos + lit > size || in + lit > end)
+            return; // Corrupted
+
+        for(size_t j = 0; j < lit; ++j)
+            pixels[pos++] ^= *in++;
+    }
+}
+
+void CachedClip::addFrame(double time, const uint8_t *pixels, const uint8_t *prev)
+{
+    size_t size = (size_t)pitch * height;
+    Frame f;
+
+    f.time = time;
+
+    if(prev && pack_delta(pixels, prev, size, f.data))
+    {
+        f.packed = true;
+        f.data.shrink_to_fit();
+    }
+    else
+    {
+        f.packed = false;
+        f.data.assign(pixels, pixels + size);
+    }
+
+    memory += f.data.size();
+    frames.push_back(std::move(f));
+}
+
+void CachedClip::unpackFrame(size_t index, uint8_t *pixels) const
+{
+    size_t size = (size_t)pitch * height;
+    const Frame &f = frames[index];
+
+    if(f.packed)
+        unpack_delta(f.data.data(), f.data.size(), pixels, size);
+    else
+        memcpy(pixels, f.data.data(), size);
+}
+
+void CachedClip::addPcm(const uint8_t *data, size_t size)
+{
+    pcm.insert(pcm.end(), data, data + size);
+    memory += size;
+}
+
+/* ------------------------------------------------------------------------- */
+
+//! Size of the clip without packing
+static inline size_t clip_raw_size(const CachedClip &clip)
+{
+    return clip.frames.size() * (size_t)clip.pitch * clip.height + clip.pcm.size();
+}
+
+ClipCache::ClipCache(size_t budget, double maxDuration) :
+    m_budget(budget),
+    m_maxDuration(maxDuration)
+{}
+
+void ClipCache::setBudget(size_t budget)
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+    m_budget = budget;
+    evict(0);
+}
+
+size_t ClipCache::budget() const
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+    return m_budget;
+}
+
+double ClipCache::maxDuration() const
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+    return m_maxDuration;
+}
+
+std::shared_ptr<const CachedClip> ClipCache::find(const std::string &key)
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+
+    auto it = m_index.find(key);
+
+    if(it == m_index.end())
+    {
+        m_stats.misses++;
+        return nullptr;
+    }
+
+    // Move to the front of the LRU list
+    m_lru.splice(m_lru.begin(), m_lru, it->second);
+    m_stats.hits++;
+
+    return it->second->second;
+}
+
+void ClipCache::insert(const std::string &key, const std::shared_ptr<CachedClip> &clip)
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+
+    auto it = m_index.find(key);
+
+    if(!clip || clip->memory > m_budget)
+    {
+        m_stats.rejected++;
+        return;
+    }
+
+    if(it != m_index.end())
+    {
+        m_stats.memory -= it->second->second->memory;
+        m_stats.rawMemory -= clip_raw_size(*it->second->second);
+        m_lru.erase(it->second);
+        m_index.erase(it);
+    }
+
+    evict(clip->memory);
+
+    clip->frames.shrink_to_fit();
+    clip->pcm.shrink_to_fit();
+
+    m_lru.push_front(Entry(key, clip));
+    m_index[key] = m_lru.begin();
+
+    m_stats.memory += clip->memory;
+    m_stats.rawMemory += clip_raw_size(*clip);
+    m_stats.clips = m_lru.size();
+}
+
+void ClipCache::evict(size_t needed)
+{
+    while(!m_lru.empty() && m_stats.memory + needed > m_budget)
+    {
+        const Entry &e = m_lru.back();
+
+        m_stats.memory -= e.second->memory;
+        m_stats.rawMemory -= clip_raw_size(*e.second);
+        m_stats.evictions++;
+
+        m_index.erase(e.first);
+        m_lru.pop_back();
+    }
+
+    m_stats.clips = m_lru.size();
+}
+
+void ClipCache::clear()
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+    m_lru.clear();
+    m_index.clear();
+    m_stats.clips = 0;
+    m_stats.memory = 0;
+    m_stats.rawMemory = 0;
+}
+
+ClipCache::Stats ClipCache::stats() const
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+    return m_stats;
+}
@@ -0,0 +1,133 @@
+#ifndef CLIP_CACHE_H
+#define CLIP_CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+/**
+ * @brief Fully decoded short clip: converted video frames and output-ready PCM
+ */
+struct CachedClip
+{
+    struct Frame
+    {
+        //! Presentation time in seconds
+        double  time = 0.0;
+        //! Frame is stored as a packed difference from the previous frame
+        bool    packed = false;
+        std::vector<uint8_t> data;
+    };
+
+    //! Geometry of the video frames (RGB24)
+    int     width = 0;
+    int     height = 0;
+    int     pitch = 0;
+
+    //! Format of the PCM (matches the output device spec at the recording time)
+    int     freq = 0;
+    uint16_t format = 0;
+    uint8_t channels = 0;
+
+    std::vector<Frame>   frames;
+    std::vector<uint8_t> pcm;
+
+    //! Bytes used by frames and PCM
+    size_t  memory = 0;
+
+    /**
+     * @brief Append the video frame
+     * @param time Presentation time in seconds
+     * @param pixels Frame pixels (pitch * height bytes)
+     * @param prev Pixels of the previous frame, or nullptr if this is the first one
+     */
+    void addFrame(double time, const uint8_t *pixels, const uint8_t *prev);
+
+    /**
+     * @brief Restore the frame
+     * @param index Index of the frame
+     * @param pixels Buffer which holds pixels of the previous frame, gets replaced with the frame
+     *
+     * Packed frames depend on the previous one, so frames must be restored in order.
+     */
+    void unpackFrame(size_t index, uint8_t *pixels) const;
+
+    void addPcm(const uint8_t *data, size_t size);
+};
+
+/**
+ * @brief In-memory cache of decoded short clips (intros, logos, interstitials)
+ *
+ * Clips are kept under the memory budget, the least recently played clips get evicted first.
+ * Thread-safe: the playlist players look clips up while preparing and store them while closing
+ * on the render thread.
+ */
+class ClipCache
+{
+public:
+    struct Stats
+    {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+        //! Clips not stored because they are over the budget or too long
+        uint64_t rejected = 0;
+        size_t   clips = 0;
+        //! Memory used by the stored clips
+        size_t   memory = 0;
+        //! Memory the stored clips would take without packing
+        size_t   rawMemory = 0;
+    };
+
+    /**
+     * @param budget Memory budget in bytes
+     * @param maxDuration Longest clip to cache, in seconds
+     */
+    explicit ClipCache(size_t budget = 64 * 1024 * 1024, double maxDuration = 10.0);
+
+    void setBudget(size_t budget);
+    size_t budget() const;
+    double maxDuration() const;
+
+    /**
+     * @brief Find the clip
+     * @param key Name of the clip (asset name or file path)
+     * @return clip or nullptr on cache miss
+     */
+    std::shared_ptr<const CachedClip> find(const std::string &key);
+
+    /**
+     * @brief Store the completely played clip
+     * @param key Name of the clip
+     * @param clip Recorded clip
+     */
+    void insert(const std::string &key, const std::shared_ptr<CachedClip> &clip);
+
+    void clear();
+
+    Stats stats() const;
+
+private:
+    typedef std::pair<std::string, std::shared_ptr<const CachedClip> > Entry;
+
+    //! Must be called with the mutex locked
+    void evict(size_t needed);
+
+    size_t m_budget;
+    double m_maxDuration;
+
+    //! Most recently used first
+    std::list<Entry> m_lru;
+    std::unordered_map<std::string, std::list<Entry>::iterator> m_index;
+
+    Stats m_stats;
+
+    mutable std::mutex m_mutex;
+};
+
+#endif // CLIP_CACHE_H
@@ -0,0 +1,358 @@
+#include <SDL2/SDL_rwops.h>
+#include <SDL2/SDL_timer.h>
+
+extern "C"
+{
+#include <libavformat/avformat.h>
+}
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "keyframe_index.h"
+
+#define KEYFRAME_INDEX_MAGIC   0x494B5644 /* "DVKI" */
+#define KEYFRAME_INDEX_VERSION 1
+
+struct KeyframeIndexHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    int64_t  fileSize;
+    int64_t  fileMtime;
+    int32_t  stream;
+    uint32_t count;
+};
+
+static bool file_stat(const std::string &file, int64_t &size, int64_t &mtime)
+{
+    struct stat st;
+
+    if(stat(file.c_str(), &st) != 0)
+        return false;
+
+    size = (int64_t)st.st_size;
+    mtime = (int64_t)st.st_mtime;
+
+    return true;
+}
+
+//! Sidecar name is the hash of the media path, so, any path fits the cache directory
+static std::string sidecar_path(const std::string &dir, const std::string &file)
+{
+    uint64_t hash = 14695981039346656037ULL; // FNV-1a
+    char name[32];
+
+    for(unsigned char c : file)
+    {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+
+    SDL_snprintf(name, sizeof(name), "%016llx.kfi", (unsigned long long)hash);
+
+    if(!dir.empty() && dir.back() != '/')
+        return dir + "/" + name;
+
+    return dir + name;
+}
+
+/*
+ * Entries are stored as differences from the previous one:
+ * zig-zag varint of pts, zig-zag varint of pos, varint of size
+ */
+
+static void put_varint(std::vector<uint8_t> &out, uint64_t v)
+{
+    while(v >= 0x80)
+    {
+        out.push_back((uint8_t)(v | 0x80));
+        v >>= 7;
+    }
+
+    out.push_back((uint8_t)v);
+}
+
+static bool get_varint(const uint8_t *&in, const uint8_t *end, uint64_t &v)
+{
+    int shift = 0;
+
+    v = 0;
+
+    while(in < end && shift < 64)
+    {
+        uint8_t b = *in++;
+        v |= (uint64_t)(b & 0x7F) << shift;
+
+        if(!(b & 0x80))
+            return true;
+
+        shift += 7;
+    }
+
+    return false;
+}
+
+static inline uint64_t zigzag(int64_t v)
+{
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static inline int64_t unzigzag(uint64_t v)
+{
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+bool KeyframeIndex::load(const std::string &dir, const std::string &file)
+{
+    KeyframeIndexHeader head;
+    std::vector<uint8_t> data;
+    const uint8_t *in, *end;
+    int64_t size, mtime, pts = 0, pos = 0;
+    SDL_RWops *f;
+    Sint64 fsize;
+
+    clear();
+
+    if(!file_stat(file, size, mtime))
+        return false;
+
+    f = SDL_RWFromFile(sidecar_path(dir, file).c_str(), "rb");
+    if(!f)
+        return false;
+
+    fsize = SDL_RWsize(f);
+    if(fsize < (Sint64)sizeof(head) || SDL_RWread(f, &head, sizeof(head), 1) != 1)
+    {
+        SDL_RWclose(f);
+        return false;
+    }
+
+    if(head.magic != KEYFRAME_INDEX_MAGIC || head.version != KEYFRAME_INDEX_VERSION ||
+       head.fileSize != size || head.fileMtime != mtime)
+    {
+        SDL_RWclose(f);
+        return false; // Outdated
+    }
+
+    data.resize((size_t)(fsize - (Sint64)sizeof(head)));
+    if(!data.empty() && SDL_RWread(f, data.data(), 1, data.size()) != data.size())
+    {
+        SDL_RWclose(f);
+        return false;
+    }
+
+    SDL_RWclose(f);
+
+    // Each entry takes at least three bytes, a larger count can't be real
+    if(head.stream < 0 || head.count > data.size() / 3)
+        return false;
+
+    in = data.data();
+    end = in + data.size();
+    m_entries.reserve(head.count);
+
+    for(uint32_t i = 0; i < head.count; ++i)
+    {
+        uint64_t dPts, dPos, eSize;
+
+        if(!get_varint(in, end, dPts) || !get_varint(in, end, dPos) || !get_varint(in, end, eSize))
+        {
+            clear();
+            return false; // Truncated
+        }
+
+        if(eSize > (uint64_t)INT32_MAX)
+        {
+            clear();
+            return false; // Damaged
+        }
+
+        pts += unzigzag(dPts);
+        pos += unzigzag(dPos);
+        m_entries.push_back(Entry{pts, pos, (int32_t)eSize});
+    }
+
+    m_stream = head.stream;
+
+    return true;
+}
+
+bool KeyframeIndex::save(const std::string &dir, const std::string &file) const
+{
+    KeyframeIndexHeader head;
+    std::vector<uint8_t> data;
+    int64_t size, mtime, pts = 0, pos = 0;
+    std::string path = sidecar_path(dir, file);
+    std::string tmp = path + ".tmp";
+    SDL_RWops *f;
+    bool ok;
+
+    if(m_entries.empty() || !file_stat(file, size, mtime))
+        return false;
+
+    SDL_memset(&head, 0, sizeof(head));
+    head.magic = KEYFRAME_INDEX_MAGIC;
+    head.version = KEYFRAME_INDEX_VERSION;
+    head.fileSize = size;
+    head.fileMtime = mtime;
+    head.stream = m_stream;
+    head.count = (uint32_t)m_entries.size();
+
+    data.reserve(m_entries.size() * 4);
+
+    for(const auto &e : m_entries)
+    {
+        put_varint(data, zigzag(e.pts - pts));
+        put_varint(data, zigzag(e.pos - pos));
+        put_varint(data, (uint64_t)e.size);
+        pts = e.pts;
+        pos = e.pos;
+    }
+
+    f = SDL_RWFromFile(tmp.c_str(), "wb");
+    if(!f)
+        return false;
+
+    ok = SDL_RWwrite(f, &head, sizeof(head), 1) == 1 &&
+         SDL_RWwrite(f, data.data(), 1, data.size()) == data.size();
+
+    SDL_RWclose(f);
+
+    if(!ok || rename(tmp.c_str(), path.c_str()) != 0)
+    {
+        remove(tmp.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+static int index_interrupt(void *opaque)
+{
+    return SDL_AtomicGet((SDL_atomic_t *)opaque);
+}
+
+bool KeyframeIndex::build(const std::string &file, SDL_atomic_t *interrupt, BuildStats *stats)
+{
+    Uint64 start = SDL_GetPerformanceCounter();
+    AVFormatContext *ctx;
+    AVPacket *pkt;
+    int stream;
+
+    clear();
+
+    ctx = avformat_alloc_context();
+    if(!ctx)
+        return false;
+
+    if(interrupt)
+    {
+        ctx->interrupt_callback.callback = index_interrupt;
+        ctx->interrupt_callback.opaque = (void *)interrupt;
+    }
+
+    // Context gets freed on failure
+    if(avformat_open_input(&ctx, file.c_str(), nullptr, nullptr) < 0)
+        return false;
+
+    if(avformat_find_stream_info(ctx, nullptr) < 0)
+    {
+        avformat_close_input(&ctx);
+        return false;
+    }
+
+    // Same choice as the player does
+    stream = av_find_best_stream(ctx, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+    if(stream < 0 || !(pkt = av_packet_alloc()))
+    {
+        avformat_close_input(&ctx);
+        return false;
+    }
+
+    for(unsigned i = 0; i < ctx->nb_streams; ++i)
+    {
+        if((int)i != stream)
+            ctx->streams[i]->discard = AVDISCARD_ALL;
+    }
+
+    m_stream = stream;
+
+    while(av_read_frame(ctx, pkt) >= 0)
+    {
+        if(pkt->stream_index == stream && (pkt->flags & AV_PKT_FLAG_KEY) && pkt->pos >= 0)
+            add(pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts, pkt->pos, pkt->size);
+
+        av_packet_unref(pkt);
+    }
+
+    if(stats)
+    {
+        stats->bytes = ctx->pb ? (uint64_t)avio_tell(ctx->pb) : 0;
+        stats->keyframes = m_entries.size();
+        stats->ms = (double)(SDL_GetPerformanceCounter() - start) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+    }
+
+    av_packet_free(&pkt);
+    avformat_close_input(&ctx);
+
+    if(interrupt && SDL_AtomicGet(interrupt))
+    {
+        clear();
+        return false;
+    }
+
+    return !m_entries.empty();
+}
+
+void KeyframeIndex::add(int64_t pts, int64_t pos, int32_t size)
+{
+    if(pts == AV_NOPTS_VALUE)
+        return;
+
+    if(!m_entries.empty() && m_entries.back().pts >= pts)
+        return; // Not growing, might be a repeated packet
+
+    m_entries.push_back(Entry{pts, pos, size});
+}
+
+void KeyframeIndex::apply(AVStream *st) const
+{
+    for(const auto &e : m_entries)
+        av_add_index_entry(st, e.pos, e.pts, e.size, 0, AVINDEX_KEYFRAME);
+}
+
+const KeyframeIndex::Entry *KeyframeIndex::find(int64_t pts) const
+{
+    size_t lo = 0, hi = m_entries.size();
+
+    // Last entry with the time stamp not greater than target
+    while(lo < hi)
+    {
+        size_t mid = (lo + hi) / 2;
+
+        if(m_entries[mid].pts <= pts)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo > 0 ? &m_entries[lo - 1] : nullptr;
+}
+
+int KeyframeIndex::stream() const
+{
+    return m_stream;
+}
+
+size_t KeyframeIndex::size() const
+{
+    return m_entries.size();
+}
+
+void KeyframeIndex::clear()
+{
+    m_stream = -1;
+    m_entries.clear();
+}
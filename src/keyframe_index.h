@@ -0,0 +1,88 @@
+#ifndef KEYFRAME_INDEX_H
+#define KEYFRAME_INDEX_H
+
+#include <SDL2/SDL_atomic.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+struct AVStream;
+typedef struct AVStream AVStream;
+
+/**
+ * @brief Index of the video key frames (time stamp to the byte offset) of the media file
+ *
+ * Built by the single sequential pass over the file and stored as a compact binary sidecar
+ * at the cache directory, so files without a usable index (AVI without idx1, MPEG-PS)
+ * can be seeked without scanning.
+ */
+class KeyframeIndex
+{
+public:
+    struct Entry
+    {
+        //! Time stamp in the stream's time base
+        int64_t pts;
+        //! Byte offset of the packet
+        int64_t pos;
+        int32_t size;
+    };
+
+    struct BuildStats
+    {
+        //! Time spent by the pass in milliseconds
+        double   ms = 0.0;
+        //! Bytes read by the pass
+        uint64_t bytes = 0;
+        size_t   keyframes = 0;
+    };
+
+    /**
+     * @brief Load the sidecar of the file
+     * @param dir Cache directory
+     * @param file Path of the media file
+     * @return true if sidecar exists and matches the file's size and modification time
+     */
+    bool load(const std::string &dir, const std::string &file);
+
+    /**
+     * @brief Write the sidecar of the file
+     * @param dir Cache directory (must exist)
+     * @param file Path of the media file
+     * @return true on success
+     */
+    bool save(const std::string &dir, const std::string &file) const;
+
+    /**
+     * @brief Scan the whole file and collect key frames of its video stream
+     * @param file Path of the media file
+     * @param interrupt Non-zero value interrupts the pass (checked while reading)
+     * @param stats Statistics of the pass (optional)
+     * @return true if the pass has been completed
+     */
+    bool build(const std::string &file, SDL_atomic_t *interrupt, BuildStats *stats = nullptr);
+
+    //! Add the key frame, time stamps must grow
+    void add(int64_t pts, int64_t pos, int32_t size);
+
+    //! Put all entries into the demuxer's index of the stream
+    void apply(AVStream *st) const;
+
+    /**
+     * @brief Find the key frame to start decoding from
+     * @param pts Target time stamp in the stream's time base
+     * @return last key frame at or before the target, or nullptr if there is none
+     */
+    const Entry *find(int64_t pts) const;
+
+    //! Index of the indexed stream at the container
+    int stream() const;
+    size_t size() const;
+    void clear();
+
+private:
+    int m_stream = -1;
+    std::vector<Entry> m_entries;
+};
+
+#endif // KEYFRAME_INDEX_H
@@ -1,6 +1,11 @@
 #include <SDL2/SDL.h>
 #include <DirManager/dirman.h>
 #include "video_player.h"
+#include "video_playlist.h"
+#include "probe_cache.h"
+#include "clip_cache.h"
+#include "media_library.h"
+#include "Archives/archives.h"
 extern "C"
 {
 #include "../res/noise.h"
@@ -8,66 +13,231 @@ extern "C"
 
 static bool stopAlles = false;
 
-static void videoLoop(const std::string &video, DerVideoPlayer& player, SDL_Renderer *render, SDL_Window *window)
+static const std::vector<std::string> s_videoFilters = {".avi", ".mpg", ".avd"};
+
+static void nextAudioTrack(DerVideoPlayer &player)
 {
-    SDL_Event event;
-    SDL_RWops *vFile;
-    SDL_Log("Trying open video: %s", video.c_str());
+    auto tracks = player.audioTracks();
+    int cur = player.audioTrack();
+
+    if(tracks.size() < 2)
+        return;
+
+    for(size_t i = 0; i < tracks.size(); ++i)
+    {
+        if(tracks[i].stream == cur)
+        {
+            const auto &next = tracks[(i + 1) % tracks.size()];
+            SDL_Log("Switching audio track to %d (%s)", next.stream, next.language.c_str());
+            player.setAudioTrack(next.stream);
+            break;
+        }
+    }
+}
+
+static void logIOStats(DerVideoPlayer &player)
+{
+    auto io = player.ioStats();
+    SDL_Log("I/O: buffer %u bytes (recommended %u), %llu reads, %llu bytes per read, %llu seeks%s",
+            (unsigned)io.bufferSize, (unsigned)io.recommendedBufferSize,
+            (unsigned long long)io.reads,
+            (unsigned long long)(io.reads ? io.bytes / io.reads : 0),
+            (unsigned long long)io.seeks, io.streaming ? " (streaming)" : "");
+    if(io.dualCursor)
+        SDL_Log("I/O: badly interleaved, dual cursor reading avoided %llu seeks", (unsigned long long)io.seeksAvoided);
+}
+
+static void appendVideo(DerVideoPlaylist &playlist, const std::string &path)
+{
+    playlist.append("noise");
+    playlist.append(path);
+}
+
+//! Queue videos found inside of the archive, they are played in place
+static void appendArchive(DerVideoPlaylist &playlist, const std::string &path)
+{
+    DirMan arch("@" + path + ":/");
+    std::string cur_path;
+    std::vector<std::string> list;
+
+    arch.beginWalking(s_videoFilters);
+
+    while(arch.fetchListFromWalker(cur_path, list))
+    {
+        for(const auto &v : list)
+            appendVideo(playlist, cur_path + (cur_path.back() == '/' ? "" : "/") + v);
+    }
+}
+
+static std::vector<std::string> mediaFilters()
+{
+    std::vector<std::string> filters = s_videoFilters;
+    filters.push_back(".zip");
+    return filters;
+}
 
-    if(video == "noise")
-        vFile = SDL_RWFromConstMem(noise_avi, noise_avi_size);
+static void appendMedia(DerVideoPlaylist &playlist, const std::string &path)
+{
+    if(DirMan::matchSuffixFilters(path, {".zip"}))
+        appendArchive(playlist, path);
     else
-        vFile = SDL_RWFromFile(video.c_str(), "rb");
+        appendVideo(playlist, path);
+}
 
-    if(!vFile)
+//! Where the playlist takes files from: the media library index if it's up to date, the directory walker otherwise
+struct PlaylistFeed
+{
+    DirMan             *dir = nullptr;
+    bool                walking = false;
+    const MediaLibrary *library = nullptr;
+    size_t              next = 0;
+};
+
+//! Keep the playlist filled by the media library or the directory walker
+static void feedPlaylist(DerVideoPlaylist &playlist, PlaylistFeed &feed)
+{
+    std::string cur_path;
+    std::vector<std::string> list;
+
+    while(playlist.pending() < 2)
     {
-        SDL_Log("Failed to open video file: %s", video.c_str());
-        std::string msg = "Ich kann diese Video öffnen:\n" + video;
-        SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "Dieses Video ist Müll!", msg.c_str(), window);
-        return;
+        if(feed.library)
+        {
+            if(feed.next >= feed.library->size())
+                break;
+
+            appendMedia(playlist, feed.library->file(feed.next++).path);
+            continue;
+        }
+
+        if(!feed.walking)
+            break;
+
+        feed.walking = feed.dir->fetchListFromWalker(cur_path, list);
+
+        for(const auto &v : list)
+            appendMedia(playlist, cur_path + "/" + v);
     }
+}
 
-    if(!player.loadVideo(vFile, true))
+//! Builds the media library index at the background while the walker feeds the playlist
+struct LibraryIndexer
+{
+    MediaLibrary    library;
+    std::string     root;
+    std::string     path;
+    SDL_atomic_t    interrupt;
+    SDL_Thread     *thread = nullptr;
+
+    LibraryIndexer()
     {
-        SDL_RWclose(vFile);
-        SDL_Log("Failed to open video: %s", video.c_str());
-        std::string msg = "Ich kann diese Video öffnen:\n" + video;
-        SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "Dieses Video ist Müll!", msg.c_str(), window);
-        return;
+        SDL_AtomicSet(&interrupt, 0);
     }
+};
 
-    SDL_RenderClear(render);
-    if(video != "noise")
-        SDL_RenderPresent(render);
+static int SDLCALL libraryIndexerThread(void *data)
+{
+    LibraryIndexer *indexer = reinterpret_cast<LibraryIndexer *>(data);
+    MediaLibrary::UpdateStats ls;
 
-    SDL_PauseAudio(0);
+    if(!indexer->library.update(indexer->root, mediaFilters(), &indexer->interrupt, &ls))
+        return 1;
 
-    bool stop = false;
+    SDL_Log("Media library: indexed %u files in %u directories in %.2f ms",
+            (unsigned)ls.files, (unsigned)ls.dirs, ls.ms);
+    indexer->library.save(indexer->path);
 
-    while(!player.atEnd() && !stopAlles && !stop)
+    return 0;
+}
+
+static void playlistLoop(DerVideoPlaylist &playlist, PlaylistFeed &feed, SDL_Renderer *render, SDL_Window *window)
+{
+    SDL_Event event;
+    bool skipped = false;
+
+    // Playback starts with the first directory read, the rest gets read at the background
+    if(!feed.library)
+    {
+        feed.dir->beginWalkingParallel(mediaFilters(), 0, true);
+        feed.walking = true;
+    }
+
+    feedPlaylist(playlist, feed);
+
+    if(!playlist.start())
     {
+        SDL_Log("Nothing to play");
+        SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "Dieses Video ist Müll!", "Ich kann kein Video öffnen", window);
+        return;
+    }
+
+    playlist.setAudioPaused(false);
+
+    while(!playlist.atEnd() && !stopAlles)
+    {
+        DerVideoPlayer *player = playlist.current();
+
         while(SDL_PollEvent(&event))
         {
             if(event.type == SDL_QUIT)
                 stopAlles = true;
-            else if(event.type == SDL_KEYUP)
+            else if(event.type == SDL_KEYUP && player)
             {
                 if(event.key.keysym.sym == SDLK_SPACE)
-                    stop = true;
+                {
+                    playlist.skip();
+                    skipped = true;
+                }
+                else if(event.key.keysym.sym == SDLK_RIGHT)
+                    player->setSpeed(player->speed() * 2.0);
+                else if(event.key.keysym.sym == SDLK_LEFT)
+                    player->setSpeed(player->speed() > 1.0 ? player->speed() / 2.0 : 1.0);
+                else if(event.key.keysym.sym == SDLK_a)
+                    nextAudioTrack(*player);
+                else if(event.key.keysym.sym == SDLK_i)
+                    logIOStats(*player);
+                else if(event.key.keysym.sym == SDLK_UP || event.key.keysym.sym == SDLK_DOWN)
+                {
+                    double to = player->position() + (event.key.keysym.sym == SDLK_UP ? 10.0 : -10.0);
+                    bool accurate = (event.key.keysym.mod & KMOD_SHIFT) != 0;
+
+                    player->seek(to, accurate ? DerVideoPlayer::SEEK_ACCURATE : DerVideoPlayer::SEEK_FAST);
+                    SDL_Log("Seek to %.2f (%s) took %.2f ms, landed at %.2f (key frame index: %u entries)",
+                            to, accurate ? "accurate" : "fast", player->seekDuration(), player->position(),
+                            (unsigned)player->keyframeIndexSize());
+                }
             }
         }
 
-        if(player.hasVideoFrame())
+        if(playlist.update())
+        {
+            auto ps = playlist.stats();
+            if(skipped)
+                SDL_Log("Skipped, the previous item stopped in %.2f ms", ps.lastStopMs);
+            skipped = false;
+            SDL_Log("Playing: %s (prepared in %.2f ms)", playlist.currentItem().c_str(), ps.lastPrepareMs);
+            if(playlist.current())
+                logIOStats(*playlist.current());
+        }
+
+        feedPlaylist(playlist, feed);
+
+        if(playlist.hasVideoFrame())
         {
             SDL_RenderClear(render);
-            player.drawVideoFrame();
+            playlist.drawVideoFrame();
             SDL_RenderPresent(render);
         }
 
         SDL_Delay(15);
     }
 
-    SDL_PauseAudio(1);
+    playlist.setAudioPaused(true);
+
+    auto ps = playlist.stats();
+    SDL_Log("Playlist: %llu gapless switches, %llu stalls (%.2f ms of silence), %llu failed",
+            (unsigned long long)ps.gapless, (unsigned long long)ps.stalls, ps.stallMs,
+            (unsigned long long)ps.failed);
 }
 
 
@@ -76,10 +246,16 @@ int main()
     SDL_Window *window = nullptr;
     SDL_Renderer *render = nullptr;
     SDL_AudioSpec spec;
-    SDL_AudioSpec obtained;
 
-    DerVideoPlayer player;
     DirMan dir;
+    ProbeCache probeCache;
+    std::string probeCachePath;
+    ClipCache clipCache(32 * 1024 * 1024, 10.0);
+    MediaLibrary library;
+    LibraryIndexer indexer;
+    PlaylistFeed feed;
+
+    DerVideoPlayer::registerMemoryAsset("noise", noise_avi, noise_avi_size);
 
     dir.setPath("/home/vitaly/Видео/RPGMakerVideos");
 
@@ -103,41 +279,84 @@ int main()
         return 1;
     }
 
-    player.setRender(render);
+    DerVideoPlaylist playlist(render);
+    playlist.setClipCache(&clipCache);
 
+    char *prefPath = SDL_GetPrefPath("Wohlstand", "DerVideoPlayer");
+    if(prefPath)
+    {
+        probeCachePath = std::string(prefPath) + "probe.cache";
+        probeCache.load(probeCachePath);
+        playlist.setProbeCache(&probeCache);
+
+        std::string keyIndexDir = std::string(prefPath) + "keyframes";
+        if(DirMan::mkAbsPath(keyIndexDir))
+            playlist.setKeyframeIndexDir(keyIndexDir);
+
+        indexer.path = std::string(prefPath) + "library.idx";
+        indexer.root = dir.absolutePath();
+
+        SDL_free(prefPath);
+    }
+
+    // An existing index only needs to revalidate changed directories, otherwise it gets built for the next run
+    if(!indexer.path.empty())
+    {
+        MediaLibrary::UpdateStats ls;
+
+        if(library.load(indexer.path) && library.root() == indexer.root &&
+           library.update(indexer.root, mediaFilters(), nullptr, &ls))
+        {
+            SDL_Log("Media library: %u files, %u of %u directories unchanged, %u files checked, updated in %.2f ms",
+                    (unsigned)ls.files, (unsigned)ls.dirsReused, (unsigned)ls.dirs, (unsigned)ls.filesStatted, ls.ms);
+            library.save(indexer.path);
+            feed.library = &library;
+        }
+        else
+            indexer.thread = SDL_CreateThread(&libraryIndexerThread, "LibraryIndexer", &indexer);
+    }
+
+    feed.dir = &dir;
+
+    SDL_zero(spec);
     spec.format = AUDIO_S16SYS;
     spec.freq = 44100;
     spec.samples = 256;
     spec.channels = 2;
-    spec.callback = &DerVideoPlayer::audio_out_stream;
-    spec.userdata = &player;
 
-    SDL_OpenAudio(&spec, &obtained);
-    player.setAudioSpec(obtained);
+    playlist.openAudioDevice(spec);
 
-    videoLoop("/home/vitaly/Видео/RPGMakerVideos/2000/Doedelburg 2/Movie/NUTTNBUMSA_.AVI", player, render, window);
+    playlist.append("/home/vitaly/Видео/RPGMakerVideos/2000/Doedelburg 2/Movie/NUTTNBUMSA_.AVI");
+    playlistLoop(playlist, feed, render, window);
 
-    dir.beginWalking({".avi", ".mpg", ".avd"});
-    std::string cur_path;
-    std::vector<std::string> list;
-
-    bool playNoise = true;
-
-    while(dir.fetchListFromWalker(cur_path, list))
+    if(indexer.thread)
     {
-        for(const auto &v : list)
-        {
-            if(stopAlles)
-                break;
+        SDL_AtomicSet(&indexer.interrupt, 1);
+        SDL_WaitThread(indexer.thread, nullptr);
+    }
 
-            videoLoop("noise", player, render, window);
+    playlist.close();
+    SDL_Log("Playlist stopped in %.2f ms", playlist.stats().lastStopMs);
+    playlist.closeAudioDevice();
 
-            std::string vid = cur_path + "/" + v;
-            videoLoop(vid, player, render, window);
-        }
+    ClipCache::Stats cs = clipCache.stats();
+    SDL_Log("Clip cache: %llu hits, %llu misses, %u clips, %u KB used (%u KB unpacked), %llu evicted, %llu rejected",
+            (unsigned long long)cs.hits, (unsigned long long)cs.misses,
+            (unsigned)cs.clips, (unsigned)(cs.memory / 1024), (unsigned)(cs.rawMemory / 1024),
+            (unsigned long long)cs.evictions, (unsigned long long)cs.rejected);
+    playlist.setClipCache(nullptr);
+
+    if(!probeCachePath.empty())
+    {
+        ProbeCache::Stats ps = probeCache.stats();
+        SDL_Log("Probe cache: %llu hits, %llu misses, %.2f ms saved",
+                (unsigned long long)ps.hits, (unsigned long long)ps.misses, ps.savedMs);
+        playlist.setProbeCache(nullptr);
+        probeCache.save(probeCachePath);
     }
 
-    SDL_CloseAudio();
+    Archives::close_all();
+
     SDL_DestroyRenderer(render);
     SDL_DestroyWindow(window);
     SDL_Quit();
@@ -0,0 +1,643 @@
+#include <SDL2/SDL_log.h>
+#include <SDL2/SDL_rwops.h>
+#include <SDL2/SDL_timer.h>
+#include <SDL2/SDL_stdinc.h>
+
+#include <stdio.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <set>
+#include <unordered_map>
+#include <utility>
+
+#if !defined(_WIN32) && !defined(__vita__)
+#   define MEDIA_LIBRARY_POSIX
+#   include <sys/mman.h>
+#   include <fcntl.h>
+#   include <unistd.h>
+#   include <dirent.h>
+#endif
+
+#include <DirManager/dirman.h>
+
+#include "media_library.h"
+
+#define MEDIA_LIBRARY_MAGIC   0x4C4D5644 /* "DVML" */
+#define MEDIA_LIBRARY_VERSION 1
+
+//! Directories modified this close to the scan might change again within the same time stamp
+#define MEDIA_LIBRARY_RACY_NS 2000000000LL
+
+/*
+ * File layout (host byte order, the index is local to the machine), all parts are 8-byte aligned:
+ *
+ * LibraryHeader
+ * LibraryDir[dirCount]     - in breadth-first order, the root first, children of every directory are adjacent
+ * LibraryFile[fileCount]   - grouped by directories, sorted by names
+ * uint32_t[childCount]     - indices of subdirectories (padded to 8 bytes)
+ * char[stringsSize]        - paths of directories and names of files
+ */
+
+struct LibraryHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t filterHash;
+    uint32_t dirCount;
+    uint32_t fileCount;
+    uint32_t childCount;
+    uint32_t stringsSize;
+};
+
+struct LibraryDir
+{
+    //! Full path at the strings
+    uint32_t path;
+    uint32_t pathSize;
+    uint32_t firstFile;
+    uint32_t fileCount;
+    uint32_t firstChild;
+    uint32_t childCount;
+    //! Modification time in nanoseconds (0 - must be read again)
+    int64_t  mtime;
+    uint64_t inode;
+};
+
+struct LibraryFile
+{
+    //! Name at the strings
+    uint32_t name;
+    uint32_t nameSize;
+    //! Index of the directory
+    uint32_t dir;
+    uint32_t reserved;
+    int64_t  size;
+    int64_t  mtime;
+    uint64_t inode;
+};
+
+static inline size_t align8(size_t size)
+{
+    return (size + 7) & ~(size_t)7;
+}
+
+//! Parts of the attached image
+struct LibraryView
+{
+    const LibraryHeader *head = nullptr;
+    const LibraryDir    *dirs = nullptr;
+    const LibraryFile   *files = nullptr;
+    const uint32_t      *children = nullptr;
+    const char          *strings = nullptr;
+
+    bool dirValid(uint32_t i) const
+    {
+        const LibraryDir &d = dirs[i];
+        return (uint64_t)d.path + d.pathSize <= head->stringsSize &&
+               (uint64_t)d.firstFile + d.fileCount <= head->fileCount &&
+               (uint64_t)d.firstChild + d.childCount <= head->childCount;
+    }
+
+    std::string dirPath(uint32_t i) const
+    {
+        return std::string(strings + dirs[i].path, dirs[i].pathSize);
+    }
+};
+
+static bool library_view(const uint8_t *data, size_t size, LibraryView &v)
+{
+    const LibraryHeader *head = (const LibraryHeader *)data;
+    size_t dirsPos, filesPos, childrenPos, stringsPos;
+
+    if(!data || size < sizeof(LibraryHeader))
+        return false;
+
+    if(head->magic != MEDIA_LIBRARY_MAGIC || head->version != MEDIA_LIBRARY_VERSION || head->dirCount == 0)
+        return false;
+
+    dirsPos = sizeof(LibraryHeader);
+    filesPos = dirsPos + (size_t)head->dirCount * sizeof(LibraryDir);
+    childrenPos = filesPos + (size_t)head->fileCount * sizeof(LibraryFile);
+    stringsPos = childrenPos + align8((size_t)head->childCount * sizeof(uint32_t));
+
+    if(stringsPos + head->stringsSize != size)
+        return false;
+
+    v.head = head;
+    v.dirs = (const LibraryDir *)(data + dirsPos);
+    v.files = (const LibraryFile *)(data + filesPos);
+    v.children = (const uint32_t *)(data + childrenPos);
+    v.strings = (const char *)(data + stringsPos);
+
+    return true;
+}
+
+static uint64_t filters_hash(const std::vector<std::string> &filters)
+{
+    uint64_t hash = 14695981039346656037ULL; // FNV-1a
+
+    for(const auto &f : filters)
+    {
+        for(unsigned char c : f)
+        {
+            hash ^= c;
+            hash *= 1099511628211ULL;
+        }
+
+        hash ^= 0; // Separator
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+MediaLibrary::MediaLibrary()
+{}
+
+MediaLibrary::~MediaLibrary()
+{
+    unmap();
+}
+
+void MediaLibrary::unmap()
+{
+#ifdef MEDIA_LIBRARY_POSIX
+    if(m_map)
+        munmap((void *)m_map, m_mapSize);
+#endif
+    m_map = nullptr;
+    m_mapSize = 0;
+    m_image.clear();
+    m_data = nullptr;
+    m_dataSize = 0;
+}
+
+bool MediaLibrary::attach(const uint8_t *data, size_t size)
+{
+    LibraryView v;
+
+    if(!library_view(data, size, v))
+        return false;
+
+    m_data = data;
+    m_dataSize = size;
+
+    return true;
+}
+
+bool MediaLibrary::load(const std::string &path)
+{
+    unmap();
+
+#ifdef MEDIA_LIBRARY_POSIX
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+
+    if(fd < 0)
+        return false;
+
+    if(fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(LibraryHeader))
+    {
+        ::close(fd);
+        return false;
+    }
+
+    void *map = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+
+    if(map == MAP_FAILED)
+        return false;
+
+    m_map = (const uint8_t *)map;
+    m_mapSize = (size_t)st.st_size;
+
+    if(!attach(m_map, m_mapSize))
+#else
+    SDL_RWops *f = SDL_RWFromFile(path.c_str(), "rb");
+    Sint64 fsize;
+
+    if(!f)
+        return false;
+
+    fsize = SDL_RWsize(f);
+    if(fsize < (Sint64)sizeof(LibraryHeader))
+    {
+        SDL_RWclose(f);
+        return false;
+    }
+
+    m_image.resize((size_t)fsize);
+    if(SDL_RWread(f, m_image.data(), 1, m_image.size()) != m_image.size())
+    {
+        SDL_RWclose(f);
+        m_image.clear();
+        return false;
+    }
+
+    SDL_RWclose(f);
+
+    if(!attach(m_image.data(), m_image.size()))
+#endif
+    {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION, "Media library %s is invalid or outdated, ignoring", path.c_str());
+        unmap();
+        return false;
+    }
+
+    return true;
+}
+
+bool MediaLibrary::save(const std::string &path)
+{
+    std::string tmp = path + ".tmp";
+    std::vector<uint8_t> keep;
+    SDL_RWops *f;
+    bool ok;
+
+    if(!m_data)
+        return false;
+
+    f = SDL_RWFromFile(tmp.c_str(), "wb");
+    if(!f)
+        return false;
+
+    ok = SDL_RWwrite(f, m_data, 1, m_dataSize) == m_dataSize;
+    SDL_RWclose(f);
+
+    if(!ok || rename(tmp.c_str(), path.c_str()) != 0)
+    {
+        remove(tmp.c_str());
+        return false;
+    }
+
+    if(m_map)
+        return true; // Still valid, the replaced file stays mapped until unmap()
+
+    // Use the written file instead of the in-memory image
+    keep.swap(m_image);
+    if(!load(path))
+    {
+        m_image.swap(keep);
+        attach(m_image.data(), m_image.size());
+    }
+
+    return true;
+}
+
+std::string MediaLibrary::root() const
+{
+    LibraryView v;
+
+    if(!library_view(m_data, m_dataSize, v) || !v.dirValid(0))
+        return std::string();
+
+    return v.dirPath(0);
+}
+
+size_t MediaLibrary::size() const
+{
+    LibraryView v;
+
+    if(!library_view(m_data, m_dataSize, v))
+        return 0;
+
+    return v.head->fileCount;
+}
+
+MediaLibrary::File MediaLibrary::file(size_t i) const
+{
+    LibraryView v;
+    File ret;
+
+    if(!library_view(m_data, m_dataSize, v) || i >= v.head->fileCount)
+        return ret;
+
+    const LibraryFile &f = v.files[i];
+
+    if(f.dir >= v.head->dirCount || !v.dirValid(f.dir) || (uint64_t)f.name + f.nameSize > v.head->stringsSize)
+        return ret;
+
+    ret.path = v.dirPath(f.dir);
+    if(ret.path.empty() || ret.path.back() != '/')
+        ret.path.push_back('/');
+    ret.path.append(v.strings + f.name, f.nameSize);
+    ret.size = f.size;
+    ret.mtime = f.mtime;
+    ret.inode = f.inode;
+
+    return ret;
+}
+
+#ifdef MEDIA_LIBRARY_POSIX
+
+static int64_t stat_mtime_ns(const struct stat &st)
+{
+#if defined(__APPLE__)
+    return (int64_t)st.st_mtimespec.tv_sec * 1000000000LL + st.st_mtimespec.tv_nsec;
+#elif defined(__linux__) || defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__)
+    return (int64_t)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+#else
+    return (int64_t)st.st_mtime * 1000000000LL;
+#endif
+}
+
+//! Directory of the index being built
+struct BuildDir
+{
+    std::string path;
+    //! Same directory at the old index (-1 if none)
+    int64_t     old = -1;
+    int64_t     mtime = 0;
+    uint64_t    inode = 0;
+    uint32_t    firstFile = 0;
+    uint32_t    fileCount = 0;
+    uint32_t    firstChild = 0;
+    uint32_t    childCount = 0;
+};
+
+struct BuildEntry
+{
+    std::string name;
+    bool        isDir;
+    struct stat st;
+};
+
+bool MediaLibrary::update(const std::string &root, const std::vector<std::string> &suffix_filters,
+                          SDL_atomic_t *interrupt, UpdateStats *stats)
+{
+    Uint64 start = SDL_GetPerformanceCounter();
+    int64_t racyLimit = (int64_t)time(nullptr) * 1000000000LL - MEDIA_LIBRARY_RACY_NS;
+    std::vector<std::string> filters;
+    std::vector<BuildDir> dirs;
+    std::vector<LibraryFile> files;
+    std::vector<uint32_t> children;
+    std::string strings;
+    std::set<std::pair<uint64_t, uint64_t> > visited;
+    std::vector<BuildEntry> entries;
+    std::unordered_map<std::string, uint32_t> oldChildren;
+    std::vector<uint8_t> image;
+    UpdateStats st;
+    LibraryView old;
+    bool hasOld;
+    LibraryHeader head;
+
+    for(const auto &f : suffix_filters)
+    {
+        std::string l = f;
+        for(char &c : l)
+            c = (char)SDL_tolower((unsigned char)c);
+        filters.push_back(l);
+    }
+
+    std::sort(filters.begin(), filters.end());
+
+    dirs.emplace_back();
+    dirs[0].path = root;
+    while(dirs[0].path.size() > 1 && dirs[0].path.back() == '/')
+        dirs[0].path.pop_back();
+
+    // The old index is only useful for the same root and filters
+    hasOld = library_view(m_data, m_dataSize, old) &&
+             old.head->filterHash == filters_hash(filters) &&
+             old.dirValid(0) && old.dirPath(0) == dirs[0].path;
+    if(hasOld)
+        dirs[0].old = 0;
+
+    for(size_t i = 0; i < dirs.size(); ++i)
+    {
+        struct stat dst;
+        bool reuse;
+        int64_t mtime;
+
+        if(interrupt && SDL_AtomicGet(interrupt))
+            return false;
+
+        dirs[i].firstFile = (uint32_t)files.size();
+        dirs[i].firstChild = (uint32_t)children.size();
+
+        // Gone since the parent has been read, or the symlink loop
+        if(stat(dirs[i].path.c_str(), &dst) != 0 || !S_ISDIR(dst.st_mode) ||
+           !visited.insert(std::make_pair((uint64_t)dst.st_dev, (uint64_t)dst.st_ino)).second)
+            continue;
+
+        st.dirs++;
+
+        mtime = stat_mtime_ns(dst);
+        dirs[i].mtime = mtime < racyLimit ? mtime : 0;
+        dirs[i].inode = (uint64_t)dst.st_ino;
+
+        reuse = dirs[i].old >= 0 && old.dirValid((uint32_t)dirs[i].old);
+        if(reuse)
+        {
+            const LibraryDir &od = old.dirs[dirs[i].old];
+            reuse = od.mtime != 0 && od.mtime == mtime && od.inode == dirs[i].inode;
+        }
+
+        if(reuse)
+        {
+            const LibraryDir &od = old.dirs[dirs[i].old];
+
+            st.dirsReused++;
+
+            for(uint32_t f = od.firstFile; f < od.firstFile + od.fileCount; ++f)
+            {
+                LibraryFile nf = old.files[f];
+
+                if((uint64_t)nf.name + nf.nameSize > old.head->stringsSize)
+                    continue;
+
+                nf.dir = (uint32_t)i;
+                nf.name = (uint32_t)strings.size();
+                strings.append(old.strings + old.files[f].name, nf.nameSize);
+                files.push_back(nf);
+            }
+
+            for(uint32_t c = od.firstChild; c < od.firstChild + od.childCount; ++c)
+            {
+                uint32_t oc = old.children[c];
+
+                if(oc >= old.head->dirCount || !old.dirValid(oc))
+                    continue;
+
+                children.push_back((uint32_t)dirs.size());
+                dirs.emplace_back();
+                dirs.back().path = old.dirPath(oc);
+                dirs.back().old = oc;
+            }
+        }
+        else
+        {
+            DIR *d = opendir(dirs[i].path.c_str());
+            dirent *dent;
+
+            if(!d)
+                continue;
+
+            entries.clear();
+
+            while((dent = readdir(d)) != nullptr)
+            {
+                BuildEntry e;
+                bool known = false;
+
+                if(strcmp(dent->d_name, ".") == 0 || strcmp(dent->d_name, "..") == 0)
+                    continue;
+
+#ifdef DT_UNKNOWN
+                // Directories don't need the stat here, they get one when processed
+                if(dent->d_type == DT_DIR)
+                {
+                    e.isDir = true;
+                    known = true;
+                }
+                else if(dent->d_type != DT_REG && dent->d_type != DT_LNK && dent->d_type != DT_UNKNOWN)
+                    continue;
+                else if(dent->d_type == DT_REG && !DirMan::matchSuffixFilters(dent->d_name, filters))
+                    continue;
+#endif
+
+                if(!known)
+                {
+                    if(fstatat(dirfd(d), dent->d_name, &e.st, 0) != 0)
+                        continue;
+
+                    e.isDir = S_ISDIR(e.st.st_mode);
+
+                    if(!e.isDir && (!S_ISREG(e.st.st_mode) || !DirMan::matchSuffixFilters(dent->d_name, filters)))
+                        continue;
+
+                    if(!e.isDir)
+                        st.filesStatted++;
+                }
+
+                e.name = dent->d_name;
+                entries.push_back(std::move(e));
+            }
+
+            closedir(d);
+
+            std::sort(entries.begin(), entries.end(), [](const BuildEntry &a, const BuildEntry &b)
+            {
+                return a.name < b.name;
+            });
+
+            // Subdirectories known by the old index keep their state
+            oldChildren.clear();
+            if(dirs[i].old >= 0 && old.dirValid((uint32_t)dirs[i].old))
+            {
+                const LibraryDir &od = old.dirs[dirs[i].old];
+
+                for(uint32_t c = od.firstChild; c < od.firstChild + od.childCount; ++c)
+                {
+                    uint32_t oc = old.children[c];
+                    if(oc < old.head->dirCount && old.dirValid(oc))
+                        oldChildren[old.dirPath(oc)] = oc;
+                }
+            }
+
+            for(auto &e : entries)
+            {
+                if(e.isDir)
+                {
+                    std::string path = dirs[i].path + (dirs[i].path.back() == '/' ? "" : "/") + e.name;
+                    auto oc = oldChildren.find(path);
+
+                    children.push_back((uint32_t)dirs.size());
+                    dirs.emplace_back();
+                    dirs.back().path = std::move(path);
+                    if(oc != oldChildren.end())
+                        dirs.back().old = oc->second;
+                }
+                else
+                {
+                    LibraryFile f;
+
+                    SDL_zero(f);
+                    f.name = (uint32_t)strings.size();
+                    f.nameSize = (uint32_t)e.name.size();
+                    f.dir = (uint32_t)i;
+                    f.size = (int64_t)e.st.st_size;
+                    f.mtime = (int64_t)e.st.st_mtime;
+                    f.inode = (uint64_t)e.st.st_ino;
+                    strings.append(e.name);
+                    files.push_back(f);
+                }
+            }
+        }
+
+        dirs[i].fileCount = (uint32_t)files.size() - dirs[i].firstFile;
+        dirs[i].childCount = (uint32_t)children.size() - dirs[i].firstChild;
+    }
+
+    // Build the image, directory paths go after file names
+    SDL_zero(head);
+    head.magic = MEDIA_LIBRARY_MAGIC;
+    head.version = MEDIA_LIBRARY_VERSION;
+    head.filterHash = filters_hash(filters);
+    head.dirCount = (uint32_t)dirs.size();
+    head.fileCount = (uint32_t)files.size();
+    head.childCount = (uint32_t)children.size();
+
+    std::vector<LibraryDir> outDirs(dirs.size());
+    for(size_t i = 0; i < dirs.size(); ++i)
+    {
+        LibraryDir &d = outDirs[i];
+
+        SDL_zero(d);
+        d.path = (uint32_t)strings.size();
+        d.pathSize = (uint32_t)dirs[i].path.size();
+        d.firstFile = dirs[i].firstFile;
+        d.fileCount = dirs[i].fileCount;
+        d.firstChild = dirs[i].firstChild;
+        d.childCount = dirs[i].childCount;
+        d.mtime = dirs[i].mtime;
+        d.inode = dirs[i].inode;
+        strings.append(dirs[i].path);
+    }
+
+    head.stringsSize = (uint32_t)strings.size();
+
+    image.resize(sizeof(LibraryHeader) +
+                 outDirs.size() * sizeof(LibraryDir) +
+                 files.size() * sizeof(LibraryFile) +
+                 align8(children.size() * sizeof(uint32_t)) +
+                 strings.size());
+
+    uint8_t *out = image.data();
+    SDL_memcpy(out, &head, sizeof(head));
+    out += sizeof(head);
+    SDL_memcpy(out, outDirs.data(), outDirs.size() * sizeof(LibraryDir));
+    out += outDirs.size() * sizeof(LibraryDir);
+    if(!files.empty())
+        SDL_memcpy(out, files.data(), files.size() * sizeof(LibraryFile));
+    out += files.size() * sizeof(LibraryFile);
+    if(!children.empty())
+        SDL_memcpy(out, children.data(), children.size() * sizeof(uint32_t));
+    out += align8(children.size() * sizeof(uint32_t));
+    SDL_memcpy(out, strings.data(), strings.size());
+
+    // The old index isn't needed anymore
+    unmap();
+    m_image.swap(image);
+    attach(m_image.data(), m_image.size());
+
+    st.files = files.size();
+    st.ms = (double)(SDL_GetPerformanceCounter() - start) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+
+    if(stats)
+        *stats = st;
+
+    return true;
+}
+
+#else // MEDIA_LIBRARY_POSIX
+
+bool MediaLibrary::update(const std::string &, const std::vector<std::string> &, volatile int *, UpdateStats *)
+{
+    return false;
+}
+
+#endif // MEDIA_LIBRARY_POSIX
@@ -0,0 +1,107 @@
+#ifndef MEDIA_LIBRARY_H
+#define MEDIA_LIBRARY_H
+
+#include <SDL2/SDL_atomic.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Persistent index of media files under the library root
+ *
+ * Keeps directories and matching files with their size, modification time and inode.
+ * The index file is a flat image of fixed layout records which is memory-mapped at load
+ * and used in place. The update revalidates the index: only directories whose modification
+ * time or inode have changed get read again, files of unchanged directories are taken
+ * from the index. Every directory still gets one stat() call, since changes deeper
+ * in the tree don't touch the modification time of their parents.
+ *
+ * Files rewritten in place inside of an unchanged directory keep their old size and time
+ * until anything gets added, removed or renamed at that directory.
+ */
+class MediaLibrary
+{
+public:
+    struct File
+    {
+        //! Full path of the file
+        std::string path;
+        int64_t     size = 0;
+        int64_t     mtime = 0;
+        uint64_t    inode = 0;
+    };
+
+    struct UpdateStats
+    {
+        //! Time spent by the update in milliseconds
+        double   ms = 0.0;
+        size_t   dirs = 0;
+        //! Unchanged directories taken from the index without reading
+        size_t   dirsReused = 0;
+        size_t   files = 0;
+        //! Files which needed the stat() call
+        size_t   filesStatted = 0;
+    };
+
+    MediaLibrary();
+    ~MediaLibrary();
+
+    MediaLibrary(const MediaLibrary &) = delete;
+    MediaLibrary &operator=(const MediaLibrary &) = delete;
+
+    /**
+     * @brief Load the index file
+     * @param path Path to the index file
+     * @return true if file has been loaded
+     */
+    bool load(const std::string &path);
+
+    /**
+     * @brief Write the index file
+     * @param path Path to the index file
+     * @return true on success
+     */
+    bool save(const std::string &path);
+
+    /**
+     * @brief Bring the index up to date with the file system
+     * @param root Root directory of the library
+     * @param suffix_filters Suffixes of files to index (case-insensitive), the whole index
+     *        gets rebuilt when the root or filters differ from the loaded ones
+     * @param interrupt Non-zero value interrupts the update (optional)
+     * @param stats Statistics of the update (optional)
+     * @return true if the update has been completed, the old index is kept otherwise
+     */
+    bool update(const std::string &root, const std::vector<std::string> &suffix_filters,
+                SDL_atomic_t *interrupt = nullptr, UpdateStats *stats = nullptr);
+
+    //! Root directory of the index (empty if nothing is loaded)
+    std::string root() const;
+
+    //! Number of indexed files
+    size_t size() const;
+
+    /**
+     * @brief Get the indexed file
+     * @param i Index from 0 to size() - 1, files are sorted by directories and names
+     * @return file
+     */
+    File file(size_t i) const;
+
+private:
+    void unmap();
+    //! Use the image, checks the layout
+    bool attach(const uint8_t *data, size_t size);
+
+    //! Mapped index file
+    const uint8_t *m_map = nullptr;
+    size_t         m_mapSize = 0;
+    //! Index image when not mapped (loaded without mmap, or just updated)
+    std::vector<uint8_t> m_image;
+
+    //! Parts of the image
+    const uint8_t *m_data = nullptr;
+    size_t         m_dataSize = 0;
+};
+
+#endif // MEDIA_LIBRARY_H
@@ -0,0 +1,262 @@
+#include <SDL2/SDL_rwops.h>
+#include <SDL2/SDL_error.h>
+#include <SDL2/SDL_stdinc.h>
+
+#include "mmap_rwops.h"
+
+#if !defined(_WIN32) && !defined(__vita__)
+#   define MMAP_RWOPS_SUPPORTED
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <fcntl.h>
+#   include <unistd.h>
+#   if defined(__linux__)
+#       include <sys/vfs.h>
+#   elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__)
+#       include <sys/param.h>
+#       include <sys/mount.h>
+#   endif
+#endif
+
+#ifdef MMAP_RWOPS_SUPPORTED
+
+//! How much data ahead of the read position to request from the kernel
+#define MMAP_READAHEAD_WINDOW (2 * 1024 * 1024)
+
+struct MappedFile
+{
+    Uint8  *data;
+    size_t  size;
+    size_t  pos;
+    //! Range already advised with MADV_WILLNEED
+    size_t  advisedBegin;
+    size_t  advisedEnd;
+    size_t  pageSize;
+};
+
+static void mapped_advise(MappedFile *f)
+{
+    size_t begin, end;
+
+    if(f->pos >= f->advisedBegin &&
+       (f->pos + MMAP_READAHEAD_WINDOW / 2 < f->advisedEnd || f->advisedEnd == f->size))
+        return; // Still inside of the advised window
+
+    begin = f->pos & ~(f->pageSize - 1);
+    end = begin + MMAP_READAHEAD_WINDOW;
+    if(end > f->size)
+        end = f->size;
+
+    if(end > begin)
+        madvise(f->data + begin, end - begin, MADV_WILLNEED);
+
+    f->advisedBegin = begin;
+    f->advisedEnd = end;
+}
+
+static Sint64 SDLCALL mapped_size(SDL_RWops *ctx)
+{
+    MappedFile *f = (MappedFile *)ctx->hidden.unknown.data1;
+    return (Sint64)f->size;
+}
+
+static Sint64 SDLCALL mapped_seek(SDL_RWops *ctx, Sint64 offset, int whence)
+{
+    MappedFile *f = (MappedFile *)ctx->hidden.unknown.data1;
+    Sint64 newPos;
+
+    switch(whence)
+    {
+    case RW_SEEK_SET:
+        newPos = offset;
+        break;
+    case RW_SEEK_CUR:
+        newPos = (Sint64)f->pos + offset;
+        break;
+    case RW_SEEK_END:
+        newPos = (Sint64)f->size + offset;
+        break;
+    default:
+        return SDL_SetError("Unknown value for 'whence'");
+    }
+
+    if(newPos < 0)
+        return SDL_SetError("Attempt to seek before the beginning of the file");
+
+    if((Uint64)newPos > f->size)
+        newPos = (Sint64)f->size;
+
+    f->pos = (size_t)newPos;
+    mapped_advise(f);
+
+    return newPos;
+}
+
+static size_t SDLCALL mapped_read(SDL_RWops *ctx, void *ptr, size_t size, size_t maxnum)
+{
+    MappedFile *f = (MappedFile *)ctx->hidden.unknown.data1;
+    size_t total, avail;
+
+    if(size == 0 || maxnum == 0)
+        return 0;
+
+    avail = f->size - f->pos;
+    total = size * maxnum;
+    if(total > avail)
+        total = avail - (avail % size);
+
+    SDL_memcpy(ptr, f->data + f->pos, total);
+    f->pos += total;
+    mapped_advise(f);
+
+    return total / size;
+}
+
+static size_t SDLCALL mapped_write(SDL_RWops *, const void *, size_t, size_t)
+{
+    SDL_SetError("Memory-mapped file is read-only");
+    return 0;
+}
+
+static int SDLCALL mapped_close(SDL_RWops *ctx)
+{
+    if(ctx)
+    {
+        MappedFile *f = (MappedFile *)ctx->hidden.unknown.data1;
+        if(f)
+        {
+            munmap(f->data, f->size);
+            SDL_free(f);
+        }
+        SDL_FreeRW(ctx);
+    }
+
+    return 0;
+}
+
+SDL_RWops *RWFromMappedFile(const char *path)
+{
+    SDL_RWops *ctx;
+    MappedFile *f;
+    struct stat st;
+    void *data;
+    int fd;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+        return nullptr;
+
+    if(fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size <= 0 ||
+       (Uint64)st.st_size > (Uint64)SIZE_MAX)
+    {
+        ::close(fd);
+        return nullptr;
+    }
+
+    data = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd); // The mapping keeps the file referenced
+
+    if(data == MAP_FAILED)
+        return nullptr;
+
+    madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+    f = (MappedFile *)SDL_calloc(1, sizeof(MappedFile));
+    ctx = SDL_AllocRW();
+    if(!f || !ctx)
+    {
+        SDL_free(f);
+        if(ctx)
+            SDL_FreeRW(ctx);
+        munmap(data, (size_t)st.st_size);
+        SDL_OutOfMemory();
+        return nullptr;
+    }
+
+    f->data = (Uint8 *)data;
+    f->size = (size_t)st.st_size;
+    f->pos = 0;
+    f->advisedBegin = 0;
+    f->advisedEnd = 0;
+    f->pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    mapped_advise(f);
+
+    ctx->size = mapped_size;
+    ctx->seek = mapped_seek;
+    ctx->read = mapped_read;
+    ctx->write = mapped_write;
+    ctx->close = mapped_close;
+    ctx->type = SDL_RWOPS_UNKNOWN;
+    ctx->hidden.unknown.data1 = f;
+
+    return ctx;
+}
+
+bool RWMappedData(SDL_RWops *ctx, const void **data, size_t *size)
+{
+    MappedFile *f;
+
+    if(!ctx || ctx->close != mapped_close)
+        return false;
+
+    f = (MappedFile *)ctx->hidden.unknown.data1;
+    *data = f->data;
+    *size = f->size;
+
+    return true;
+}
+
+bool IsLocalStorageFile(const char *path)
+{
+#if defined(__linux__)
+    struct statfs st;
+
+    if(statfs(path, &st) != 0)
+        return false;
+
+    switch((unsigned long)st.f_type)
+    {
+    case 0x6969UL:      // NFS
+    case 0x517BUL:      // SMB
+    case 0xFF534D42UL:  // CIFS
+    case 0xFE534D42UL:  // SMB2
+    case 0x65735546UL:  // FUSE
+    case 0x01021997UL:  // 9P
+    case 0x00C36400UL:  // Ceph
+    case 0x5346414FUL:  // AFS
+    case 0x564CUL:      // NCP
+        return false;
+    default:
+        return true;
+    }
+#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__)
+    struct statfs st;
+
+    if(statfs(path, &st) != 0)
+        return false;
+
+    return (st.f_flags & MNT_LOCAL) != 0;
+#else
+    (void)path;
+    return true;
+#endif
+}
+
+#else // MMAP_RWOPS_SUPPORTED
+
+SDL_RWops *RWFromMappedFile(const char *)
+{
+    return nullptr;
+}
+
+bool RWMappedData(SDL_RWops *, const void **, size_t *)
+{
+    return false;
+}
+
+bool IsLocalStorageFile(const char *)
+{
+    return false;
+}
+
+#endif // MMAP_RWOPS_SUPPORTED
@@ -0,0 +1,38 @@
+#ifndef MMAP_RWOPS_H
+#define MMAP_RWOPS_H
+
+#include <stddef.h>
+
+struct SDL_RWops;
+
+/**
+ * @brief Open a local file as a memory-mapped read-only SDL_RWops
+ * @param path Path to the file
+ * @return RWops or nullptr if the file can't be mapped (use SDL_RWFromFile() then)
+ *
+ * Reads are served from the mapping without system calls, the kernel
+ * gets read-ahead hints around the current read position.
+ */
+SDL_RWops *RWFromMappedFile(const char *path);
+
+/**
+ * @brief Get the mapped memory of the RWops opened by RWFromMappedFile()
+ * @param ctx RWops
+ * @param data Start of the mapping
+ * @param size Size of the file
+ * @return false if the RWops is not a mapped file
+ *
+ * The memory stays valid until the RWops is closed. Reading it directly skips the copy,
+ * seeking the RWops to the read position keeps the read-ahead hints following it.
+ */
+bool RWMappedData(SDL_RWops *ctx, const void **data, size_t *size);
+
+/**
+ * @brief Check if the file is on the local storage
+ * @param path Path to the file
+ * @return false for network and FUSE file systems, where page faults of the mapping
+ *         may stall for long and can't be interrupted
+ */
+bool IsLocalStorageFile(const char *path);
+
+#endif // MMAP_RWOPS_H
@@ -0,0 +1,535 @@
+#include <SDL2/SDL_log.h>
+#include <SDL2/SDL_rwops.h>
+
+extern "C"
+{
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+}
+
+#include <stdio.h>
+#include <mutex>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#if !defined(_WIN32) && !defined(__vita__)
+#   define PROBE_CACHE_MMAP
+#   include <sys/mman.h>
+#   include <fcntl.h>
+#   include <unistd.h>
+#endif
+
+#include "probe_cache.h"
+
+#if LIBAVCODEC_VERSION_INT >= AV_VERSION_INT(59, 24, 100)
+#define AVCODEC_NEW_CHANNEL_LAYOUT
+#endif
+
+#define PROBE_CACHE_MAGIC   0x43505644 /* "DVPC" */
+#define PROBE_CACHE_VERSION 1
+
+/*
+ * File layout (host byte order, the cache is local to the machine):
+ *
+ * CacheHeader
+ * Record 1: CacheRecord, key bytes, CacheStream + extradata for every stream (padded to 8 bytes)
+ * Record 2: ...
+ */
+
+struct CacheHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t count;
+    uint32_t reserved;
+};
+
+struct CacheRecord
+{
+    //! Size of the whole record including this header
+    uint32_t recordSize;
+    uint32_t keySize;
+    int64_t  fileSize;
+    int64_t  fileMtime;
+    int64_t  duration;
+    int64_t  startTime;
+    int64_t  bitRate;
+    double   probeMs;
+    uint32_t nbStreams;
+    uint32_t reserved;
+};
+
+struct CacheStream
+{
+    int32_t  codecType;
+    int32_t  codecId;
+    uint32_t codecTag;
+    int32_t  format;
+    int64_t  bitRate;
+    int32_t  width;
+    int32_t  height;
+    int32_t  sarNum;
+    int32_t  sarDen;
+    int32_t  sampleRate;
+    int32_t  channels;
+    uint64_t channelMask;
+    int32_t  frameSize;
+    int32_t  blockAlign;
+    int32_t  avgRateNum;
+    int32_t  avgRateDen;
+    int32_t  rRateNum;
+    int32_t  rRateDen;
+    int64_t  startTime;
+    int64_t  duration;
+    uint32_t extradataSize;
+    uint32_t reserved;
+};
+
+static inline size_t pad8(size_t v)
+{
+    return (v + 7) & ~(size_t)7;
+}
+
+/**
+ * @brief Check that all stream records and their extradata fit into the record
+ * @param data Start of the record
+ * @param rec Header of the record
+ * @return false if the record is damaged
+ */
+static bool record_valid(const uint8_t *data, const CacheRecord &rec)
+{
+    uint64_t pos = pad8(sizeof(CacheRecord) + (size_t)rec.keySize);
+
+    for(uint32_t i = 0; i < rec.nbStreams; ++i)
+    {
+        CacheStream cs;
+
+        if(pos + sizeof(CacheStream) > rec.recordSize)
+            return false;
+
+        SDL_memcpy(&cs, data + pos, sizeof(cs));
+
+        if(cs.extradataSize > (uint32_t)(INT32_MAX - AV_INPUT_BUFFER_PADDING_SIZE) ||
+           pos + sizeof(CacheStream) + cs.extradataSize > rec.recordSize)
+            return false;
+
+        pos += pad8(sizeof(CacheStream) + (size_t)cs.extradataSize);
+    }
+
+    return true;
+}
+
+static bool file_stat(const std::string &file, int64_t &size, int64_t &mtime)
+{
+    struct stat st;
+
+    if(stat(file.c_str(), &st) != 0)
+        return false;
+
+    size = (int64_t)st.st_size;
+    mtime = (int64_t)st.st_mtime;
+
+    return true;
+}
+
+ProbeCache::ProbeCache()
+{}
+
+ProbeCache::~ProbeCache()
+{
+    unmap();
+}
+
+void ProbeCache::unmap()
+{
+#ifdef PROBE_CACHE_MMAP
+    if(m_map && m_fileData.empty())
+        munmap((void *)m_map, m_mapSize);
+#endif
+    m_map = nullptr;
+    m_mapSize = 0;
+    m_fileData.clear();
+    m_loaded.clear();
+}
+
+bool ProbeCache::load(const std::string &path)
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+    return loadLocked(path);
+}
+
+bool ProbeCache::loadLocked(const std::string &path)
+{
+    CacheHeader head;
+    size_t pos;
+
+    unmap();
+
+#ifdef PROBE_CACHE_MMAP
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+
+    if(fd < 0)
+        return false;
+
+    if(fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(CacheHeader))
+    {
+        ::close(fd);
+        return false;
+    }
+
+    void *map = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+
+    if(map == MAP_FAILED)
+        return false;
+
+    m_map = (const uint8_t *)map;
+    m_mapSize = (size_t)st.st_size;
+#else
+    SDL_RWops *f = SDL_RWFromFile(path.c_str(), "rb");
+    Sint64 fsize;
+
+    if(!f)
+        return false;
+
+    fsize = SDL_RWsize(f);
+    if(fsize < (Sint64)sizeof(CacheHeader))
+    {
+        SDL_RWclose(f);
+        return false;
+    }
+
+    m_fileData.resize((size_t)fsize);
+    if(SDL_RWread(f, m_fileData.data(), 1, m_fileData.size()) != m_fileData.size())
+    {
+        SDL_RWclose(f);
+        m_fileData.clear();
+        return false;
+    }
+
+    SDL_RWclose(f);
+    m_map = m_fileData.data();
+    m_mapSize = m_fileData.size();
+#endif
+
+    SDL_memcpy(&head, m_map, sizeof(head));
+    if(head.magic != PROBE_CACHE_MAGIC || head.version != PROBE_CACHE_VERSION)
+    {
+        SDL_LogWarn(SDL_LOG_CATEGORY_APPLICATION, "Probe cache %s is invalid or outdated, ignoring", path.c_str());
+        unmap();
+        return false;
+    }
+
+    // Index the keys, the records themselves are read from the mapping on demand
+    pos = sizeof(CacheHeader);
+    for(uint32_t i = 0; i < head.count; ++i)
+    {
+        CacheRecord rec;
+
+        if(pos + sizeof(CacheRecord) > m_mapSize)
+            break;
+
+        SDL_memcpy(&rec, m_map + pos, sizeof(rec));
+        if((uint64_t)rec.recordSize < sizeof(CacheRecord) + (uint64_t)rec.keySize ||
+           (uint64_t)pos + rec.recordSize > m_mapSize || rec.recordSize % 8 != 0)
+            break; // Truncated file
+
+        // Damaged records are dropped, the rest of the file is still usable
+        if(record_valid(m_map + pos, rec))
+            m_loaded[std::string((const char *)m_map + pos + sizeof(CacheRecord), rec.keySize)] = m_map + pos;
+
+        pos += rec.recordSize;
+    }
+
+    return true;
+}
+
+bool ProbeCache::save(const std::string &path)
+{
+    std::string tmp = path + ".tmp";
+    CacheHeader head;
+    SDL_RWops *f;
+    bool ok = true;
+
+    std::lock_guard<std::mutex> guard(m_mutex);
+
+    f = SDL_RWFromFile(tmp.c_str(), "wb");
+    if(!f)
+        return false;
+
+    SDL_memset(&head, 0, sizeof(head));
+    head.magic = PROBE_CACHE_MAGIC;
+    head.version = PROBE_CACHE_VERSION;
+
+    for(const auto &r : m_loaded)
+    {
+        if(m_added.find(r.first) == m_added.end())
+            head.count++;
+    }
+
+    head.count += (uint32_t)m_added.size();
+
+    ok &= SDL_RWwrite(f, &head, sizeof(head), 1) == 1;
+
+    for(const auto &r : m_loaded)
+    {
+        CacheRecord rec;
+
+        if(m_added.find(r.first) != m_added.end())
+            continue; // Replaced by the new one
+
+        SDL_memcpy(&rec, r.second, sizeof(rec));
+        ok &= SDL_RWwrite(f, r.second, 1, rec.recordSize) == rec.recordSize;
+    }
+
+    for(const auto &r : m_added)
+        ok &= SDL_RWwrite(f, r.second.data(), 1, r.second.size()) == r.second.size();
+
+    SDL_RWclose(f);
+
+    if(!ok)
+    {
+        remove(tmp.c_str());
+        return false;
+    }
+
+    // Existing mapping must be released before the file gets replaced
+    std::unordered_map<std::string, std::vector<uint8_t> > added;
+    added.swap(m_added);
+
+    for(const auto &r : m_loaded)
+    {
+        if(added.find(r.first) == added.end())
+        {
+            CacheRecord rec;
+            SDL_memcpy(&rec, r.second, sizeof(rec));
+            added[r.first].assign(r.second, r.second + rec.recordSize);
+        }
+    }
+
+    unmap();
+
+    if(rename(tmp.c_str(), path.c_str()) != 0)
+    {
+        m_added.swap(added);
+        remove(tmp.c_str());
+        return false;
+    }
+
+    // Everything is at the file now, use it
+    if(!loadLocked(path))
+        m_added.swap(added);
+
+    return true;
+}
+
+bool ProbeCache::restore(const std::string &file, AVFormatContext *ctx)
+{
+    const uint8_t *data = nullptr;
+    CacheRecord rec;
+    int64_t size, mtime;
+    size_t pos;
+
+    std::lock_guard<std::mutex> guard(m_mutex);
+
+    auto added = m_added.find(file);
+    if(added != m_added.end())
+        data = added->second.data();
+    else
+    {
+        auto loaded = m_loaded.find(file);
+        if(loaded != m_loaded.end())
+            data = loaded->second;
+    }
+
+    // Streams of such inputs are created by reading packets, they can't be restored (MPEG-PS)
+    if(ctx->ctx_flags & AVFMTCTX_NOHEADER)
+    {
+        m_stats.misses++; // Probed in full anyway
+        return false;
+    }
+
+    if(!data || !file_stat(file, size, mtime))
+    {
+        m_stats.misses++;
+        return false;
+    }
+
+    SDL_memcpy(&rec, data, sizeof(rec));
+
+    // Streams created by the demuxer must match the cached ones
+    if(rec.fileSize != size || rec.fileMtime != mtime || rec.nbStreams != ctx->nb_streams || !record_valid(data, rec))
+    {
+        m_stats.misses++;
+        return false;
+    }
+
+    pos = pad8(sizeof(CacheRecord) + rec.keySize);
+
+    for(uint32_t i = 0; i < rec.nbStreams; ++i)
+    {
+        CacheStream cs;
+        AVCodecParameters *par = ctx->streams[i]->codecpar;
+
+        SDL_memcpy(&cs, data + pos, sizeof(cs));
+        pos += pad8(sizeof(CacheStream) + cs.extradataSize);
+
+        if(par->codec_type != (enum AVMediaType)cs.codecType ||
+           (par->codec_id != AV_CODEC_ID_NONE && par->codec_id != (enum AVCodecID)cs.codecId))
+        {
+            m_stats.misses++;
+            return false;
+        }
+    }
+
+    // Everything matches, apply
+    pos = pad8(sizeof(CacheRecord) + rec.keySize);
+
+    for(uint32_t i = 0; i < rec.nbStreams; ++i)
+    {
+        CacheStream cs;
+        AVStream *st = ctx->streams[i];
+        AVCodecParameters *par = st->codecpar;
+
+        SDL_memcpy(&cs, data + pos, sizeof(cs));
+
+        par->codec_id = (enum AVCodecID)cs.codecId;
+        par->codec_tag = cs.codecTag;
+        par->format = cs.format;
+        par->bit_rate = cs.bitRate;
+        par->width = cs.width;
+        par->height = cs.height;
+        par->sample_aspect_ratio = AVRational{cs.sarNum, cs.sarDen};
+        par->sample_rate = cs.sampleRate;
+        par->frame_size = cs.frameSize;
+        par->block_align = cs.blockAlign;
+
+#if defined(AVCODEC_NEW_CHANNEL_LAYOUT)
+        if(cs.channels > 0)
+        {
+            av_channel_layout_uninit(&par->ch_layout);
+            if(cs.channelMask)
+                av_channel_layout_from_mask(&par->ch_layout, cs.channelMask);
+            if(par->ch_layout.nb_channels != cs.channels)
+            {
+                av_channel_layout_uninit(&par->ch_layout);
+                av_channel_layout_default(&par->ch_layout, cs.channels);
+            }
+        }
+#else
+        par->channels = cs.channels;
+        par->channel_layout = cs.channelMask;
+#endif
+
+        if(cs.extradataSize > 0 && par->extradata_size == 0)
+        {
+            par->extradata = (uint8_t *)av_mallocz(cs.extradataSize + AV_INPUT_BUFFER_PADDING_SIZE);
+            if(par->extradata)
+            {
+                SDL_memcpy(par->extradata, data + pos + sizeof(CacheStream), cs.extradataSize);
+                par->extradata_size = (int)cs.extradataSize;
+            }
+        }
+
+        st->avg_frame_rate = AVRational{cs.avgRateNum, cs.avgRateDen};
+        st->r_frame_rate = AVRational{cs.rRateNum, cs.rRateDen};
+        st->start_time = cs.startTime;
+        st->duration = cs.duration;
+
+        pos += pad8(sizeof(CacheStream) + cs.extradataSize);
+    }
+
+    ctx->duration = rec.duration;
+    ctx->start_time = rec.startTime;
+    ctx->bit_rate = rec.bitRate;
+
+    m_stats.hits++;
+    m_stats.savedMs += rec.probeMs;
+
+    return true;
+}
+
+void ProbeCache::store(const std::string &file, AVFormatContext *ctx, double probeMs)
+{
+    std::vector<uint8_t> out;
+    CacheRecord rec;
+    int64_t size, mtime;
+    size_t pos;
+
+    std::lock_guard<std::mutex> guard(m_mutex);
+
+    // Would never hit, see restore()
+    if(ctx->ctx_flags & AVFMTCTX_NOHEADER)
+        return;
+
+    if(!file_stat(file, size, mtime))
+        return;
+
+    SDL_memset(&rec, 0, sizeof(rec));
+    rec.keySize = (uint32_t)file.size();
+    rec.fileSize = size;
+    rec.fileMtime = mtime;
+    rec.duration = ctx->duration;
+    rec.startTime = ctx->start_time;
+    rec.bitRate = ctx->bit_rate;
+    rec.probeMs = probeMs;
+    rec.nbStreams = ctx->nb_streams;
+
+    pos = pad8(sizeof(CacheRecord) + rec.keySize);
+    out.resize(pos, 0);
+    SDL_memcpy(out.data() + sizeof(CacheRecord), file.data(), file.size());
+
+    for(unsigned i = 0; i < ctx->nb_streams; ++i)
+    {
+        const AVStream *st = ctx->streams[i];
+        const AVCodecParameters *par = st->codecpar;
+        CacheStream cs;
+
+        SDL_memset(&cs, 0, sizeof(cs));
+        cs.codecType = par->codec_type;
+        cs.codecId = par->codec_id;
+        cs.codecTag = par->codec_tag;
+        cs.format = par->format;
+        cs.bitRate = par->bit_rate;
+        cs.width = par->width;
+        cs.height = par->height;
+        cs.sarNum = par->sample_aspect_ratio.num;
+        cs.sarDen = par->sample_aspect_ratio.den;
+        cs.sampleRate = par->sample_rate;
+        cs.frameSize = par->frame_size;
+        cs.blockAlign = par->block_align;
+#if defined(AVCODEC_NEW_CHANNEL_LAYOUT)
+        cs.channels = par->ch_layout.nb_channels;
+        cs.channelMask = par->ch_layout.order == AV_CHANNEL_ORDER_NATIVE ? par->ch_layout.u.mask : 0;
+#else
+        cs.channels = par->channels;
+        cs.channelMask = par->channel_layout;
+#endif
+        cs.avgRateNum = st->avg_frame_rate.num;
+        cs.avgRateDen = st->avg_frame_rate.den;
+        cs.rRateNum = st->r_frame_rate.num;
+        cs.rRateDen = st->r_frame_rate.den;
+        cs.startTime = st->start_time;
+        cs.duration = st->duration;
+        cs.extradataSize = par->extradata ? (uint32_t)par->extradata_size : 0;
+
+        out.resize(pos + pad8(sizeof(CacheStream) + cs.extradataSize), 0);
+        SDL_memcpy(out.data() + pos, &cs, sizeof(cs));
+        if(cs.extradataSize > 0)
+            SDL_memcpy(out.data() + pos + sizeof(CacheStream), par->extradata, cs.extradataSize);
+
+        pos = out.size();
+    }
+
+    rec.recordSize = (uint32_t)out.size();
+    SDL_memcpy(out.data(), &rec, sizeof(rec));
+
+    m_added[file].swap(out);
+}
+
+ProbeCache::Stats ProbeCache::stats() const
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+    return m_stats;
+}
@@ -0,0 +1,88 @@
+#ifndef PROBE_CACHE_H
+#define PROBE_CACHE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <unordered_map>
+
+struct AVFormatContext;
+typedef struct AVFormatContext AVFormatContext;
+
+/**
+ * @brief Persistent cache of the stream information of media files
+ *
+ * Stores stream layout and codec parameters (including the extradata) found by the
+ * avformat_find_stream_info() keyed by the file path, size and modification time.
+ * The cache file is a sequence of fixed layout records and is memory-mapped at load.
+ * Thread-safe: players restore and store from their prepare threads while the cache gets saved.
+ */
+class ProbeCache
+{
+public:
+    struct Stats
+    {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        //! Probe time saved by the cache hits, in milliseconds
+        double   savedMs = 0.0;
+    };
+
+    ProbeCache();
+    ~ProbeCache();
+
+    /**
+     * @brief Load the cache file
+     * @param path Path to the cache file
+     * @return true if file has been loaded
+     */
+    bool load(const std::string &path);
+
+    /**
+     * @brief Write the cache file (both loaded and new entries)
+     * @param path Path to the cache file
+     * @return true on success
+     */
+    bool save(const std::string &path);
+
+    /**
+     * @brief Apply the cached stream information to the just opened input
+     * @param file Path of the media file
+     * @param ctx Input context after the avformat_open_input() call
+     * @return true on cache hit, the avformat_find_stream_info() call can be skipped then
+     */
+    bool restore(const std::string &file, AVFormatContext *ctx);
+
+    /**
+     * @brief Remember the stream information of the input
+     * @param file Path of the media file
+     * @param ctx Input context after the avformat_find_stream_info() call
+     * @param probeMs Time spent by the avformat_find_stream_info() call
+     */
+    void store(const std::string &file, AVFormatContext *ctx, double probeMs);
+
+    Stats stats() const;
+
+private:
+    //! Must be called with the mutex locked
+    bool loadLocked(const std::string &path);
+    void unmap();
+
+    //! Mapped cache file
+    const uint8_t *m_map = nullptr;
+    size_t         m_mapSize = 0;
+    //! Cache file data when it can't be mapped
+    std::vector<uint8_t> m_fileData;
+
+    //! Records of the loaded file
+    std::unordered_map<std::string, const uint8_t *> m_loaded;
+    //! Records added since the load
+    std::unordered_map<std::string, std::vector<uint8_t> > m_added;
+
+    Stats m_stats;
+
+    mutable std::mutex m_mutex;
+};
+
+#endif // PROBE_CACHE_H
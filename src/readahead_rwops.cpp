@@ -0,0 +1,404 @@
+#include <SDL2/SDL_rwops.h>
+#include <SDL2/SDL_error.h>
+#include <SDL2/SDL_stdinc.h>
+#include <SDL2/SDL_mutex.h>
+#include <SDL2/SDL_thread.h>
+#include <SDL2/SDL_atomic.h>
+
+#include "readahead_rwops.h"
+
+#if !defined(_WIN32) && !defined(__vita__)
+#   define READAHEAD_RWOPS_SUPPORTED
+#   include <sys/types.h>
+#   include <sys/stat.h>
+#   include <fcntl.h>
+#   include <unistd.h>
+#   include <errno.h>
+#   if defined(__linux__) || defined(__FreeBSD__) || defined(__NetBSD__)
+#       define READAHEAD_HAS_FADVISE
+#   endif
+#endif
+
+#ifdef READAHEAD_RWOPS_SUPPORTED
+
+#define READAHEAD_WINDOW_MIN (1 * 1024 * 1024)
+#define READAHEAD_WINDOW_MAX (64 * 1024 * 1024)
+//! Size of a single read by the thread
+#define READAHEAD_CHUNK (256 * 1024)
+//! How often the waiting consumer checks the interrupt flag, in milliseconds
+#define READAHEAD_INTERRUPT_POLL 10
+
+struct ReadAheadFile
+{
+    int         fd;
+    Sint64      size;
+
+    //! Ring buffer, the file offset X is stored at X % cap
+    Uint8      *buf;
+    size_t      cap;
+
+    //! Range of the file which is available at the buffer
+    Sint64      start;
+    Sint64      end;
+    //! Read position of the consumer
+    Sint64      pos;
+    //! Incremented on every reset of the window, makes in-flight reads obsolete
+    Uint32      generation;
+    //! End of the range already advised to the kernel
+    Sint64      advised;
+
+    bool        quit;
+    bool        error;
+    //! The thread is reading the file outside of the mutex
+    bool        busy;
+    //! Closed while the thread was busy, the thread frees everything itself
+    bool        detached;
+
+    //! Makes the waiting consumer give up when non-zero (optional)
+    SDL_atomic_t *interrupt;
+
+    SDL_mutex  *mutex;
+    SDL_cond   *cond;
+    SDL_Thread *thread;
+};
+
+static void readahead_advise(ReadAheadFile *f)
+{
+#ifdef READAHEAD_HAS_FADVISE
+    if(f->end + (Sint64)f->cap / 2 < f->advised)
+        return; // Still far enough from the end of the advised range
+
+    posix_fadvise(f->fd, f->end, f->cap, POSIX_FADV_WILLNEED);
+    f->advised = f->end + (Sint64)f->cap;
+#else
+    (void)f;
+#endif
+}
+
+static void readahead_release(ReadAheadFile *f);
+
+static int SDLCALL readahead_thread(void *data)
+{
+    ReadAheadFile *f = (ReadAheadFile *)data;
+    bool detached;
+
+    SDL_LockMutex(f->mutex);
+
+    while(!f->quit)
+    {
+        Sint64 offset = f->end;
+        size_t chunk = READAHEAD_CHUNK;
+        size_t ringPos = (size_t)(offset % (Sint64)f->cap);
+        Uint32 gen = f->generation;
+        ssize_t got;
+
+        if(offset >= f->size || f->error ||
+           (offset - f->pos) + (Sint64)chunk > (Sint64)f->cap)
+        {
+            SDL_CondWait(f->cond, f->mutex); // Nothing to do: wait for the consumer
+            continue;
+        }
+
+        if(chunk > f->cap - ringPos)
+            chunk = f->cap - ringPos;
+        if((Sint64)chunk > f->size - offset)
+            chunk = (size_t)(f->size - offset);
+
+        // This part of the ring is going to be overwritten, it's no longer available for backward seeks
+        if(f->start < offset + (Sint64)chunk - (Sint64)f->cap)
+            f->start = offset + (Sint64)chunk - (Sint64)f->cap;
+
+        readahead_advise(f);
+
+        f->busy = true;
+        SDL_UnlockMutex(f->mutex);
+
+        do
+        {
+            got = pread(f->fd, f->buf + ringPos, chunk, (off_t)offset);
+        } while(got < 0 && errno == EINTR);
+
+        SDL_LockMutex(f->mutex);
+        f->busy = false;
+
+        if(f->quit)
+            break;
+
+        if(gen != f->generation)
+            continue; // Consumer has jumped away, this data isn't needed
+
+        if(got <= 0)
+            f->error = true;
+        else
+            f->end += got;
+
+        SDL_CondBroadcast(f->cond);
+    }
+
+    detached = f->detached;
+    SDL_UnlockMutex(f->mutex);
+
+    // Nobody waits for this thread anymore
+    if(detached)
+        readahead_release(f);
+
+    return 0;
+}
+
+//! Move the window to the new position, must be called with the mutex locked
+static void readahead_reset(ReadAheadFile *f, Sint64 pos)
+{
+    f->start = pos;
+    f->end = pos;
+    f->error = false;
+    f->advised = pos;
+    f->generation++;
+    SDL_CondBroadcast(f->cond);
+}
+
+static Sint64 SDLCALL readahead_size(SDL_RWops *ctx)
+{
+    ReadAheadFile *f = (ReadAheadFile *)ctx->hidden.unknown.data1;
+    return f->size;
+}
+
+static Sint64 SDLCALL readahead_seek(SDL_RWops *ctx, Sint64 offset, int whence)
+{
+    ReadAheadFile *f = (ReadAheadFile *)ctx->hidden.unknown.data1;
+    Sint64 newPos;
+
+    SDL_LockMutex(f->mutex);
+
+    switch(whence)
+    {
+    case RW_SEEK_SET:
+        newPos = offset;
+        break;
+    case RW_SEEK_CUR:
+        newPos = f->pos + offset;
+        break;
+    case RW_SEEK_END:
+        newPos = f->size + offset;
+        break;
+    default:
+        SDL_UnlockMutex(f->mutex);
+        return SDL_SetError("Unknown value for 'whence'");
+    }
+
+    if(newPos < 0)
+    {
+        SDL_UnlockMutex(f->mutex);
+        return SDL_SetError("Attempt to seek before the beginning of the file");
+    }
+
+    if(newPos > f->size)
+        newPos = f->size;
+
+    f->pos = newPos;
+
+    if(newPos < f->start || newPos > f->end)
+        readahead_reset(f, newPos);
+    else
+        SDL_CondBroadcast(f->cond); // Space might be freed
+
+    SDL_UnlockMutex(f->mutex);
+
+    return newPos;
+}
+
+static size_t SDLCALL readahead_read(SDL_RWops *ctx, void *ptr, size_t size, size_t maxnum)
+{
+    ReadAheadFile *f = (ReadAheadFile *)ctx->hidden.unknown.data1;
+    Uint8 *dst = (Uint8 *)ptr;
+    size_t total, done = 0;
+
+    if(size == 0 || maxnum == 0)
+        return 0;
+
+    total = size * maxnum;
+
+    SDL_LockMutex(f->mutex);
+
+    if(f->pos < f->start || f->pos > f->end)
+        readahead_reset(f, f->pos);
+
+    while(done < total && f->pos < f->size)
+    {
+        if(f->pos < f->end)
+        {
+            size_t ringPos = (size_t)(f->pos % (Sint64)f->cap);
+            size_t toCopy = (size_t)(f->end - f->pos);
+
+            if(toCopy > total - done)
+                toCopy = total - done;
+            if(toCopy > f->cap - ringPos)
+                toCopy = f->cap - ringPos;
+
+            SDL_memcpy(dst + done, f->buf + ringPos, toCopy);
+            done += toCopy;
+            f->pos += (Sint64)toCopy;
+            SDL_CondBroadcast(f->cond); // Space for the thread
+        }
+        else if(f->error)
+            break;
+        else if(f->interrupt)
+        {
+            if(SDL_AtomicGet(f->interrupt))
+                break;
+            SDL_CondWaitTimeout(f->cond, f->mutex, READAHEAD_INTERRUPT_POLL);
+        }
+        else
+            SDL_CondWait(f->cond, f->mutex);
+    }
+
+    // Return whole objects only, keep the remainder unread
+    f->pos -= (Sint64)(done % size);
+
+    SDL_UnlockMutex(f->mutex);
+
+    return done / size;
+}
+
+static size_t SDLCALL readahead_write(SDL_RWops *, const void *, size_t, size_t)
+{
+    SDL_SetError("Read-ahead file is read-only");
+    return 0;
+}
+
+//! Free everything except of the thread
+static void readahead_release(ReadAheadFile *f)
+{
+    if(f->cond)
+        SDL_DestroyCond(f->cond);
+    if(f->mutex)
+        SDL_DestroyMutex(f->mutex);
+    if(f->fd >= 0)
+        ::close(f->fd);
+
+    SDL_free(f->buf);
+    SDL_free(f);
+}
+
+static void readahead_free(ReadAheadFile *f)
+{
+    if(f->thread)
+    {
+        bool busy;
+
+        SDL_LockMutex(f->mutex);
+        f->quit = true;
+        busy = f->busy;
+        f->detached = busy;
+        SDL_CondBroadcast(f->cond);
+        SDL_UnlockMutex(f->mutex);
+
+        // Stalled storage may keep the read hanging for long, don't wait for it
+        if(busy)
+        {
+            SDL_DetachThread(f->thread);
+            return;
+        }
+
+        SDL_WaitThread(f->thread, nullptr);
+    }
+
+    readahead_release(f);
+}
+
+static int SDLCALL readahead_close(SDL_RWops *ctx)
+{
+    if(ctx)
+    {
+        ReadAheadFile *f = (ReadAheadFile *)ctx->hidden.unknown.data1;
+        if(f)
+            readahead_free(f);
+        SDL_FreeRW(ctx);
+    }
+
+    return 0;
+}
+
+SDL_RWops *RWFromFileReadAhead(const char *path, size_t window, SDL_atomic_t *interrupt)
+{
+    SDL_RWops *ctx;
+    ReadAheadFile *f;
+    struct stat st;
+    int fd;
+
+    if(window < READAHEAD_WINDOW_MIN)
+        window = READAHEAD_WINDOW_MIN;
+    else if(window > READAHEAD_WINDOW_MAX)
+        window = READAHEAD_WINDOW_MAX;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+        return nullptr;
+
+    if(fstat(fd, &st) < 0 || !S_ISREG(st.st_mode))
+    {
+        ::close(fd);
+        return nullptr;
+    }
+
+#ifdef READAHEAD_HAS_FADVISE
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    f = (ReadAheadFile *)SDL_calloc(1, sizeof(ReadAheadFile));
+    if(!f)
+    {
+        ::close(fd);
+        SDL_OutOfMemory();
+        return nullptr;
+    }
+
+    f->fd = fd;
+    f->size = (Sint64)st.st_size;
+    f->interrupt = interrupt;
+
+    // Small files don't need the whole window
+    f->cap = window;
+    if((Sint64)f->cap > f->size + READAHEAD_CHUNK)
+        f->cap = (size_t)f->size + READAHEAD_CHUNK;
+
+    f->buf = (Uint8 *)SDL_malloc(f->cap);
+    f->mutex = SDL_CreateMutex();
+    f->cond = SDL_CreateCond();
+    ctx = SDL_AllocRW();
+
+    if(!f->buf || !f->mutex || !f->cond || !ctx)
+    {
+        if(ctx)
+            SDL_FreeRW(ctx);
+        readahead_free(f);
+        SDL_OutOfMemory();
+        return nullptr;
+    }
+
+    f->thread = SDL_CreateThread(readahead_thread, "ReadAhead", f);
+    if(!f->thread)
+    {
+        SDL_FreeRW(ctx);
+        readahead_free(f);
+        return nullptr;
+    }
+
+    ctx->size = readahead_size;
+    ctx->seek = readahead_seek;
+    ctx->read = readahead_read;
+    ctx->write = readahead_write;
+    ctx->close = readahead_close;
+    ctx->type = SDL_RWOPS_UNKNOWN;
+    ctx->hidden.unknown.data1 = f;
+
+    return ctx;
+}
+
+#else // READAHEAD_RWOPS_SUPPORTED
+
+SDL_RWops *RWFromFileReadAhead(const char *, size_t, SDL_atomic_t *)
+{
+    return nullptr;
+}
+
+#endif // READAHEAD_RWOPS_SUPPORTED
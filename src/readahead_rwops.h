@@ -0,0 +1,22 @@
+#ifndef READAHEAD_RWOPS_H
+#define READAHEAD_RWOPS_H
+
+#include <stddef.h>
+#include <SDL2/SDL_atomic.h>
+
+struct SDL_RWops;
+
+/**
+ * @brief Open a local file with a background read-ahead thread
+ * @param path Path to the file
+ * @param window Size of the prefetch window in bytes (1 MB to 64 MB)
+ * @param interrupt Flag which makes reads waiting for the storage return short when set (optional)
+ * @return RWops or nullptr if the file can't be opened this way (use SDL_RWFromFile() then)
+ *
+ * The thread keeps up to the window size of data ahead of the read position. Seeks which
+ * land inside of the already fetched data are served without waiting for the storage.
+ * Closing doesn't wait for the read the thread is stuck in, the thread cleans up after it.
+ */
+SDL_RWops *RWFromFileReadAhead(const char *path, size_t window, SDL_atomic_t *interrupt = nullptr);
+
+#endif // READAHEAD_RWOPS_H
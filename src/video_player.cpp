@@ -1,5 +1,6 @@
 #include <SDL2/SDL_log.h>
 #include <SDL2/SDL_render.h>
+#include <SDL2/SDL_timer.h>
 
 extern "C"
 {
@@ -15,10 +16,40 @@ extern "C"
 }
 
 #include <string>
+#include <map>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #include "video_player.h"
-
-#define AUDIO_INBUF_SIZE 4096
+#include "audio_interleave.h"
+#include "probe_cache.h"
+#include "clip_cache.h"
+#include "mmap_rwops.h"
+#include "readahead_rwops.h"
+#include "Archives/archives.h"
+
+//! Read-ahead window used for local files
+#define FILE_READAHEAD_WINDOW (16 * 1024 * 1024)
+
+//! Limits of the input buffer size
+#define IO_BUFFER_SIZE_MIN (32 * 1024)
+#define IO_BUFFER_SIZE_MAX (4 * 1024 * 1024)
+
+//! Probing limits of non-seekable input: everything read while probing stays in memory to be replayed
+#define STREAM_PROBE_SIZE       (256 * 1024)
+#define STREAM_ANALYZE_DURATION AV_TIME_BASE
+
+//! Video queued by the pre-roll while waiting for the audio, the playback starts with less audio beyond it
+#define PREROLL_VIDEO_BYTES     (8 * 1024 * 1024)
+
+//! Seeks farther than this jump between distant areas of the file
+#define DUAL_CURSOR_FAR_SEEK    (1024 * 1024)
+//! Far seeks during the playback which reveal the badly interleaved file
+#define DUAL_CURSOR_DETECT      16
+//! The far seeks must happen while this much data gets read, rare jumps don't add up
+#define DUAL_CURSOR_WINDOW      (64 * 1024 * 1024)
+//! Size of the area read by one cursor at once
+#define DUAL_CURSOR_CHUNK       (1024 * 1024)
 
 #if LIBAVCODEC_VERSION_INT >= AV_VERSION_INT(59, 24, 100)
 #define AVCODEC_NEW_CHANNEL_LAYOUT
@@ -50,21 +81,75 @@ static std::string av_error_to_str(int err)
     return ret;
 }
 
+//! Speed limits of playback
+#define PLAYER_SPEED_MIN 0.5
+#define PLAYER_SPEED_MAX 16.0
+//! Above this speed, only key frames get decoded and audio gets muted
+#define PLAYER_FAST_FORWARD_SPEED 4.0
+
+struct MemoryAsset
+{
+    const void *data;
+    size_t      size;
+};
+
+static std::map<std::string, MemoryAsset> &memory_assets()
+{
+    static std::map<std::string, MemoryAsset> assets;
+    return assets;
+}
+
+//! Clips of files are keyed by the size and the modification time too, a replaced file doesn't replay the old clip
+static std::string file_clip_key(const std::string &path)
+{
+    struct stat st;
+
+    if(path.empty() || stat(path.c_str(), &st) != 0)
+        return std::string();
+
+    return path + "\n" + std::to_string((long long)st.st_size) + ":" + std::to_string((long long)st.st_mtime);
+}
+
+static inline int64_t paquet_ts(const AVPacket &p)
+{
+    return p.pts != AV_NOPTS_VALUE ? p.pts : p.dts;
+}
+
+static inline int audio_frame_size(const SDL_AudioSpec &spec)
+{
+    return (SDL_AUDIO_BITSIZE(spec.format) / 8) * spec.channels;
+}
+
 int _rw_read_buffer(void *opaque, uint8_t *buf, int buf_size)
 {
     DerVideoPlayer *music = (DerVideoPlayer *)opaque;
-    size_t ret = SDL_RWread(music->m_src, buf, 1, buf_size);
+    size_t ret;
+
+    if(SDL_AtomicGet(&music->m_cancel))
+        return AVERROR_EXIT;
+
+    if(music->m_dualCursor)
+        return music->cursorRead(buf, buf_size);
+
+    ret = SDL_RWread(music->m_src, buf, 1, buf_size);
+
+    music->m_ioStats.reads++;
 
     if (ret == 0) {
-        return AVERROR_EOF;
+        // Read-ahead gives up waiting when cancelled
+        return SDL_AtomicGet(&music->m_cancel) ? AVERROR_EXIT : AVERROR_EOF;
     }
 
+    music->m_ioStats.bytes += ret;
+    music->m_srcPos += (int64_t)ret;
+
     return ret;
 }
 
 int64_t _rw_seek(void *opaque, int64_t offset, int whence)
 {
     DerVideoPlayer *music = (DerVideoPlayer *)opaque;
+    int64_t pos;
     int rw_whence;
 
     switch(whence)
@@ -83,11 +168,89 @@ int64_t _rw_seek(void *opaque, int64_t offset, int whence)
         return SDL_RWsize(music->m_src);
     }
 
-    return SDL_RWseek(music->m_src, offset, rw_whence);
+    if(SDL_AtomicGet(&music->m_cancel))
+        return AVERROR_EXIT;
+
+    if(!music->m_dualCursor)
+        music->cursorDetect(offset, rw_whence);
+
+    if(music->m_dualCursor)
+        return music->cursorSeek(offset, rw_whence);
+
+    music->m_ioStats.seeks++;
+
+    pos = SDL_RWseek(music->m_src, offset, rw_whence);
+    if(pos >= 0)
+        music->m_srcPos = pos;
+
+    return pos;
+}
+
+int _mem_read_buffer(void *opaque, uint8_t *buf, int buf_size)
+{
+    DerVideoPlayer *music = (DerVideoPlayer *)opaque;
+    size_t avail = music->m_memSize - music->m_memPos;
+    size_t ret = (size_t)buf_size < avail ? (size_t)buf_size : avail;
+
+    music->m_ioStats.reads++;
+
+    if(ret == 0)
+        return AVERROR_EOF;
+
+    SDL_memcpy(buf, music->m_memData + music->m_memPos, ret);
+    music->m_memPos += ret;
+    music->m_ioStats.bytes += ret;
+
+    // Mapped file: move the read-ahead hints along
+    if(music->m_src)
+        SDL_RWseek(music->m_src, (Sint64)music->m_memPos, RW_SEEK_SET);
+
+    return (int)ret;
+}
+
+int64_t _mem_seek(void *opaque, int64_t offset, int whence)
+{
+    DerVideoPlayer *music = (DerVideoPlayer *)opaque;
+    int64_t pos;
+
+    switch(whence)
+    {
+    default:
+    case SEEK_SET:
+        pos = offset;
+        break;
+    case SEEK_CUR:
+        pos = (int64_t)music->m_memPos + offset;
+        break;
+    case SEEK_END:
+        pos = (int64_t)music->m_memSize + offset;
+        break;
+    case AVSEEK_SIZE:
+        return (int64_t)music->m_memSize;
+    }
+
+    music->m_ioStats.seeks++;
+
+    if(pos < 0 || pos > (int64_t)music->m_memSize)
+        return -1;
+
+    music->m_memPos = (size_t)pos;
+
+    if(music->m_src)
+        SDL_RWseek(music->m_src, pos, RW_SEEK_SET);
+
+    return pos;
 }
 
 void DerVideoPlayer::videoPaquetToQueue()
 {
+    if((m_videoKeysOnly || m_videoWaitKey) && !(m_paquet.flags & AV_PKT_FLAG_KEY))
+    {
+        av_packet_unref(&m_paquet);
+        return; // Not going to decode it anyway
+    }
+
+    m_videoWaitKey = false;
     m_videoPaquets.push_back(m_paquet);
     SDL_memset(&m_paquet, 0, sizeof(AVPacket));
 }
@@ -110,164 +273,469 @@ void DerVideoPlayer::videoPaquetsProcess()
     if(m_videoPaquets.empty())
         return; // Nothing To Do
 
-    videoTime = (double)m_videoPaquets.front().pts * timeBase;
+    videoTime = (double)paquet_ts(m_videoPaquets.front()) * timeBase;
 
     while(videoTime < m_time && !m_videoPaquets.empty())
     {
-        bool got;
+        bool got, show;
         auto p = m_videoPaquets.front();
-        videoTime = (double)p.pts * timeBase;
-        decode_video_packet(p, got);
-        av_packet_unref(&p);
         m_videoPaquets.pop_front();
+        videoTime = (double)paquet_ts(p) * timeBase;
+
+        // While fast-forwarding, don't convert frames which will be replaced by next ones at this pass
+        show = m_speed <= 1.0 ||
+               m_videoPaquets.empty() ||
+               (double)paquet_ts(m_videoPaquets.front()) * timeBase >= m_time;
+
+        decode_video_packet(p, got, show);
+        av_packet_unref(&p);
     }
 }
 
-bool DerVideoPlayer::updateAudioStream()
+bool DerVideoPlayer::updateAudioStream(const AVFrame *frame)
 {
+    enum AVSampleFormat sfmt;
+    int srate;
+    int channels;
+    int fmt = 0;
+
+#if defined(AVCODEC_NEW_CHANNEL_LAYOUT)
+    AVChannelLayout layout;
+#else
+    uint64_t layout;
+#endif
+
     if(!m_audio || !m_audio->codecpar)
         return true; // No audio - no actions!
 
-    enum AVSampleFormat sfmt = (enum AVSampleFormat)m_audio->codecpar->format;
-    int srate = m_audio->codecpar->sample_rate;
-
+    if(frame)
+    {
+        sfmt = (enum AVSampleFormat)frame->format;
+        srate = frame->sample_rate;
 #if defined(AVCODEC_NEW_CHANNEL_LAYOUT)
-    int channels = m_audio->codecpar->ch_layout.nb_channels;
+        channels = frame->ch_layout.nb_channels;
 #else
-    int channels = m_audio->codecpar->channels;
+        channels = frame->channels;
 #endif
-    int fmt = 0;
-
+    }
+    else
+    {
+        sfmt = (enum AVSampleFormat)m_audio->codecpar->format;
+        srate = m_audio->codecpar->sample_rate;
 #if defined(AVCODEC_NEW_CHANNEL_LAYOUT)
-    AVChannelLayout layout;
+        channels = m_audio->codecpar->ch_layout.nb_channels;
 #else
-    int layout;
+        channels = m_audio->codecpar->channels;
 #endif
+    }
+
+    if(sfmt == m_sfmt && srate == m_srate && channels == m_schannels && m_audio_cvt)
+        return true; // Nothing changed
 
     if(srate == 0 || channels == 0)
         return false;
 
-    if(sfmt != m_sfmt || srate != m_srate || channels != m_schannels || !m_audio_cvt)
+    m_planar = false;
+
+    switch(sfmt)
     {
-        m_planar = false;
+    case AV_SAMPLE_FMT_U8P:
+        m_planar = true;
+        m_dst_sample_fmt = AV_SAMPLE_FMT_U8;
+        /*fallthrough*/
+    case AV_SAMPLE_FMT_U8:
+        fmt = AUDIO_U8;
+        break;
 
-        switch(sfmt)
-        {
-        case AV_SAMPLE_FMT_U8P:
-            m_planar = true;
-            m_dst_sample_fmt = AV_SAMPLE_FMT_U8;
-            /*fallthrough*/
-        case AV_SAMPLE_FMT_U8:
-            fmt = AUDIO_U8;
-            break;
+    case AV_SAMPLE_FMT_S16P:
+        m_planar = true;
+        m_dst_sample_fmt = AV_SAMPLE_FMT_S16;
+        /*fallthrough*/
+    case AV_SAMPLE_FMT_S16:
+        fmt = AUDIO_S16SYS;
+        break;
 
-        case AV_SAMPLE_FMT_S16P:
-            m_planar = true;
-            m_dst_sample_fmt = AV_SAMPLE_FMT_S16;
-            /*fallthrough*/
-        case AV_SAMPLE_FMT_S16:
-            fmt = AUDIO_S16SYS;
-            break;
+    case AV_SAMPLE_FMT_S32P:
+        m_planar = true;
+        m_dst_sample_fmt = AV_SAMPLE_FMT_S32;
+        /*fallthrough*/
+    case AV_SAMPLE_FMT_S32:
+        fmt = AUDIO_S32SYS;
+        break;
 
-        case AV_SAMPLE_FMT_S32P:
-            m_planar = true;
-            m_dst_sample_fmt = AV_SAMPLE_FMT_S32;
-            /*fallthrough*/
-        case AV_SAMPLE_FMT_S32:
-            fmt = AUDIO_S32SYS;
-            break;
+    case AV_SAMPLE_FMT_FLTP:
+        m_planar = true;
+        m_dst_sample_fmt = AV_SAMPLE_FMT_FLT;
+        /*fallthrough*/
+    case AV_SAMPLE_FMT_FLT:
+        fmt = AUDIO_F32SYS;
+        break;
 
-        case AV_SAMPLE_FMT_FLTP:
-            m_planar = true;
-            m_dst_sample_fmt = AV_SAMPLE_FMT_FLT;
-            /*fallthrough*/
-        case AV_SAMPLE_FMT_FLT:
-            fmt = AUDIO_F32SYS;
-            break;
+    default:
+        return false; /* Unsupported audio format */
+    }
 
-        default:
-            return -1; /* Unsupported audio format */
-        }
+    // Interleave directly into the device's format when possible
+    if(sfmt == AV_SAMPLE_FMT_FLTP && m_dstSpec.format == AUDIO_S16SYS &&
+       audio_interleave_supported(sfmt, AV_SAMPLE_FMT_S16, channels))
+    {
+        m_dst_sample_fmt = AV_SAMPLE_FMT_S16;
+        fmt = AUDIO_S16SYS;
+    }
 
-        if(m_audio_cvt)
+    m_interleaveFast = m_planar && audio_interleave_supported(sfmt, m_dst_sample_fmt, channels);
+
+    if(m_audio_cvt)
+    {
+        // Keep the already converted audio, it will be played before the new one
+        audioStreamCarryOver();
+        SDL_FreeAudioStream(m_audio_cvt);
+        m_audio_cvt = nullptr;
+    }
+
+    if(m_swr_ctx)
+    {
+        swr_free(&m_swr_ctx);
+        m_swr_ctx = nullptr;
+    }
+
+    m_audio_cvt = SDL_NewAudioStream(fmt, (Uint8)channels, srate,
+                                     m_dstSpec.format, m_dstSpec.channels, m_dstSpec.freq);
+    if(!m_audio_cvt)
+        return false;
+
+    if(m_planar && !m_interleaveFast)
+    {
+        m_swr_ctx = swr_alloc();
+
+#if defined(AVCODEC_NEW_CHANNEL_LAYOUT)
+        SDL_memset(&layout, 0, sizeof(layout));
+        av_channel_layout_copy(&layout, frame ? &frame->ch_layout : &m_audio->codecpar->ch_layout);
+
+        if(layout.order != AV_CHANNEL_ORDER_NATIVE || layout.u.mask == 0)
         {
-            SDL_FreeAudioStream(m_audio_cvt);
-            m_audio_cvt = NULL;
+            av_channel_layout_uninit(&layout);
+            layout.order = AV_CHANNEL_ORDER_NATIVE;
+            layout.nb_channels = channels;
+
+            if(channels > 2)
+                layout.u.mask = AV_CH_LAYOUT_SURROUND;
+            else if(channels == 2)
+                layout.u.mask = AV_CH_LAYOUT_STEREO;
+            else if(channels == 1)
+                layout.u.mask = AV_CH_LAYOUT_MONO;
         }
 
-        m_merge_buffer.clear();
+        av_opt_set_chlayout(m_swr_ctx, "in_chlayout",  &layout, 0);
+        av_opt_set_chlayout(m_swr_ctx, "out_chlayout", &layout, 0);
+#else
+        layout = frame ? frame->channel_layout : m_audio->codecpar->channel_layout;
 
-        if(m_swr_ctx)
+        if(layout == 0)
         {
-            swr_free(&m_swr_ctx);
-            m_swr_ctx = nullptr;
+            if(channels > 2)
+                layout = AV_CH_LAYOUT_SURROUND;
+            else if(channels == 2)
+                layout = AV_CH_LAYOUT_STEREO;
+            else if(channels == 1)
+                layout = AV_CH_LAYOUT_MONO;
         }
 
-        m_audio_cvt = SDL_NewAudioStream(fmt, (Uint8)channels, srate,
-                                         m_dstSpec.format, m_dstSpec.channels, m_dstSpec.freq);
-        if(!m_audio_cvt)
-            return false;
+        av_opt_set_int(m_swr_ctx, "in_channel_layout",  layout, 0);
+        av_opt_set_int(m_swr_ctx, "out_channel_layout", layout, 0);
+#endif
+        av_opt_set_int(m_swr_ctx, "in_sample_rate",     srate, 0);
+        av_opt_set_int(m_swr_ctx, "out_sample_rate",    srate, 0);
+        av_opt_set_sample_fmt(m_swr_ctx, "in_sample_fmt",  sfmt, 0);
+        av_opt_set_sample_fmt(m_swr_ctx, "out_sample_fmt", m_dst_sample_fmt,  0);
+        swr_init(m_swr_ctx);
+
+#if defined(AVCODEC_NEW_CHANNEL_LAYOUT)
+        av_channel_layout_uninit(&layout);
+#endif
+    }
+
+    if(m_planar)
+        m_merge_buffer.resize(channels * av_get_bytes_per_sample(sfmt) * 4096);
+
+    m_sfmt = sfmt;
+    m_srate = srate;
+    m_schannels = channels;
+
+    return true;
+}
+
+void DerVideoPlayer::audioStreamCarryOver()
+{
+    int avail;
+    size_t old;
+
+    SDL_AudioStreamFlush(m_audio_cvt);
+    avail = SDL_AudioStreamAvailable(m_audio_cvt);
+    if(avail <= 0)
+        return;
 
-        if(m_planar)
+    if(m_audioCarryPos > 0)
+    {
+        m_audioCarry.erase(m_audioCarry.begin(), m_audioCarry.begin() + m_audioCarryPos);
+        m_audioCarryPos = 0;
+    }
+
+    old = m_audioCarry.size();
+    m_audioCarry.resize(old + avail);
+    avail = SDL_AudioStreamGet(m_audio_cvt, m_audioCarry.data() + old, avail);
+    m_audioCarry.resize(old + (avail > 0 ? avail : 0));
+}
+
+void DerVideoPlayer::audioStreamClear()
+{
+    if(m_audio_cvt)
+        SDL_AudioStreamClear(m_audio_cvt);
+
+    m_audioCarry.clear();
+    m_audioCarryPos = 0;
+}
+
+int DerVideoPlayer::audioStreamGet(Uint8 *stream, int len)
+{
+    if(m_audioCarryPos < m_audioCarry.size())
+    {
+        size_t toCopy = m_audioCarry.size() - m_audioCarryPos;
+
+        if(toCopy > (size_t)len)
+            toCopy = (size_t)len;
+
+        SDL_memcpy(stream, m_audioCarry.data() + m_audioCarryPos, toCopy);
+        m_audioCarryPos += toCopy;
+
+        if(m_audioCarryPos >= m_audioCarry.size())
         {
-            m_swr_ctx = swr_alloc();
+            m_audioCarry.clear();
+            m_audioCarryPos = 0;
+        }
+
+        return (int)toCopy;
+    }
+
+    return m_audio_cvt ? SDL_AudioStreamGet(m_audio_cvt, stream, len) : 0;
+}
+
+int DerVideoPlayer::audioStreamAvailable()
+{
+    int ret = (int)(m_audioCarry.size() - m_audioCarryPos);
+
+    if(m_audio_cvt)
+        ret += SDL_AudioStreamAvailable(m_audio_cvt);
+
+    return ret;
+}
+
+bool DerVideoPlayer::updateAudioDevice()
+{
+    SDL_AudioSpec want;
+    SDL_AudioSpec obtained;
+    int srate, channels;
+
+    if(!m_audioDev || !m_audioNativeRate)
+        return true; // Nothing to do
+
+    if(m_clipPlay)
+    {
+        srate = m_clipPlay->freq;
+        channels = m_clipPlay->channels;
+    }
+    else if(m_audio && m_audio->codecpar)
+    {
+        srate = m_audio->codecpar->sample_rate;
 #if defined(AVCODEC_NEW_CHANNEL_LAYOUT)
-            layout = m_audio->codecpar->ch_layout;
+        channels = m_audio->codecpar->ch_layout.nb_channels;
 #else
-            layout = m_audio->codecpar->channel_layout;
+        channels = m_audio->codecpar->channels;
 #endif
+    }
+    else
+        return true;
 
-#if defined(AVCODEC_NEW_CHANNEL_LAYOUT)
-            if(layout.u.mask == 0)
-            {
-                layout.order = AV_CHANNEL_ORDER_NATIVE;
-                layout.nb_channels = channels;
-
-                if(channels > 2)
-                    layout.u.mask = AV_CH_LAYOUT_SURROUND;
-                else if(channels == 2)
-                    layout.u.mask = AV_CH_LAYOUT_STEREO;
-                else if(channels == 1)
-                    layout.u.mask = AV_CH_LAYOUT_MONO;
-            }
+    if(srate <= 0 || channels <= 0)
+        return true;
 
-            av_opt_set_chlayout(m_swr_ctx, "in_chlayout",  &layout, 0);
-            av_opt_set_chlayout(m_swr_ctx, "out_chlayout", &layout, 0);
-#else
-            if(layout == 0)
-            {
-                if(channels > 2)
-                    layout = AV_CH_LAYOUT_SURROUND;
-                else if(channels == 2)
-                    layout = AV_CH_LAYOUT_STEREO;
-                else if(channels == 1)
-                    layout = AV_CH_LAYOUT_MONO;
-            }
+    // SDL2 supports 1, 2, 4, 6 and 8 channels only, keep the original otherwise
+    if(channels != 1 && channels != 2 && channels != 4 && channels != 6 && channels != 8)
+        channels = m_wantSpec.channels;
 
-            av_opt_set_int(m_swr_ctx, "in_channel_layout",  layout, 0);
-            av_opt_set_int(m_swr_ctx, "out_channel_layout", layout, 0);
-#endif
-            av_opt_set_int(m_swr_ctx, "in_sample_rate",     srate, 0);
-            av_opt_set_int(m_swr_ctx, "out_sample_rate",    srate, 0);
-            av_opt_set_sample_fmt(m_swr_ctx, "in_sample_fmt",  sfmt, 0);
-            av_opt_set_sample_fmt(m_swr_ctx, "out_sample_fmt", m_dst_sample_fmt,  0);
-            swr_init(m_swr_ctx);
+    if(srate == m_dstSpec.freq && channels == m_dstSpec.channels)
+        return true; // Already matches
+
+    if(SDL_GetAudioDeviceStatus(m_audioDev) == SDL_AUDIO_PLAYING)
+        return true; // Reopen will cause a gap, resample instead
+
+    want = m_wantSpec;
+    want.freq = srate;
+    want.channels = (Uint8)channels;
+
+    SDL_CloseAudioDevice(m_audioDev);
+    m_audioDev = SDL_OpenAudioDevice(nullptr, 0, &want, &obtained,
+                                     SDL_AUDIO_ALLOW_FREQUENCY_CHANGE | SDL_AUDIO_ALLOW_CHANNELS_CHANGE);
+
+    if(!m_audioDev)
+    {
+        SDL_LogWarn(SDL_LOG_CATEGORY_AUDIO, "Failed to reopen audio at %d Hz, %d channels: %s", srate, channels, SDL_GetError());
+        // Fall back to the originally requested spec
+        return openAudioDevice(m_wantSpec);
+    }
+
+    m_dstSpec = obtained;
+
+    return true;
+}
+
+bool DerVideoPlayer::updateAudioTempo(const AVFrame *frame)
+{
+    char args[512];
+    char layout[128];
+    std::string chain;
+    double tempo;
+    AVFilterInOut *outputs = nullptr;
+    AVFilterInOut *inputs = nullptr;
+    int ret;
+
+    if(!m_atempoDirty &&
+       (!m_atempo_graph || (frame->format == m_atempo_fmt && frame->sample_rate == m_atempo_rate)))
+        return true; // Nothing to change
+
+    closeAudioTempo();
+    m_atempoDirty = false;
+
+    if(m_speed == 1.0)
+        return true; // Pass the audio as is
+
+    m_atempo_graph = avfilter_graph_alloc();
+    if(!m_atempo_graph)
+    {
+        SDL_LogWarn(SDL_LOG_CATEGORY_ERROR, "FFMPEG: Out of memory");
+        return false;
+    }
 
 #if defined(AVCODEC_NEW_CHANNEL_LAYOUT)
-            av_channel_layout_uninit(&layout);
+    if(frame->ch_layout.order == AV_CHANNEL_ORDER_UNSPEC)
+    {
+        AVChannelLayout def;
+        av_channel_layout_default(&def, frame->ch_layout.nb_channels);
+        av_channel_layout_describe(&def, layout, sizeof(layout));
+        av_channel_layout_uninit(&def);
+    }
+    else
+        av_channel_layout_describe(&frame->ch_layout, layout, sizeof(layout));
+#else
+    SDL_snprintf(layout, sizeof(layout), "0x%llx",
+                 (unsigned long long)(frame->channel_layout ?
+                                      frame->channel_layout :
+                                      av_get_default_channel_layout(frame->channels)));
 #endif
 
-            m_merge_buffer.resize(channels * av_get_bytes_per_sample(sfmt) * 4096);
-        }
+    SDL_snprintf(args, sizeof(args), "time_base=1/%d:sample_rate=%d:sample_fmt=%s:channel_layout=%s",
+                 frame->sample_rate, frame->sample_rate,
+                 av_get_sample_fmt_name((enum AVSampleFormat)frame->format), layout);
+
+    ret = avfilter_graph_create_filter(&m_atempo_src, avfilter_get_by_name("abuffer"), "in", args, nullptr, m_atempo_graph);
+    if(ret < 0)
+    {
+        SDL_LogWarn(SDL_LOG_CATEGORY_ERROR, "FFMPEG: Can't create audio buffer source (%s)", av_error_to_str(ret).c_str());
+        closeAudioTempo();
+        return false;
+    }
+
+    ret = avfilter_graph_create_filter(&m_atempo_sink, avfilter_get_by_name("abuffersink"), "out", nullptr, nullptr, m_atempo_graph);
+    if(ret < 0)
+    {
+        SDL_LogWarn(SDL_LOG_CATEGORY_ERROR, "FFMPEG: Can't create audio buffer sink (%s)", av_error_to_str(ret).c_str());
+        closeAudioTempo();
+        return false;
+    }
+
+    // Older versions of atempo accept up to 2.0 only, so, chain them
+    tempo = m_speed;
+    while(tempo > 2.0)
+    {
+        chain += "atempo=2.0,";
+        tempo /= 2.0;
+    }
+
+    SDL_snprintf(args, sizeof(args), "atempo=%f", tempo);
+    chain += args;
+
+    outputs = avfilter_inout_alloc();
+    inputs = avfilter_inout_alloc();
+
+    if(outputs && inputs)
+    {
+        outputs->name = av_strdup("in");
+        outputs->filter_ctx = m_atempo_src;
+        outputs->pad_idx = 0;
+        outputs->next = nullptr;
+
+        inputs->name = av_strdup("out");
+        inputs->filter_ctx = m_atempo_sink;
+        inputs->pad_idx = 0;
+        inputs->next = nullptr;
+
+        ret = avfilter_graph_parse_ptr(m_atempo_graph, chain.c_str(), &inputs, &outputs, nullptr);
+    }
+    else
+        ret = AVERROR(ENOMEM);
 
-        m_sfmt = sfmt;
-        m_srate = srate;
-        m_schannels = channels;
+    avfilter_inout_free(&inputs);
+    avfilter_inout_free(&outputs);
+
+    if(ret < 0)
+    {
+        SDL_LogWarn(SDL_LOG_CATEGORY_ERROR, "FFMPEG: Can't parse the tempo filter (%s)", av_error_to_str(ret).c_str());
+        closeAudioTempo();
+        return false;
+    }
+
+    ret = avfilter_graph_config(m_atempo_graph, nullptr);
+    if(ret < 0)
+    {
+        SDL_LogWarn(SDL_LOG_CATEGORY_ERROR, "FFMPEG: Can't configure the tempo filter (%s)", av_error_to_str(ret).c_str());
+        closeAudioTempo();
+        return false;
     }
 
+    m_atempo_fmt = frame->format;
+    m_atempo_rate = frame->sample_rate;
+
     return true;
 }
 
+void DerVideoPlayer::closeAudioTempo()
+{
+    if(m_atempo_graph)
+        avfilter_graph_free(&m_atempo_graph);
+
+    m_atempo_graph = nullptr;
+    m_atempo_src = nullptr;
+    m_atempo_sink = nullptr;
+    m_atempo_fmt = -1;
+    m_atempo_rate = 0;
+}
+
+void DerVideoPlayer::updateAudioClock()
+{
+    int64_t buffered;
+
+    if(!m_audio || m_audioPtsEnd == AV_NOPTS_VALUE)
+        return;
+
+    buffered = audioStreamAvailable() / audio_frame_size(m_dstSpec);
+    buffered += m_dstSpec.samples;
+    // Buffered samples are already time-stretched
+    buffered = (int64_t)SDL_floor(buffered * m_speed + 0.5);
+
+    m_audioClock = m_audioPtsEnd - av_rescale_q(buffered, AVRational{1, m_dstSpec.freq}, m_audio->time_base);
+    m_time = (double)m_audioClock * av_q2d(m_audio->time_base);
+}
+
 bool DerVideoPlayer::updateVideoStream()
 {
     if(!m_video || !m_video->codecpar)
@@ -306,15 +774,88 @@ bool DerVideoPlayer::updateVideoStream()
     return false;
 }
 
-int DerVideoPlayer::decode_audio_packet(bool &got)
+int DerVideoPlayer::audioFrameToStream(AVFrame *frame)
 {
-    int ret = 0;
     size_t unpadded_linesize;
     size_t sample_size;
 
-    got = false;
+    if(m_planar)
+    {
+        sample_size = av_get_bytes_per_sample(m_dst_sample_fmt);
+        unpadded_linesize = sample_size * frame->nb_samples * m_schannels;
 
-    ret = avcodec_send_packet(m_decoderAudioCtx, &m_paquet);
+        if(unpadded_linesize > m_merge_buffer.size())
+            m_merge_buffer.resize(unpadded_linesize);
+
+        uint8_t *out = m_merge_buffer.data();
+
+        if(m_interleaveFast)
+            audio_interleave(m_sfmt, m_dst_sample_fmt, m_schannels,
+                             frame->extended_data, out, frame->nb_samples);
+        else
+            swr_convert(m_swr_ctx, &out, frame->nb_samples,
+                        (const Uint8**)frame->extended_data, frame->nb_samples);
+
+        if(SDL_AudioStreamPut(m_audio_cvt, m_merge_buffer.data(), unpadded_linesize) < 0)
+        {
+            SDL_LogWarn(SDL_LOG_CATEGORY_ERROR, "FFMPEG: Failed to put audio stream");
+            return -1;
+        }
+    }
+    else
+    {
+        unpadded_linesize = frame->nb_samples * av_get_bytes_per_sample((enum AVSampleFormat)frame->format) * m_schannels;
+
+        if(SDL_AudioStreamPut(m_audio_cvt, frame->extended_data[0], unpadded_linesize) < 0)
+        {
+            SDL_LogWarn(SDL_LOG_CATEGORY_ERROR, "FFMPEG: Failed to put audio stream");
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int DerVideoPlayer::audioSilenceToStream(int64_t samples)
+{
+    enum AVSampleFormat fmt = m_planar ? m_dst_sample_fmt : m_sfmt;
+    size_t frame_size = av_get_bytes_per_sample(fmt) * m_schannels;
+    Uint8 silence = (fmt == AV_SAMPLE_FMT_U8) ? 0x80 : 0x00;
+    Uint8 chunk[4096];
+    size_t bytes;
+
+    if(!m_audio_cvt || frame_size == 0 || samples <= 0)
+        return 0;
+
+    if(samples > m_srate)
+        samples = m_srate; // Don't fill more than one second of silence
+
+    SDL_memset(chunk, silence, sizeof(chunk));
+    bytes = (size_t)samples * frame_size;
+
+    while(bytes > 0)
+    {
+        size_t toPut = bytes > sizeof(chunk) ? sizeof(chunk) - (sizeof(chunk) % frame_size) : bytes;
+
+        if(SDL_AudioStreamPut(m_audio_cvt, chunk, (int)toPut) < 0)
+        {
+            SDL_LogWarn(SDL_LOG_CATEGORY_ERROR, "FFMPEG: Failed to put audio stream");
+            return -1;
+        }
+
+        bytes -= toPut;
+    }
+
+    return 0;
+}
+
+int DerVideoPlayer::decode_audio_packet(bool &got)
+{
+    int ret = 0;
+
+    got = false;
+
+    ret = avcodec_send_packet(m_decoderAudioCtx, &m_paquet);
     if(ret < 0)
     {
         if(ret == AVERROR_EOF)
@@ -339,42 +880,60 @@ int DerVideoPlayer::decode_audio_packet(bool &got)
             return ret;
         }
 
-        updateAudioStream();
+        if(!updateAudioStream(m_audio_frame))
+        {
+            SDL_LogWarn(SDL_LOG_CATEGORY_ERROR, "FFMPEG: Unsupported audio frame format, skipping");
+            av_frame_unref(m_audio_frame);
+            continue;
+        }
+
+        int64_t pts = m_audio_frame->best_effort_timestamp;
+        if(pts == AV_NOPTS_VALUE)
+            pts = m_audio_frame->pts;
 
-        if(m_planar)
+        if(m_audioResumePts != AV_NOPTS_VALUE && pts != AV_NOPTS_VALUE &&
+           pts + av_rescale_q(m_audio_frame->nb_samples, AVRational{1, m_audio_frame->sample_rate}, m_audio->time_base) <= m_audioResumePts)
         {
-            sample_size = av_get_bytes_per_sample((enum AVSampleFormat)m_audio_frame->format);
-            unpadded_linesize = sample_size * m_audio_frame->nb_samples * m_schannels;
+            // Whole frame is before the clock position (after the seek or the track switch)
+            av_frame_unref(m_audio_frame);
+            continue;
+        }
 
-            if(unpadded_linesize > m_merge_buffer.size())
-                m_merge_buffer.resize(unpadded_linesize);
+        if(m_audioResumePts != AV_NOPTS_VALUE)
+        {
+            // Just switched track or seeked: fill the gap between the clock and the first frame
+            if(pts != AV_NOPTS_VALUE && pts > m_audioResumePts)
+                audioSilenceToStream(av_rescale_q(pts - m_audioResumePts, m_audio->time_base, AVRational{1, m_srate}));
+            m_audioResumePts = AV_NOPTS_VALUE;
+        }
 
-            uint8_t *out = m_merge_buffer.data();
+        if(pts != AV_NOPTS_VALUE)
+            m_audioPtsEnd = pts;
+        else if(m_audioPtsEnd == AV_NOPTS_VALUE)
+            m_audioPtsEnd = 0;
 
-            swr_convert(m_swr_ctx, &out, m_audio_frame->nb_samples,
-                        (const Uint8**)m_audio_frame->extended_data, m_audio_frame->nb_samples);
+        m_audioPtsEnd += av_rescale_q(m_audio_frame->nb_samples,
+                                      AVRational{1, m_audio_frame->sample_rate},
+                                      m_audio->time_base);
 
-            // if (m_paquet.pts != AV_NOPTS_VALUE)
-            //     m_time = (double)m_paquet.pts * av_q2d(m_audio->time_base);
-            // else
-            //     m_time = -1.0;
+        if(!updateAudioTempo(m_audio_frame))
+            SDL_LogWarn(SDL_LOG_CATEGORY_ERROR, "FFMPEG: Failed to setup the audio tempo, playing at the normal tempo");
 
-            if(SDL_AudioStreamPut(m_audio_cvt, m_merge_buffer.data(), unpadded_linesize) < 0)
-            {
-                SDL_LogWarn(SDL_LOG_CATEGORY_ERROR, "FFMPEG: Failed to put audio stream");
-                return -1;
-            }
-        }
-        else
+        if(m_atempo_graph)
         {
-            unpadded_linesize = m_audio_frame->nb_samples * av_get_bytes_per_sample((enum AVSampleFormat)m_audio_frame->format);
+            if(av_buffersrc_add_frame(m_atempo_src, m_audio_frame) < 0)
+                SDL_LogWarn(SDL_LOG_CATEGORY_ERROR, "FFMPEG: Failed to feed the tempo filter");
 
-            if(SDL_AudioStreamPut(m_audio_cvt, m_audio_frame->extended_data[0], unpadded_linesize) < 0)
+            while(av_buffersink_get_frame(m_atempo_sink, m_atempo_frame) >= 0)
             {
-                SDL_LogWarn(SDL_LOG_CATEGORY_ERROR, "FFMPEG: Failed to put audio stream");
-                return -1;
+                int put = audioFrameToStream(m_atempo_frame);
+                av_frame_unref(m_atempo_frame);
+                if(put < 0)
+                    return put;
             }
         }
+        else if(audioFrameToStream(m_audio_frame) < 0)
+            return -1;
 
         av_frame_unref(m_audio_frame);
 
@@ -387,11 +946,9 @@ int DerVideoPlayer::decode_audio_packet(bool &got)
     return 0;
 }
 
-int DerVideoPlayer::decode_video_packet(AVPacket &paquet, bool &got)
+int DerVideoPlayer::decode_video_packet(AVPacket &paquet, bool &got, bool convert)
 {
     int ret = 0;
-    size_t unpadded_linesize;
-    size_t sample_size;
 
     got = false;
 
@@ -420,19 +977,32 @@ int DerVideoPlayer::decode_video_packet(AVPacket &paquet, bool &got)
             return ret;
         }
 
-        updateVideoStream();
+        int64_t pts = in_frame->best_effort_timestamp;
+        m_videoFrameTime = pts != AV_NOPTS_VALUE ? (double)pts * av_q2d(m_video->time_base) : m_time;
 
-        SDL_LockMutex(m_textureMutex);
+        // Accurate seek: frames before the target are decoded as references only
+        if(convert && m_videoFrameTime < m_videoSkipUntil)
+            convert = false;
 
-        uint8_t *out[] = {m_texturePixelData.data()};
-        int lines[] = {m_texture_pitch};
+        if(convert)
+        {
+            updateVideoStream();
 
-        sws_scale(m_video_cvt,
-                  in_frame->data, in_frame->linesize, 0, in_frame->height,
-                  out, lines);
+            SDL_LockMutex(m_textureMutex);
 
-        SDL_UnlockMutex(m_textureMutex);
-        m_hasVideoFrame = true;
+            uint8_t *out[] = {m_texturePixelData.data()};
+            int lines[] = {m_texture_pitch};
+
+            sws_scale(m_video_cvt,
+                      in_frame->data, in_frame->linesize, 0, in_frame->height,
+                      out, lines);
+
+            if(m_clipRecord)
+                clipRecordFrame(m_videoFrameTime);
+
+            SDL_UnlockMutex(m_textureMutex);
+            m_hasVideoFrame = true;
+        }
 
         double fps = av_q2d(av_guess_frame_rate(m_inputCtx, m_video, in_frame));
         m_timeNextFrame = m_time + (1.0 / fps);
@@ -452,11 +1022,15 @@ DerVideoPlayer::DerVideoPlayer(SDL_Renderer *dst) :
     m_render(dst)
 {
     SDL_memset(&m_paquet, 0, sizeof(AVPacket));
+    SDL_AtomicSet(&m_keyIndexReady, 0);
+    SDL_AtomicSet(&m_keyIndexAbort, 0);
+    SDL_AtomicSet(&m_cancel, 0);
 }
 
 DerVideoPlayer::~DerVideoPlayer()
 {
     close();
+    closeAudioDevice();
 }
 
 void DerVideoPlayer::setAudioSpec(SDL_AudioSpec &spec)
@@ -464,6 +1038,125 @@ void DerVideoPlayer::setAudioSpec(SDL_AudioSpec &spec)
     m_dstSpec = spec;
 }
 
+bool DerVideoPlayer::openAudioDevice(const SDL_AudioSpec &want)
+{
+    SDL_AudioSpec obtained;
+
+    closeAudioDevice();
+
+    m_wantSpec = want;
+    m_wantSpec.callback = &DerVideoPlayer::audio_out_stream;
+    m_wantSpec.userdata = this;
+
+    m_audioDev = SDL_OpenAudioDevice(nullptr, 0, &m_wantSpec, &obtained, 0);
+    if(!m_audioDev)
+    {
+        SDL_LogWarn(SDL_LOG_CATEGORY_AUDIO, "Failed to open audio: %s", SDL_GetError());
+        return false;
+    }
+
+    m_dstSpec = obtained;
+
+    return true;
+}
+
+void DerVideoPlayer::closeAudioDevice()
+{
+    if(m_audioDev)
+    {
+        SDL_CloseAudioDevice(m_audioDev);
+        m_audioDev = 0;
+    }
+}
+
+void DerVideoPlayer::setAudioPaused(bool paused)
+{
+    if(m_audioDev)
+        SDL_PauseAudioDevice(m_audioDev, paused ? 1 : 0);
+}
+
+void DerVideoPlayer::setNativeAudioRate(bool enable)
+{
+    m_audioNativeRate = enable;
+}
+
+void DerVideoPlayer::lockAudio()
+{
+    if(m_offline)
+        return;
+
+    if(m_audioDev)
+        SDL_LockAudioDevice(m_audioDev);
+    else if(m_sharedDev)
+        SDL_LockAudioDevice(m_sharedDev);
+    else
+        SDL_LockAudio();
+}
+
+void DerVideoPlayer::unlockAudio()
+{
+    if(m_offline)
+        return;
+
+    if(m_audioDev)
+        SDL_UnlockAudioDevice(m_audioDev);
+    else if(m_sharedDev)
+        SDL_UnlockAudioDevice(m_sharedDev);
+    else
+        SDL_UnlockAudio();
+}
+
+void DerVideoPlayer::setSpeed(double speed)
+{
+    if(speed < PLAYER_SPEED_MIN)
+        speed = PLAYER_SPEED_MIN;
+    else if(speed > PLAYER_SPEED_MAX)
+        speed = PLAYER_SPEED_MAX;
+
+    lockAudio();
+    if(speed != 1.0)
+        clipRecordAbort();
+    m_speed = speed;
+    m_atempoDirty = true;
+    applySpeed();
+    unlockAudio();
+}
+
+double DerVideoPlayer::speed() const
+{
+    return m_speed;
+}
+
+void DerVideoPlayer::applySpeed()
+{
+    bool fastForward = m_speed > PLAYER_FAST_FORWARD_SPEED;
+
+    if(m_decoderVideoCtx && fastForward != m_videoKeysOnly)
+    {
+        m_decoderVideoCtx->skip_frame = fastForward ? AVDISCARD_NONKEY : AVDISCARD_DEFAULT;
+
+        if(!fastForward)
+        {
+            // Decoder has no references for inter-frames, start from the next key frame
+            avcodec_flush_buffers(m_decoderVideoCtx);
+            videoPaquetsClean();
+            m_videoWaitKey = true;
+        }
+    }
+
+    m_videoKeysOnly = fastForward;
+
+    if(m_decoderAudioCtx && m_audioMuted && !fastForward)
+    {
+        // Audio packets were skipped while muted, restart the audio from scratch
+        avcodec_flush_buffers(m_decoderAudioCtx);
+        audioStreamClear();
+        m_audioPtsEnd = AV_NOPTS_VALUE;
+    }
+
+    m_audioMuted = fastForward;
+}
+
 void DerVideoPlayer::setRender(SDL_Renderer *dst)
 {
     m_render = dst;
@@ -471,6 +1164,22 @@ void DerVideoPlayer::setRender(SDL_Renderer *dst)
 
 void DerVideoPlayer::close()
 {
+    bool cancelled = SDL_AtomicGet(&m_cancel) != 0;
+
+    keyIndexStop();
+
+    // The clip has been played completely, keep it
+    if(m_clipRecord && m_clipCache && m_atEnd)
+        m_clipCache->insert(m_clipKey, m_clipRecord);
+
+    m_clipRecord.reset();
+    m_clipRecordPrev.clear();
+    m_clipPlay.reset();
+    m_clipKey.clear();
+    m_clipPcmPos = 0;
+    m_clipFrame = 0;
+    m_clipSamples = 0;
+
     if(m_audio_cvt)
     {
         SDL_FreeAudioStream(m_audio_cvt);
@@ -483,6 +1192,8 @@ void DerVideoPlayer::close()
         m_swr_ctx = nullptr;
     }
 
+    closeAudioTempo();
+
     if(m_video_cvt)
     {
         sws_freeContext(m_video_cvt);
@@ -492,6 +1203,7 @@ void DerVideoPlayer::close()
     m_texture_colour = AV_PIX_FMT_NONE;
     m_texture_w = 0;
     m_texture_h = 0;
+    m_hasVideoFrame = false;
 
     m_dst_colour = AV_PIX_FMT_NONE;
     m_dst_w = 0;
@@ -504,10 +1216,13 @@ void DerVideoPlayer::close()
     }
 
     m_merge_buffer.clear();
+    m_audioCarry.clear();
+    m_audioCarryPos = 0;
 
     av_frame_free(&sw_frame);
     av_frame_free(&in_frame);
     av_frame_free(&m_audio_frame);
+    av_frame_free(&m_atempo_frame);
 
     /* flush the decoder */
     m_paquet.data = nullptr;
@@ -525,217 +1240,1403 @@ void DerVideoPlayer::close()
     if(m_decoderVideoCtx)
         avcodec_free_context(&m_decoderVideoCtx);
 
-    if(m_inputCtx)
-    {
-        avformat_close_input(&m_inputCtx);
-        m_inputCtx = nullptr;
-    }
+    if(m_inputCtx)
+    {
+        avformat_close_input(&m_inputCtx);
+        m_inputCtx = nullptr;
+    }
+
+    if(m_textureMutex)
+    {
+        SDL_DestroyMutex(m_textureMutex);
+        m_textureMutex = nullptr;
+    }
+
+    // Custom I/O context is not freed by the avformat_close_input()
+    if(avio_in)
+    {
+        av_freep(&avio_in->buffer);
+        avio_context_free(&avio_in);
+        avio_in = nullptr;
+    }
+
+    in_buffer = NULL; /* This buffer is owned by the AVIO context */
+    in_buffer_size = 0;
+
+    if(m_src && m_freesrc)
+        SDL_RWclose(m_src);
+
+    m_src = nullptr;
+    m_freesrc = false;
+
+    m_memData = nullptr;
+    m_memSize = 0;
+    m_memPos = 0;
+    m_probePath.clear();
+    m_streaming = false;
+
+    m_srcPos = 0;
+    m_srcPhysPos = 0;
+    m_dualCursor = false;
+    m_farSeeks = 0;
+    m_farSeeksWindow = 0;
+    m_seeking = false;
+    m_cursorTick = 0;
+    m_cursorSeeks = 0;
+    m_cursorSourceSeeks = 0;
+    for(auto &c : m_cursors)
+    {
+        c.data.clear();
+        c.data.shrink_to_fit();
+        c.start = 0;
+        c.size = 0;
+        c.used = 0;
+    }
+
+    m_video = nullptr;
+    m_audio = nullptr;
+    m_streamAudio = -1;
+    m_decoderVideo = nullptr;
+    m_decoderAudio = nullptr;
+    m_sfmt = AV_SAMPLE_FMT_NONE;
+    m_srate = 0;
+    m_schannels = 0;
+    m_planar = false;
+    m_interleaveFast = false;
+    m_videoKeysOnly = false;
+    m_videoWaitKey = false;
+    m_audioMuted = false;
+    // Every load starts at the normal speed, a player of the playlist gets reused for later items
+    m_speed = 1.0;
+
+    // The token stays: close() at the start of every load must not swallow the cancel
+    if(cancelled)
+    {
+        if(m_cancelStart)
+        {
+            m_stopDuration = (double)(SDL_GetPerformanceCounter() - m_cancelStart) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+            m_cancelStart = 0;
+        }
+    }
+    else
+        m_stopDuration = 0.0;
+}
+
+void DerVideoPlayer::cancel()
+{
+    // The start time must be visible before the flag
+    m_cancelStart = SDL_GetPerformanceCounter();
+    SDL_AtomicSet(&m_cancel, 1);
+}
+
+void DerVideoPlayer::resetCancel()
+{
+    SDL_AtomicSet(&m_cancel, 0);
+    m_cancelStart = 0;
+}
+
+double DerVideoPlayer::stopDuration() const
+{
+    return m_stopDuration;
+}
+
+int DerVideoPlayer::interrupt_cb(void *self)
+{
+    DerVideoPlayer *p = (DerVideoPlayer *)self;
+    return SDL_AtomicGet(&p->m_cancel);
+}
+
+size_t DerVideoPlayer::ioBufferSizeClamp(size_t size)
+{
+    size_t ret = IO_BUFFER_SIZE_MIN;
+
+    // Round up to the power of two
+    while(ret < size && ret < IO_BUFFER_SIZE_MAX)
+        ret <<= 1;
+
+    return ret;
+}
+
+size_t DerVideoPlayer::ioBufferSizeFor(int64_t fileSize) const
+{
+    if(m_ioBufferSize > 0)
+        return ioBufferSizeClamp(m_ioBufferSize);
+
+    if(fileSize <= 0)
+        return IO_BUFFER_SIZE_MIN; // Unknown size
+
+    // Large files tend to have higher bit rates
+    return ioBufferSizeClamp((size_t)(fileSize / 128));
+}
+
+void DerVideoPlayer::setIOBufferSize(size_t bytes)
+{
+    m_ioBufferSize = bytes;
+}
+
+DerVideoPlayer::IOStats DerVideoPlayer::ioStats() const
+{
+    return m_ioStats;
+}
+
+void DerVideoPlayer::cursorDetect(int64_t offset, int whence)
+{
+    int64_t target, dist;
+
+    // Seeks done while opening (index, stream info) or requested by the user don't count
+    if(!m_video || m_seeking || whence == RW_SEEK_END)
+        return;
+
+    target = whence == RW_SEEK_CUR ? m_srcPos + offset : offset;
+    dist = target > m_srcPos ? target - m_srcPos : m_srcPos - target;
+
+    if(dist < DUAL_CURSOR_FAR_SEEK)
+        return;
+
+    if(m_farSeeks == 0 || m_ioStats.bytes - m_farSeeksWindow > DUAL_CURSOR_WINDOW)
+    {
+        m_farSeeks = 0;
+        m_farSeeksWindow = m_ioStats.bytes;
+    }
+
+    if(++m_farSeeks < DUAL_CURSOR_DETECT)
+        return;
+
+    // Audio and video are far apart: let each of them be read by its own cursor
+    m_dualCursor = true;
+    m_srcPhysPos = m_srcPos;
+    m_ioStats.dualCursor = true;
+
+    for(auto &c : m_cursors)
+    {
+        c.data.resize(DUAL_CURSOR_CHUNK);
+        c.start = 0;
+        c.size = 0;
+        c.used = 0;
+    }
+}
+
+DerVideoPlayer::ReadCursor *DerVideoPlayer::cursorFind(int64_t pos)
+{
+    for(auto &c : m_cursors)
+    {
+        if(c.size > 0 && pos >= c.start && pos < c.start + (int64_t)c.size)
+            return &c;
+    }
+
+    return nullptr;
+}
+
+int64_t DerVideoPlayer::cursorSeek(int64_t offset, int whence)
+{
+    int64_t pos;
+
+    switch(whence)
+    {
+    case RW_SEEK_CUR:
+        pos = m_srcPos + offset;
+        break;
+    case RW_SEEK_END:
+        pos = SDL_RWsize(m_src) + offset;
+        break;
+    default:
+        pos = offset;
+        break;
+    }
+
+    if(pos < 0)
+        return -1;
+
+    m_cursorSeeks++;
+    m_srcPos = pos;
+
+    return pos;
+}
+
+int DerVideoPlayer::cursorRead(uint8_t *buf, int buf_size)
+{
+    ReadCursor *c = cursorFind(m_srcPos);
+    size_t got, off;
+
+    if(!c)
+    {
+        // Prefer the cursor which continues right here, otherwise replace the least recently used one
+        if(m_cursors[0].start + (int64_t)m_cursors[0].size == m_srcPos)
+            c = &m_cursors[0];
+        else if(m_cursors[1].start + (int64_t)m_cursors[1].size == m_srcPos)
+            c = &m_cursors[1];
+        else
+            c = m_cursors[0].used <= m_cursors[1].used ? &m_cursors[0] : &m_cursors[1];
+
+        if(m_srcPhysPos != m_srcPos)
+        {
+            m_ioStats.seeks++;
+            m_cursorSourceSeeks++;
+
+            if(SDL_RWseek(m_src, m_srcPos, RW_SEEK_SET) < 0)
+                return SDL_AtomicGet(&m_cancel) ? AVERROR_EXIT : AVERROR(EIO);
+
+            m_srcPhysPos = m_srcPos;
+        }
+
+        got = SDL_RWread(m_src, c->data.data(), 1, c->data.size());
+        m_ioStats.reads++;
+
+        if(got == 0)
+            return SDL_AtomicGet(&m_cancel) ? AVERROR_EXIT : AVERROR_EOF;
+
+        m_ioStats.bytes += got;
+        m_srcPhysPos += (int64_t)got;
+        c->start = m_srcPos;
+        c->size = got;
+    }
+
+    off = (size_t)(m_srcPos - c->start);
+    got = c->size - off;
+    if(got > (size_t)buf_size)
+        got = (size_t)buf_size;
+
+    SDL_memcpy(buf, c->data.data() + off, got);
+    m_srcPos += (int64_t)got;
+    c->used = ++m_cursorTick;
+
+    // Everything the demuxer asked to jump to and got without seeking the source
+    m_ioStats.seeksAvoided = m_cursorSeeks > m_cursorSourceSeeks ? m_cursorSeeks - m_cursorSourceSeeks : 0;
+
+    return (int)got;
+}
+
+void DerVideoPlayer::setProbeCache(ProbeCache *cache)
+{
+    m_probeCache = cache;
+}
+
+void DerVideoPlayer::setClipCache(ClipCache *cache)
+{
+    m_clipCache = cache;
+}
+
+bool DerVideoPlayer::loadCachedClip(const std::string &key)
+{
+    std::shared_ptr<const CachedClip> clip;
+
+    if(!m_clipCache || key.empty() || m_speed != 1.0)
+        return false;
+
+    clip = m_clipCache->find(key);
+    if(!clip)
+        return false;
+
+    m_clipPlay = clip;
+    updateAudioDevice();
+
+    if(clip->freq != m_dstSpec.freq || clip->format != m_dstSpec.format || clip->channels != m_dstSpec.channels)
+    {
+        // Output device has been changed since the recording
+        m_audio_cvt = SDL_NewAudioStream(clip->format, clip->channels, clip->freq,
+                                         m_dstSpec.format, m_dstSpec.channels, m_dstSpec.freq);
+        if(!m_audio_cvt)
+        {
+            SDL_LogWarn(SDL_LOG_CATEGORY_ERROR, "Failed to convert audio of the cached clip: %s", SDL_GetError());
+            m_clipPlay.reset();
+            return false;
+        }
+    }
+
+    m_clipKey = key;
+    m_clipPcmPos = 0;
+    m_clipFrame = 0;
+    m_clipSamples = 0;
+
+    m_dst_colour = AV_PIX_FMT_RGB24;
+    m_dst_w = clip->width;
+    m_dst_h = clip->height;
+    m_texture_pitch = clip->pitch;
+    m_texturePixelData.resize((size_t)clip->pitch * clip->height);
+
+    m_time = 0.0;
+    m_atEnd = false;
+
+    // Show the first frame right away, like the pre-roll does
+    if(!clip->frames.empty())
+    {
+        clip->unpackFrame(0, m_texturePixelData.data());
+        m_clipFrame = 1;
+        m_hasVideoFrame = true;
+    }
+
+    m_textureMutex = SDL_CreateMutex();
+
+    return true;
+}
+
+void DerVideoPlayer::clipRecordStart(const std::string &key)
+{
+    if(!m_clipCache || key.empty() || m_speed != 1.0 || !m_inputCtx)
+        return;
+
+    // Don't waste memory for clips known to be too long
+    if(m_inputCtx->duration != AV_NOPTS_VALUE &&
+       (double)m_inputCtx->duration / AV_TIME_BASE > m_clipCache->maxDuration())
+        return;
+
+    m_clipRecord = std::make_shared<CachedClip>();
+    m_clipRecord->width = m_dst_w;
+    m_clipRecord->height = m_dst_h;
+    m_clipRecord->pitch = m_texture_pitch;
+    m_clipRecord->freq = m_dstSpec.freq;
+    m_clipRecord->format = m_dstSpec.format;
+    m_clipRecord->channels = m_dstSpec.channels;
+    m_clipRecordPrev.clear();
+    m_clipKey = key;
+}
+
+void DerVideoPlayer::clipRecordFrame(double time)
+{
+    CachedClip &clip = *m_clipRecord;
+
+    if(m_texturePixelData.size() < (size_t)clip.pitch * clip.height)
+    {
+        clipRecordAbort();
+        return;
+    }
+
+    clip.addFrame(time, m_texturePixelData.data(), m_clipRecordPrev.empty() ? nullptr : m_clipRecordPrev.data());
+    m_clipRecordPrev.assign(m_texturePixelData.begin(), m_texturePixelData.begin() + (size_t)clip.pitch * clip.height);
+
+    if(clip.memory > m_clipCache->budget() || time > m_clipCache->maxDuration())
+        clipRecordAbort();
+}
+
+void DerVideoPlayer::clipRecordPcm(const Uint8 *data, int len)
+{
+    if(!m_clipRecord || len <= 0)
+        return;
+
+    CachedClip &clip = *m_clipRecord;
+    size_t bytesPerSec = (size_t)audio_frame_size(m_dstSpec) * clip.freq;
+
+    clip.addPcm(data, (size_t)len);
+
+    if(clip.memory > m_clipCache->budget() || (double)clip.pcm.size() / bytesPerSec > m_clipCache->maxDuration())
+        clipRecordAbort();
+}
+
+void DerVideoPlayer::clipRecordAbort()
+{
+    m_clipRecord.reset();
+    m_clipRecordPrev.clear();
+}
+
+int DerVideoPlayer::runClip(Uint8 *stream, int len)
+{
+    const CachedClip &clip = *m_clipPlay;
+    int filled;
+
+    if(m_audio_cvt)
+    {
+        size_t chunk = (size_t)((SDL_AUDIO_BITSIZE(clip.format) / 8) * clip.channels) * 4096;
+
+        while(SDL_AudioStreamAvailable(m_audio_cvt) < len && m_clipPcmPos < clip.pcm.size())
+        {
+            if(chunk > clip.pcm.size() - m_clipPcmPos)
+                chunk = clip.pcm.size() - m_clipPcmPos;
+
+            if(SDL_AudioStreamPut(m_audio_cvt, clip.pcm.data() + m_clipPcmPos, (int)chunk) < 0)
+            {
+                SDL_LogWarn(SDL_LOG_CATEGORY_ERROR, "Failed to put audio stream");
+                m_clipPcmPos = clip.pcm.size();
+            }
+            else
+                m_clipPcmPos += chunk;
+
+            if(m_clipPcmPos >= clip.pcm.size())
+                SDL_AudioStreamFlush(m_audio_cvt);
+        }
+
+        filled = SDL_AudioStreamGet(m_audio_cvt, stream, len);
+        if(filled < 0)
+            filled = 0;
+    }
+    else
+    {
+        filled = (int)SDL_min((size_t)len, clip.pcm.size() - m_clipPcmPos);
+        SDL_memcpy(stream, clip.pcm.data() + m_clipPcmPos, filled);
+        m_clipPcmPos += filled;
+    }
+
+    m_clipSamples += filled / audio_frame_size(m_dstSpec);
+    m_time = (double)m_clipSamples / m_dstSpec.freq;
+
+    if(m_clipFrame < clip.frames.size() && clip.frames[m_clipFrame].time < m_time)
+    {
+        SDL_LockMutex(m_textureMutex);
+
+        // Packed frames depend on previous ones, none can be skipped
+        while(m_clipFrame < clip.frames.size() && clip.frames[m_clipFrame].time < m_time)
+            clip.unpackFrame(m_clipFrame++, m_texturePixelData.data());
+
+        m_hasVideoFrame = true;
+        SDL_UnlockMutex(m_textureMutex);
+    }
+
+    if(filled < len)
+    {
+        SDL_memset(stream + filled, m_dstSpec.silence, len - filled);
+        m_atEnd = true;
+    }
+
+    return len;
+}
+
+bool DerVideoPlayer::loadVideo(SDL_RWops *src, bool freesrc, const std::string &path)
+{
+    // Pipes and FIFOs can only be read forward, and their path says nothing about the content
+    if(SDL_RWseek(src, 0, RW_SEEK_CUR) < 0)
+        return loadVideoStream(src, freesrc);
+
+    const void *mapped;
+    size_t mappedSize;
+    std::string clipKey;
+
+    close();
+
+    m_src = src;
+
+    // Mapped files are read straight from the memory, like assets
+    if(RWMappedData(src, &mapped, &mappedSize))
+    {
+        m_memData = (const Uint8 *)mapped;
+        m_memSize = mappedSize;
+        m_memPos = 0;
+    }
+
+    clipKey = file_clip_key(path);
+
+    if(loadCachedClip(clipKey))
+    {
+        m_freesrc = freesrc; // Not needed anymore, but owned as usual
+        return true;
+    }
+
+    m_probePath = path;
+
+    if(!openInput(SDL_RWsize(src)))
+        return false;
+
+    m_freesrc = freesrc;
+    clipRecordStart(clipKey);
+    keyIndexStart();
+
+    return true;
+}
+
+bool DerVideoPlayer::loadVideoStream(SDL_RWops *src, bool freesrc)
+{
+    close();
+
+    m_src = src;
+    m_streaming = true;
+
+    if(!openInput(-1))
+        return false;
+
+    m_freesrc = freesrc;
+
+    return true;
+}
+
+bool DerVideoPlayer::loadVideoFile(const std::string &path)
+{
+    SDL_RWops *src;
+    struct stat st;
+
+    if(path == "-")
+    {
+        src = SDL_RWFromFP(stdin, SDL_FALSE);
+        if(!src)
+        {
+            SDL_LogWarn(SDL_LOG_CATEGORY_ERROR, "Failed to open the standard input: %s", SDL_GetError());
+            close();
+            return false;
+        }
+
+        if(!loadVideoStream(src, true))
+        {
+            SDL_RWclose(src);
+            return false;
+        }
+
+        return true;
+    }
+
+    if(Archives::has_prefix(path))
+    {
+        const void *data;
+        size_t size;
+
+        // Stored entries are played straight from the mapped archive
+        if(Archives::map_file(path.c_str(), &data, &size))
+            return loadVideoMemory(data, size);
+
+        src = Archives::open_file(path.c_str());
+        if(!src)
+        {
+            SDL_LogWarn(SDL_LOG_CATEGORY_ERROR, "Failed to open file %s: %s", path.c_str(), SDL_GetError());
+            close();
+            return false;
+        }
+
+        if(!loadVideo(src, true))
+        {
+            SDL_RWclose(src);
+            return false;
+        }
+
+        return true;
+    }
+
+    // FIFO or device: opened only once, every close might leave the writer without the reader
+    if(stat(path.c_str(), &st) == 0 && !S_ISREG(st.st_mode))
+    {
+        src = SDL_RWFromFile(path.c_str(), "rb");
+        if(!src)
+        {
+            SDL_LogWarn(SDL_LOG_CATEGORY_ERROR, "Failed to open file %s: %s", path.c_str(), SDL_GetError());
+            close();
+            return false;
+        }
+
+        if(!loadVideoStream(src, true))
+        {
+            SDL_RWclose(src);
+            return false;
+        }
+
+        return true;
+    }
+
+    // Local files get mapped, slow network storage gets the read-ahead thread, which can be interrupted
+    src = IsLocalStorageFile(path.c_str()) ? RWFromMappedFile(path.c_str()) : nullptr;
+    if(!src)
+        src = RWFromFileReadAhead(path.c_str(), FILE_READAHEAD_WINDOW, &m_cancel);
+    if(!src)
+        src = SDL_RWFromFile(path.c_str(), "rb");
+
+    if(!src)
+    {
+        SDL_LogWarn(SDL_LOG_CATEGORY_ERROR, "Failed to open file %s: %s", path.c_str(), SDL_GetError());
+        close();
+        return false;
+    }
+
+    if(!loadVideo(src, true, path))
+    {
+        SDL_RWclose(src);
+        return false;
+    }
+
+    return true;
+}
+
+bool DerVideoPlayer::loadVideoMemory(const void *data, size_t size)
+{
+    close();
+
+    if(!data || size == 0)
+        return false;
+
+    m_memData = (const Uint8 *)data;
+    m_memSize = size;
+    m_memPos = 0;
+
+    return openInput((int64_t)size);
+}
+
+void DerVideoPlayer::registerMemoryAsset(const std::string &name, const void *data, size_t size)
+{
+    MemoryAsset a;
+    a.data = data;
+    a.size = size;
+    memory_assets()[name] = a;
+}
+
+bool DerVideoPlayer::hasMemoryAsset(const std::string &name)
+{
+    return memory_assets().find(name) != memory_assets().end();
+}
+
+bool DerVideoPlayer::loadVideoAsset(const std::string &name)
+{
+    auto it = memory_assets().find(name);
+
+    if(it == memory_assets().end())
+    {
+        SDL_LogWarn(SDL_LOG_CATEGORY_ERROR, "No memory asset named %s", name.c_str());
+        close();
+        return false;
+    }
+
+    close();
+
+    if(loadCachedClip(name))
+        return true;
+
+    if(!loadVideoMemory(it->second.data, it->second.size))
+        return false;
+
+    clipRecordStart(name);
+
+    return true;
+}
+
+bool DerVideoPlayer::openInput(int64_t size)
+{
+    AVDictionary *options = nullptr;
+    int ret;
+    char proto[] = "file:///sdl_rwops";
+
+    m_ioStats = IOStats();
+    m_ioStats.streaming = m_streaming;
+    in_buffer_size = ioBufferSizeFor(size);
+    in_buffer = (uint8_t *)av_malloc(in_buffer_size);
+    m_ioStats.bufferSize = in_buffer_size;
+    if(!in_buffer)
+    {
+        SDL_LogWarn(SDL_LOG_CATEGORY_ERROR, "FFMPEG: Out of memory");
+        close();
+        return false;
+    }
+
+    avio_in = avio_alloc_context(in_buffer,
+                                 in_buffer_size,
+                                 0,
+                                 this,
+                                 m_memData ? _mem_read_buffer : _rw_read_buffer,
+                                 nullptr,
+                                 m_streaming ? nullptr : (m_memData ? _mem_seek : _rw_seek));
+    if(!avio_in)
+    {
+        av_freep(&in_buffer);
+        close();
+        SDL_LogWarn(SDL_LOG_CATEGORY_ERROR, "FFMPEG: Unhandled file format");
+        return false;
+    }
+
+    // Let large reads (packets) to be copied straight from the memory, bypassing the AVIO buffer
+    if(m_memData)
+        avio_in->direct = 1;
+
+    m_inputCtx = avformat_alloc_context();
+    m_inputCtx->pb = avio_in;
+    m_inputCtx->url = proto;
+    m_inputCtx->interrupt_callback.callback = &DerVideoPlayer::interrupt_cb;
+    m_inputCtx->interrupt_callback.opaque = this;
+
+    if(m_streaming)
+    {
+        avio_in->seekable = 0;
+        m_inputCtx->format_probesize = STREAM_PROBE_SIZE;
+        m_inputCtx->probesize = STREAM_PROBE_SIZE;
+        m_inputCtx->max_analyze_duration = STREAM_ANALYZE_DURATION;
+    }
+
+    /* open the input file */
+    ret = avformat_open_input(&m_inputCtx, nullptr, nullptr, &options);
+    av_dict_free(&options);
+
+    if(ret != 0)
+    {
+        SDL_LogWarn(SDL_LOG_CATEGORY_ERROR, "Cannot open input file");
+        close();
+        return false;
+    }
+
+    if(!m_probeCache || m_probePath.empty() || !m_probeCache->restore(m_probePath, m_inputCtx))
+    {
+        Uint64 probeStart = SDL_GetPerformanceCounter();
+
+        if(avformat_find_stream_info(m_inputCtx, NULL) < 0)
+        {
+            SDL_LogWarn(SDL_LOG_CATEGORY_ERROR, "Cannot find input stream information");
+            close();
+            return false;
+        }
+
+        if(m_probeCache && !m_probePath.empty())
+        {
+            double probeMs = (double)(SDL_GetPerformanceCounter() - probeStart) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+            m_probeCache->store(m_probePath, m_inputCtx, probeMs);
+        }
+    }
+
+    // The live context can't be resized, so, just tell how large the buffer should be for this bit rate
+    if(m_inputCtx->bit_rate > 0)
+        m_ioStats.recommendedBufferSize = ioBufferSizeClamp((size_t)(m_inputCtx->bit_rate / 8 / 4));
+
+    ret = av_find_best_stream(m_inputCtx, AVMEDIA_TYPE_VIDEO, -1, -1, &m_decoderVideo, 0);
+    if(ret < 0)
+    {
+        SDL_LogWarn(SDL_LOG_CATEGORY_ERROR, "No suitable video stream in the input file");
+        close();
+        return false;
+    }
+
+    m_streamVideo = ret;
+    m_video = m_inputCtx->streams[ret];
+
+    ret = av_find_best_stream(m_inputCtx, AVMEDIA_TYPE_AUDIO, -1, -1, &m_decoderAudio, 0);
+    if(ret >= 0)
+    {
+        m_streamAudio = ret;
+        m_audio = m_inputCtx->streams[ret];
+
+        // Don't demux audio tracks which aren't playing
+        for(unsigned i = 0; i < m_inputCtx->nb_streams; ++i)
+        {
+            AVStream *st = m_inputCtx->streams[i];
+            if(st != m_audio && st->codecpar && st->codecpar->codec_type == AVMEDIA_TYPE_AUDIO)
+                st->discard = AVDISCARD_ALL;
+        }
+    }
+
+    if(!(m_decoderVideoCtx = avcodec_alloc_context3(m_decoderVideo)))
+    {
+        SDL_LogWarn(SDL_LOG_CATEGORY_ERROR, "No enough memory to initialise the video decoder!");
+        close();
+        return false;
+    }
+
+    if(!m_video->codecpar)
+    {
+        SDL_LogWarn(SDL_LOG_CATEGORY_ERROR, "FFMPEG: codec parameters aren't recognised");
+        close();
+        return false;
+    }
+
+    if(m_audio && !(m_decoderAudioCtx = avcodec_alloc_context3(m_decoderAudio)))
+    {
+        SDL_LogWarn(SDL_LOG_CATEGORY_ERROR, "No enough memory to initialise the audio decoder!");
+        close();
+        return false;
+    }
+
+    if(m_audio && !m_audio->codecpar)
+    {
+        SDL_LogWarn(SDL_LOG_CATEGORY_ERROR, "FFMPEG: codec parameters aren't recognised    m_texture_colour = AV_PIX_FMT_RGB24;");
+        close();
+        return false;
+    }
+
+    if(avcodec_parameters_to_context(m_decoderVideoCtx, m_video->codecpar) < 0)
+    {
+        SDL_LogWarn(SDL_LOG_CATEGORY_ERROR, "Error of avcodec_parameters_to_context (video)");
+        close();
+        return false;
+    }
+
+    if(m_audio && avcodec_parameters_to_context(m_decoderAudioCtx, m_audio->codecpar) < 0)
+    {
+        SDL_LogWarn(SDL_LOG_CATEGORY_ERROR, "Error of avcodec_parameters_to_context (audio)");
+        close();
+        return false;
+    }
+
+    m_decoderVideoCtx->sw_pix_fmt = AV_PIX_FMT_RGB24;
+    m_decoderVideoCtx->opaque = this;
+
+    if(m_decoderAudioCtx)
+        m_decoderAudioCtx->opaque = this;
+
+    ret = avcodec_open2(m_decoderVideoCtx, m_decoderVideo, nullptr);
+    if(ret < 0)
+    {
+        SDL_LogWarn(SDL_LOG_CATEGORY_ERROR, "Failed avcodec_open2 (video)");
+        close();
+        return false;
+    }
+
+    if(m_audio)
+    {
+        ret = avcodec_open2(m_decoderAudioCtx, m_decoderAudio, nullptr);
+        if(ret < 0)
+        {
+            SDL_LogWarn(SDL_LOG_CATEGORY_ERROR, "Failed avcodec_open2 (audio)");
+            close();
+            return false;
+        }
+    }
+
+    if(!(in_frame = av_frame_alloc()) || !(sw_frame = av_frame_alloc()))
+    {
+        SDL_LogWarn(SDL_LOG_CATEGORY_ERROR, "Can not alloc frame");
+        close();
+        return false;
+    }
+
+    if(m_audio && (!(m_audio_frame = av_frame_alloc()) || !(m_atempo_frame = av_frame_alloc())))
+    {
+        SDL_LogWarn(SDL_LOG_CATEGORY_ERROR, "Can not alloc audio frame");
+        close();
+        return false;
+    }
+
+    m_texture_colour = AV_PIX_FMT_RGB24;
+    m_texture_w = 0;
+    m_texture_h = 0;
+
+    m_dst_colour = AV_PIX_FMT_RGB24;
+    m_dst_w = m_video->codecpar->width;
+    m_dst_h = m_video->codecpar->height;
+
+    m_texturePixelData.resize(m_dst_h * m_texture_pitch);
+    SDL_memset(m_texturePixelData.data(), 0, m_texturePixelData.size());
+
+    updateVideoStream();
+    updateAudioDevice();
+    updateAudioStream();
+
+    // av_dump_format(m_inputCtx, m_streamVideo, video_path.c_str(), 0);
+
+    // if(m_streamAudio >= 0)
+    //     av_dump_format(m_inputCtx, m_streamAudio, video_path.c_str(), 0);
+
+    m_time = 0.0;
+    m_audioPtsEnd = AV_NOPTS_VALUE;
+    m_audioClock = 0;
+    m_audioResumePts = AV_NOPTS_VALUE;
+    m_silentSamples = 0;
+    m_atEnd = false;
+
+    m_atempoDirty = true;
+    m_videoWaitKey = false;
+    applySpeed();
+
+    m_textureMutex = SDL_CreateMutex();
+
+    return true;
+}
+
+bool DerVideoPlayer::openAudioDecoder(int stream)
+{
+    AVStream *st;
+    AVCodecContext *ctx;
+    int ret;
+#if LIBAVCODEC_VERSION_MAJOR >= 60
+    const AVCodec *codec;
+#else
+    AVCodec *codec;
+#endif
+
+    if(!m_inputCtx || stream < 0 || stream >= (int)m_inputCtx->nb_streams)
+        return false;
+
+    st = m_inputCtx->streams[stream];
+    if(!st->codecpar || st->codecpar->codec_type != AVMEDIA_TYPE_AUDIO)
+        return false;
+
+    codec = avcodec_find_decoder(st->codecpar->codec_id);
+    if(!codec)
+    {
+        SDL_LogWarn(SDL_LOG_CATEGORY_ERROR, "No decoder for the audio stream %d", stream);
+        return false;
+    }
+
+    if(!(ctx = avcodec_alloc_context3(codec)))
+    {
+        SDL_LogWarn(SDL_LOG_CATEGORY_ERROR, "No enough memory to initialise the audio decoder!");
+        return false;
+    }
+
+    if(avcodec_parameters_to_context(ctx, st->codecpar) < 0)
+    {
+        SDL_LogWarn(SDL_LOG_CATEGORY_ERROR, "Error of avcodec_parameters_to_context (audio)");
+        avcodec_free_context(&ctx);
+        return false;
+    }
+
+    ctx->opaque = this;
+
+    ret = avcodec_open2(ctx, codec, nullptr);
+    if(ret < 0)
+    {
+        SDL_LogWarn(SDL_LOG_CATEGORY_ERROR, "Failed avcodec_open2 (audio)");
+        avcodec_free_context(&ctx);
+        return false;
+    }
+
+    if(m_decoderAudioCtx)
+        avcodec_free_context(&m_decoderAudioCtx);
+
+    if(m_audio)
+        m_audio->discard = AVDISCARD_ALL;
+
+    st->discard = AVDISCARD_DEFAULT;
+
+    m_decoderAudioCtx = ctx;
+    m_decoderAudio = codec;
+    m_streamAudio = stream;
+    m_audio = st;
+
+    return true;
+}
+
+std::vector<DerVideoPlayer::AudioTrack> DerVideoPlayer::audioTracks() const
+{
+    std::vector<AudioTrack> ret;
+
+    if(!m_inputCtx)
+        return ret;
+
+    for(unsigned i = 0; i < m_inputCtx->nb_streams; ++i)
+    {
+        const AVStream *st = m_inputCtx->streams[i];
+        AVDictionaryEntry *e;
+        AudioTrack t;
+
+        if(!st->codecpar || st->codecpar->codec_type != AVMEDIA_TYPE_AUDIO)
+            continue;
+
+        t.stream = (int)i;
+        t.codec = avcodec_get_name(st->codecpar->codec_id);
+        t.sample_rate = st->codecpar->sample_rate;
+#if defined(AVCODEC_NEW_CHANNEL_LAYOUT)
+        t.channels = st->codecpar->ch_layout.nb_channels;
+#else
+        t.channels = st->codecpar->channels;
+#endif
+
+        if((e = av_dict_get(st->metadata, "language", nullptr, 0)) != nullptr)
+            t.language = e->value;
+
+        if((e = av_dict_get(st->metadata, "title", nullptr, 0)) != nullptr)
+            t.title = e->value;
+
+        ret.push_back(t);
+    }
+
+    return ret;
+}
+
+int DerVideoPlayer::audioTrack() const
+{
+    return m_audio ? m_streamAudio : -1;
+}
+
+bool DerVideoPlayer::setAudioTrack(int stream)
+{
+    AVRational oldTimeBase;
+    bool ret;
+
+    if(!m_inputCtx || !m_audio)
+        return false; // Nothing to switch
+
+    if(stream == m_streamAudio)
+        return true;
+
+    lockAudio();
+
+    // Recording must represent the whole clip with a single track
+    clipRecordAbort();
+
+    oldTimeBase = m_audio->time_base;
+
+    ret = openAudioDecoder(stream);
+    if(ret)
+    {
+        // Reset converters only, the demuxer and the video are kept as is
+        audioStreamClear();
+
+        if(m_audio_cvt)
+        {
+            SDL_FreeAudioStream(m_audio_cvt);
+            m_audio_cvt = nullptr;
+        }
+
+        if(m_swr_ctx)
+        {
+            swr_free(&m_swr_ctx);
+            m_swr_ctx = nullptr;
+        }
+
+        closeAudioTempo();
+        m_atempoDirty = true;
+
+        m_sfmt = AV_SAMPLE_FMT_NONE;
+        m_srate = 0;
+        m_schannels = 0;
+        m_planar = false;
+        m_merge_buffer.clear();
+
+        m_audioClock = av_rescale_q(m_audioClock, oldTimeBase, m_audio->time_base);
+        m_audioResumePts = m_audioClock;
+        m_audioPtsEnd = AV_NOPTS_VALUE;
+
+        ret = updateAudioStream();
+    }
+
+    unlockAudio();
+
+    return ret;
+}
+
+bool DerVideoPlayer::seekClip(double time)
+{
+    const CachedClip &clip = *m_clipPlay;
+    size_t frameSize = (size_t)((SDL_AUDIO_BITSIZE(clip.format) / 8) * clip.channels);
+    size_t pos = (size_t)(time * clip.freq) * frameSize;
+
+    lockAudio();
+
+    m_clipPcmPos = pos < clip.pcm.size() ? pos : clip.pcm.size();
+    if(m_audio_cvt)
+        SDL_AudioStreamClear(m_audio_cvt);
+
+    m_clipSamples = (int64_t)(time * m_dstSpec.freq);
+    m_time = time;
+    m_atEnd = false;
+
+    SDL_LockMutex(m_textureMutex);
 
-    if(m_textureMutex)
-    {
-        SDL_DestroyMutex(m_textureMutex);
-        m_textureMutex = nullptr;
-    }
+    // Packed frames can only be restored in order: go backward through the first frame
+    if(m_clipFrame > 0 && clip.frames[m_clipFrame - 1].time > time)
+        m_clipFrame = 0;
 
-    in_buffer = NULL; /* This buffer is already freed by FFMPEG side*/
-    in_buffer_size = 0;
+    while(m_clipFrame < clip.frames.size() && (m_clipFrame == 0 || clip.frames[m_clipFrame].time <= time))
+        clip.unpackFrame(m_clipFrame++, m_texturePixelData.data());
 
-    if(m_src && m_freesrc)
-        SDL_RWclose(m_src);
+    m_hasVideoFrame = true;
 
-    m_src = nullptr;
-    m_freesrc = false;
+    SDL_UnlockMutex(m_textureMutex);
 
-    m_video = nullptr;
-    m_audio = nullptr;
-    m_decoderVideo = nullptr;
-    m_decoderAudio = nullptr;
-    m_sfmt = AV_SAMPLE_FMT_NONE;
-    m_srate = 0;
-    m_schannels = 0;
-    m_planar = false;
+    unlockAudio();
+
+    return true;
 }
 
-bool DerVideoPlayer::loadVideo(SDL_RWops *src, bool freesrc)
+bool DerVideoPlayer::seek(double time, SeekMode mode)
 {
-    AVDictionary *options = nullptr;
+    Uint64 start = SDL_GetPerformanceCounter();
+    double target;
+    int64_t ts;
     int ret;
-    char proto[] = "file:///sdl_rwops";
-    close();
+    bool got, gotVideo = false;
 
-    in_buffer = (uint8_t *)av_malloc(AUDIO_INBUF_SIZE);
-    in_buffer_size = AUDIO_INBUF_SIZE;
-    if(!in_buffer)
+    if(time < 0.0)
+        time = 0.0;
+
+    if(m_clipPlay)
     {
-        SDL_LogWarn(SDL_LOG_CATEGORY_ERROR, "FFMPEG: Out of memory");
-        close();
-        return false;
+        seekClip(time);
+        m_seekDuration = (double)(SDL_GetPerformanceCounter() - start) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+        return true;
     }
 
-    m_src = src;
+    if(!m_inputCtx || !m_video)
+        return false;
 
-    avio_in = avio_alloc_context(in_buffer,
-                                 in_buffer_size,
-                                 0,
-                                 this,
-                                 _rw_read_buffer,
-                                 nullptr,
-                                 _rw_seek);
-    if(!avio_in)
+    if(m_streaming)
     {
-        close();
-        SDL_LogWarn(SDL_LOG_CATEGORY_ERROR, "FFMPEG: Unhandled file format");
+        SDL_LogWarn(SDL_LOG_CATEGORY_ERROR, "Can't seek the non-seekable input");
         return false;
     }
 
-    m_inputCtx = avformat_alloc_context();
-    m_inputCtx->pb = avio_in;
-    m_inputCtx->url = proto;
+    lockAudio();
+    m_seeking = true;
 
-    /* open the input file */
-    ret = avformat_open_input(&m_inputCtx, nullptr, nullptr, &options);
-    av_dict_free(&options);
+    // The clip is no longer played from the beginning to the end
+    clipRecordAbort();
 
-    if(ret != 0)
-    {
-        SDL_LogWarn(SDL_LOG_CATEGORY_ERROR, "Cannot open input file");
-        close();
-        return false;
-    }
+    keyIndexApply();
+
+    ts = (int64_t)(time / av_q2d(m_video->time_base));
 
-    if(avformat_find_stream_info(m_inputCtx, NULL) < 0)
+    if(m_keyIndexApplied)
     {
-        SDL_LogWarn(SDL_LOG_CATEGORY_ERROR, "Cannot find input stream information");
-        close();
-        return false;
+        // Target the indexed key frame exactly, so the demuxer doesn't need to scan around
+        const KeyframeIndex::Entry *e = m_keyIndex.find(ts);
+        if(e)
+            ts = e->pts;
     }
 
-    ret = av_find_best_stream(m_inputCtx, AVMEDIA_TYPE_VIDEO, -1, -1, &m_decoderVideo, 0);
+    // Closest key frame at or before the target
+    ret = avformat_seek_file(m_inputCtx, m_streamVideo, INT64_MIN, ts, ts, 0);
+    if(ret < 0)
+        ret = av_seek_frame(m_inputCtx, m_streamVideo, ts, AVSEEK_FLAG_BACKWARD);
+
     if(ret < 0)
     {
-        SDL_LogWarn(SDL_LOG_CATEGORY_ERROR, "No suitable video stream in the input file");
-        close();
+        SDL_LogWarn(SDL_LOG_CATEGORY_ERROR, "FFMPEG: Failed to seek to %g (%s)", time, av_error_to_str(ret).c_str());
+        m_seeking = false;
+        unlockAudio();
         return false;
     }
 
-    m_streamVideo = ret;
-    m_video = m_inputCtx->streams[ret];
+    // Nothing decoded before the seek is valid anymore
+    if(m_paquet.buf)
+        av_packet_unref(&m_paquet);
+    videoPaquetsClean();
 
-    ret = av_find_best_stream(m_inputCtx, AVMEDIA_TYPE_AUDIO, -1, -1, &m_decoderAudio, 0);
-    if(ret >= 0)
-    {
-        m_streamAudio = ret;
-        m_audio = m_inputCtx->streams[ret];
-    }
+    avcodec_flush_buffers(m_decoderVideoCtx);
+    if(m_decoderAudioCtx)
+        avcodec_flush_buffers(m_decoderAudioCtx);
 
-    if(!(m_decoderVideoCtx = avcodec_alloc_context3(m_decoderVideo)))
-    {
-        SDL_LogWarn(SDL_LOG_CATEGORY_ERROR, "No enough memory to initialise the video decoder!");
-        close();
-        return false;
-    }
+    audioStreamClear();
+    closeAudioTempo();
+    m_atempoDirty = true;
 
-    if(!m_video->codecpar)
-    {
-        SDL_LogWarn(SDL_LOG_CATEGORY_ERROR, "FFMPEG: codec parameters aren't recognised");
-        close();
-        return false;
-    }
+    m_audioPtsEnd = AV_NOPTS_VALUE;
+    m_audioResumePts = AV_NOPTS_VALUE;
+    m_atEnd = false;
+    m_hasVideoFrame = false;
+    m_videoWaitKey = true;
 
-    if(m_audio && !(m_decoderAudioCtx = avcodec_alloc_context3(m_decoderAudio)))
+    if(mode == SEEK_ACCURATE)
     {
-        SDL_LogWarn(SDL_LOG_CATEGORY_ERROR, "No enough memory to initialise the audio decoder!");
-        close();
-        return false;
+        m_videoSkipUntil = time;
+        if(m_audio)
+            m_audioResumePts = (int64_t)(time / av_q2d(m_audio->time_base));
     }
 
-    if(m_audio && !m_audio->codecpar)
+    // Decode up to the first shown frame
+    while(!gotVideo)
     {
-        SDL_LogWarn(SDL_LOG_CATEGORY_ERROR, "FFMPEG: codec parameters aren't recognised    m_texture_colour = AV_PIX_FMT_RGB24;");
-        close();
-        return false;
+        ret = av_read_frame(m_inputCtx, &m_paquet);
+        if(ret < 0)
+            break; // Let the playback to handle the end of file
+
+        if(m_paquet.stream_index == m_streamVideo)
+        {
+            if(!m_videoWaitKey || (m_paquet.flags & AV_PKT_FLAG_KEY))
+            {
+                m_videoWaitKey = false;
+                decode_video_packet(m_paquet, got);
+                gotVideo = m_hasVideoFrame;
+            }
+        }
+        else if(m_paquet.stream_index == m_streamAudio && m_audio && !m_audioMuted &&
+                m_audioResumePts != AV_NOPTS_VALUE)
+            decode_audio_packet(got); // Frames before the target get dropped by the decoder
+
+        av_packet_unref(&m_paquet);
     }
 
-    if(avcodec_parameters_to_context(m_decoderVideoCtx, m_video->codecpar) < 0)
+    m_videoSkipUntil = -1.0;
+    m_videoWaitKey = false;
+
+    target = (mode == SEEK_FAST && gotVideo) ? m_videoFrameTime : time;
+
+    m_time = target;
+    m_timeNextFrame = target;
+    m_silentSamples = (int64_t)(target * m_dstSpec.freq);
+
+    if(m_audio)
     {
-        SDL_LogWarn(SDL_LOG_CATEGORY_ERROR, "Error of avcodec_parameters_to_context (video)");
-        close();
-        return false;
+        m_audioClock = (int64_t)(target / av_q2d(m_audio->time_base));
+        if(m_audioResumePts == AV_NOPTS_VALUE && m_audioPtsEnd == AV_NOPTS_VALUE)
+            m_audioResumePts = m_audioClock;
     }
 
-    if(m_audio && avcodec_parameters_to_context(m_decoderAudioCtx, m_audio->codecpar) < 0)
+    // Detection starts over from the new position
+    m_seeking = false;
+    m_farSeeks = 0;
+
+    unlockAudio();
+
+    m_seekDuration = (double)(SDL_GetPerformanceCounter() - start) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+
+    return gotVideo || ret == AVERROR_EOF;
+}
+
+double DerVideoPlayer::seekDuration() const
+{
+    return m_seekDuration;
+}
+
+void DerVideoPlayer::setKeyframeIndexDir(const std::string &dir)
+{
+    m_keyIndexDir = dir;
+}
+
+size_t DerVideoPlayer::keyframeIndexSize() const
+{
+    return m_keyIndexApplied ? m_keyIndex.size() : 0;
+}
+
+KeyframeIndex::BuildStats DerVideoPlayer::keyframeIndexStats() const
+{
+    if(m_keyIndexThread && !SDL_AtomicGet(const_cast<SDL_atomic_t *>(&m_keyIndexReady)))
+        return KeyframeIndex::BuildStats(); // Still in progress
+
+    return m_keyIndexStats;
+}
+
+void DerVideoPlayer::keyIndexStart()
+{
+    if(m_keyIndexDir.empty() || m_probePath.empty() || !m_video)
+        return;
+
+    // Containers with the proper index (MP4, AVI with idx1, etc.) are seeked well by the demuxer
+    if(avformat_index_get_entries_count(m_video) > 1)
+        return;
+
+    if(m_keyIndex.load(m_keyIndexDir, m_probePath) && m_keyIndex.stream() == m_streamVideo)
     {
-        SDL_LogWarn(SDL_LOG_CATEGORY_ERROR, "Error of avcodec_parameters_to_context (audio)");
-        close();
-        return false;
+        m_keyIndex.apply(m_video);
+        m_keyIndexApplied = true;
+        return;
     }
 
-    m_decoderVideoCtx->sw_pix_fmt = AV_PIX_FMT_RGB24;
-    m_decoderVideoCtx->opaque = this;
+    m_keyIndex.clear();
+    SDL_AtomicSet(&m_keyIndexAbort, 0);
+    SDL_AtomicSet(&m_keyIndexReady, 0);
 
-    if(m_decoderAudioCtx)
-        m_decoderAudioCtx->opaque = this;
+    m_keyIndexThread = SDL_CreateThread(&DerVideoPlayer::keyindex_thread, "KeyframeIndex", this);
+    if(!m_keyIndexThread)
+        SDL_LogWarn(SDL_LOG_CATEGORY_ERROR, "Failed to start the indexing of %s: %s", m_probePath.c_str(), SDL_GetError());
+}
 
-    ret = avcodec_open2(m_decoderVideoCtx, m_decoderVideo, nullptr);
-    if(ret < 0)
+int SDLCALL DerVideoPlayer::keyindex_thread(void *self)
+{
+    DerVideoPlayer *p = (DerVideoPlayer *)self;
+    KeyframeIndex::BuildStats stats;
+
+    // Must not take the disk and CPU time from the playback
+    SDL_SetThreadPriority(SDL_THREAD_PRIORITY_LOW);
+
+    if(p->m_keyIndex.build(p->m_probePath, &p->m_keyIndexAbort, &stats))
     {
-        SDL_LogWarn(SDL_LOG_CATEGORY_ERROR, "Failed avcodec_open2 (video)");
-        close();
-        return false;
+        SDL_Log("Keyframe index: %u key frames of %s, %.2f MB in %.2f ms (%.2f MB/s)",
+                (unsigned)stats.keyframes, p->m_probePath.c_str(),
+                (double)stats.bytes / 1048576.0, stats.ms,
+                stats.ms > 0.0 ? (double)stats.bytes / 1048576.0 / (stats.ms / 1000.0) : 0.0);
+
+        if(!p->m_keyIndex.save(p->m_keyIndexDir, p->m_probePath))
+            SDL_LogWarn(SDL_LOG_CATEGORY_ERROR, "Failed to save the keyframe index of %s", p->m_probePath.c_str());
     }
 
-    if(m_audio)
+    p->m_keyIndexStats = stats;
+    SDL_AtomicSet(&p->m_keyIndexReady, 1);
+
+    return 0;
+}
+
+void DerVideoPlayer::keyIndexApply()
+{
+    if(!m_keyIndexThread || !SDL_AtomicGet(&m_keyIndexReady))
+        return;
+
+    SDL_WaitThread(m_keyIndexThread, nullptr);
+    m_keyIndexThread = nullptr;
+
+    if(m_keyIndex.size() > 0 && m_keyIndex.stream() == m_streamVideo)
     {
-        ret = avcodec_open2(m_decoderAudioCtx, m_decoderAudio, nullptr);
-        if(ret < 0)
-        {
-            SDL_LogWarn(SDL_LOG_CATEGORY_ERROR, "Failed avcodec_open2 (audio)");
-            close();
-            return false;
-        }
+        m_keyIndex.apply(m_video);
+        m_keyIndexApplied = true;
     }
+}
 
-    if(!(in_frame = av_frame_alloc()) || !(sw_frame = av_frame_alloc()))
+void DerVideoPlayer::keyIndexStop()
+{
+    if(m_keyIndexThread)
     {
-        SDL_LogWarn(SDL_LOG_CATEGORY_ERROR, "Can not alloc frame");
-        close();
-        return false;
+        SDL_AtomicSet(&m_keyIndexAbort, 1);
+        SDL_WaitThread(m_keyIndexThread, nullptr);
+        m_keyIndexThread = nullptr;
     }
 
-    if(m_audio && !(m_audio_frame = av_frame_alloc()))
+    m_keyIndex.clear();
+    m_keyIndexApplied = false;
+    m_keyIndexStats = KeyframeIndex::BuildStats();
+    SDL_AtomicSet(&m_keyIndexReady, 0);
+}
+
+double DerVideoPlayer::position() const
+{
+    return m_time;
+}
+
+void DerVideoPlayer::setPreRollTarget(int ms)
+{
+    m_preRollMs = ms > 0 ? ms : 0;
+}
+
+bool DerVideoPlayer::preRoll()
+{
+    Uint64 start = SDL_GetPerformanceCounter();
+    int target;
+    int ret = 0;
+    int videoTries = 0;
+    size_t videoQueued = 0;
+    bool videoAhead = false;
+    bool got;
+
+    if(m_clipPlay)
     {
-        SDL_LogWarn(SDL_LOG_CATEGORY_ERROR, "Can not alloc audio frame");
-        close();
-        return false;
+        m_preRollDuration = 0.0; // The first frame is already shown by the load
+        return true;
     }
 
-    m_freesrc = freesrc;
-
-    m_texture_colour = AV_PIX_FMT_RGB24;
-    m_texture_w = 0;
-    m_texture_h = 0;
+    if(!m_inputCtx)
+        return false;
 
-    m_dst_colour = AV_PIX_FMT_RGB24;
-    m_dst_w = m_video->codecpar->width;
-    m_dst_h = m_video->codecpar->height;
+    lockAudio();
 
-    m_texturePixelData.resize(m_dst_h * m_texture_pitch);
-    SDL_memset(m_texturePixelData.data(), 0, m_texturePixelData.size());
+    target = (int)(((int64_t)m_preRollMs * m_dstSpec.freq) / 1000) * audio_frame_size(m_dstSpec);
 
-    updateVideoStream();
-    updateAudioStream();
+    // Give up waiting for the first frame after a number of undecodable packets
+    while((!m_hasVideoFrame && videoTries < 32) ||
+          (m_audio && !m_audioMuted && !videoAhead && audioStreamAvailable() < target))
+    {
+        ret = av_read_frame(m_inputCtx, &m_paquet);
+        if(ret < 0)
+            break; // Let the playback to handle the end of file
 
-    // av_dump_format(m_inputCtx, m_streamVideo, video_path.c_str(), 0);
+        if(m_paquet.stream_index == m_streamAudio && m_audio && !m_audioMuted)
+        {
+            decode_audio_packet(got);
+            av_packet_unref(&m_paquet);
+        }
+        else if(m_paquet.stream_index == m_streamVideo)
+        {
+            if(!m_hasVideoFrame && m_videoPaquets.empty())
+            {
+                // Show the first frame as soon as possible
+                decode_video_packet(m_paquet, got);
+                ++videoTries;
+                av_packet_unref(&m_paquet);
+            }
+            else
+            {
+                videoQueued += (size_t)m_paquet.size;
+                videoPaquetToQueue();
+
+                if(!m_videoPaquets.empty())
+                {
+                    int64_t first = paquet_ts(m_videoPaquets.front());
+                    int64_t last = paquet_ts(m_videoPaquets.back());
+
+                    // Audio is far away or not decodable (badly interleaved file): start with what is there
+                    videoAhead = videoQueued > PREROLL_VIDEO_BYTES ||
+                                 (first != AV_NOPTS_VALUE && last != AV_NOPTS_VALUE &&
+                                  (double)(last - first) * av_q2d(m_video->time_base) * 1000.0 > m_preRollMs);
+                }
+            }
+        }
+        else
+            av_packet_unref(&m_paquet);
+    }
 
-    // if(m_streamAudio >= 0)
-    //     av_dump_format(m_inputCtx, m_streamAudio, video_path.c_str(), 0);
+    unlockAudio();
 
-    m_time = 0.0;
-    m_atEnd = false;
+    m_preRollDuration = (double)(SDL_GetPerformanceCounter() - start) * 1000.0 / (double)SDL_GetPerformanceFrequency();
 
-    m_textureMutex = SDL_CreateMutex();
+    return ret >= 0 || ret == AVERROR_EOF;
+}
 
-    return true;
+double DerVideoPlayer::preRollDuration() const
+{
+    return m_preRollDuration;
 }
 
 bool DerVideoPlayer::atEnd() const
@@ -787,29 +2688,43 @@ int DerVideoPlayer::runAV(Uint8 *stream, int len)
     int filled, ret = 0;
     bool got_some, got_video;
 
-    if(!m_audio) // When no audio, just process a time
-    {
-        SDL_memset(stream, 0, len);
-        m_time += (len / (double)((SDL_AUDIO_BITSIZE(m_dstSpec.format) / 8) * m_dstSpec.channels)) / m_dstSpec.freq;
+    if(m_clipPlay)
+        return runClip(stream, len);
 
-        double videoTime = 0.0;
+    if(!m_audio || m_audioMuted) // When no audio, just process a time
+    {
+        int64_t samples = (int64_t)SDL_floor((len / audio_frame_size(m_dstSpec)) * m_speed + 0.5);
         double timeBase = av_q2d(m_video->time_base);
 
-        while((ret = av_read_frame(m_inputCtx, &m_paquet)) >= 0)
-        {
-            if(m_paquet.stream_index == m_streamVideo)
-            {
-                videoTime = (double)m_paquet.pts * timeBase;
-                ret = decode_video_packet(m_paquet, got_some);
-            }
+        SDL_memset(stream, 0, len);
+        clipRecordPcm(stream, len);
 
-            av_packet_unref(&m_paquet);
+        if(m_audio)
+        {
+            m_audioClock += av_rescale_q(samples, AVRational{1, m_dstSpec.freq}, m_audio->time_base);
+            m_time = (double)m_audioClock * av_q2d(m_audio->time_base);
+        }
+        else
+        {
+            m_silentSamples += samples;
+            m_time = (double)m_silentSamples / m_dstSpec.freq;
+        }
 
-            if(ret < 0 || videoTime >= m_time)
+        while(m_videoPaquets.empty() || (double)paquet_ts(m_videoPaquets.back()) * timeBase < m_time)
+        {
+            ret = av_read_frame(m_inputCtx, &m_paquet);
+            if(ret < 0)
                 break;
+
+            if(m_paquet.stream_index == m_streamVideo)
+                videoPaquetToQueue();
+            else
+                av_packet_unref(&m_paquet);
         }
 
-        if(ret == AVERROR_EOF)
+        videoPaquetsProcess();
+
+        if((ret == AVERROR_EOF && m_videoPaquets.empty()) || ret == AVERROR_EXIT)
             m_atEnd = true;
 
         return len;
@@ -817,10 +2732,11 @@ int DerVideoPlayer::runAV(Uint8 *stream, int len)
 
     if(!m_videoPaquets.empty() || (m_time < m_timeNextFrame))
     {
-        filled = SDL_AudioStreamGet(m_audio_cvt, stream, len);
+        filled = audioStreamGet(stream, len);
         if(filled != 0)
         {
-            m_time += (filled / (double)((SDL_AUDIO_BITSIZE(m_dstSpec.format) / 8) * m_dstSpec.channels)) / m_dstSpec.freq;
+            clipRecordPcm(stream, filled);
+            updateAudioClock();
             videoPaquetsProcess();
             return filled;
         }
@@ -850,35 +2766,45 @@ int DerVideoPlayer::runAV(Uint8 *stream, int len)
 
     if(!got_some || ret == AVERROR_EOF)
     {
-        SDL_AudioStreamFlush(m_audio_cvt);
+        if(m_audio_cvt)
+            SDL_AudioStreamFlush(m_audio_cvt);
         m_atEnd = true;
     }
 
     return 0;
 }
 
-void DerVideoPlayer::audio_out_stream(void *self, Uint8 *stream, int bytes)
+int DerVideoPlayer::fillAudio(Uint8 *stream, int len)
 {
-    DerVideoPlayer *p = (DerVideoPlayer*)self;
     int got;
-    Uint8 *snd = (Uint8 *)stream;
-    Uint8 *dst = snd;
-    int len = bytes;
+    Uint8 *dst = stream;
     int zero_cycles = 0;
 
-    while(len > 0 && !p->m_atEnd)
+    // Cancelled: don't touch the input anymore, the rest is silence
+    if(SDL_AtomicGet(&m_cancel))
+        m_atEnd = true;
+
+    while(len > 0 && !m_atEnd)
     {
-        got = p->runAV(dst, len);
+        got = runAV(dst, len);
 
         if(got <= 0)
         {
             ++zero_cycles;
             if(zero_cycles >= 10)
-                p->m_atEnd = true;
+                m_atEnd = true;
             continue;
         }
 
         dst += got;
         len -= got;
     }
+
+    return (int)(dst - stream);
+}
+
+void DerVideoPlayer::audio_out_stream(void *self, Uint8 *stream, int bytes)
+{
+    DerVideoPlayer *p = (DerVideoPlayer*)self;
+    p->fillAudio(stream, bytes);
 }
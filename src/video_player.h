@@ -3,6 +3,8 @@
 
 #include <SDL2/SDL_audio.h>
 #include <SDL2/SDL_mutex.h>
+#include <SDL2/SDL_thread.h>
+#include <SDL2/SDL_atomic.h>
 
 extern "C"
 {
@@ -14,7 +16,10 @@ extern "C"
 
 #include <vector>
 #include <deque>
+#include <string>
+#include <memory>
 
+#include "keyframe_index.h"
 
 struct SDL_Renderer;
 typedef struct SDL_Renderer SDL_Renderer;
@@ -37,15 +42,55 @@ typedef struct AVFrame AVFrame;
 struct SwrContext;
 typedef struct SwrContext SwrContext;
 struct SwsContext;
+struct AVFilterGraph;
+typedef struct AVFilterGraph AVFilterGraph;
+struct AVFilterContext;
+typedef struct AVFilterContext AVFilterContext;
 typedef struct AVIOContext AVIOContext;
 struct AVIOContext;
 
+class ProbeCache;
+class ClipCache;
+struct CachedClip;
+class DerVideoPlaylist;
+
 class DerVideoPlayer
 {
+public:
+    struct IOStats
+    {
+        //! Number of read calls
+        uint64_t    reads = 0;
+        //! Total bytes read
+        uint64_t    bytes = 0;
+        //! Number of seek calls
+        uint64_t    seeks = 0;
+        //! Size of the input buffer in use
+        size_t      bufferSize = 0;
+        //! Size suggested by the bit rate of the stream (0 if unknown)
+        size_t      recommendedBufferSize = 0;
+        //! Input is read forward only (pipe, FIFO, standard input)
+        bool        streaming = false;
+        //! Audio and video are read by separate cursors (badly interleaved file)
+        bool        dualCursor = false;
+        //! Seeks of the demuxer served by cursors without seeking the source
+        uint64_t    seeksAvoided = 0;
+    };
+
+private:
     friend int64_t _rw_seek(void *opaque, int64_t offset, int whence);
     friend int _rw_read_buffer(void *opaque, uint8_t *buf, int buf_size);
+    friend int64_t _mem_seek(void *opaque, int64_t offset, int whence);
+    friend int _mem_read_buffer(void *opaque, uint8_t *buf, int buf_size);
+    friend class DerVideoPlaylist;
     Uint8 *in_buffer = nullptr;
     size_t in_buffer_size = 0;
+    //! Configured input buffer size (0 - choose automatically)
+    size_t m_ioBufferSize = 0;
+    IOStats m_ioStats;
+
+    static size_t ioBufferSizeClamp(size_t size);
+    size_t ioBufferSizeFor(int64_t fileSize) const;
 
     //! Where to draw
     SDL_Renderer   *m_render = nullptr;
@@ -55,6 +100,97 @@ class DerVideoPlayer
     AVIOContext     *avio_in = nullptr;
     SDL_RWops       *m_src = nullptr;
     bool            m_freesrc = false;
+    //! In-memory source (used instead of m_src when set)
+    const Uint8     *m_memData = nullptr;
+    size_t          m_memSize = 0;
+    size_t          m_memPos = 0;
+    //! Source can't be seeked, it's read forward with bounded probing
+    bool            m_streaming = false;
+
+    //! Cancellation token: set by cancel(), makes input calls give up, cleared by resetCancel()
+    SDL_atomic_t    m_cancel;
+    //! When cancel() has been called (0 once the stop time is measured)
+    Uint64          m_cancelStart = 0;
+    //! Time from cancel() to the end of close(), in milliseconds
+    double          m_stopDuration = 0.0;
+
+    //! AVIOInterruptCB of the demuxer
+    static int interrupt_cb(void *self);
+
+    //! Sequentially read area of the source
+    struct ReadCursor
+    {
+        std::vector<uint8_t> data;
+        int64_t     start = 0;
+        size_t      size = 0;
+        //! Tick of the last use
+        uint64_t    used = 0;
+    };
+
+    //! Position of the demuxer at the source
+    int64_t         m_srcPos = 0;
+    //! Actual position of the source (differs from m_srcPos with cursors)
+    int64_t         m_srcPhysPos = 0;
+    //! Reads get served by two cursors, so, streams stored far apart don't make the source seek on every packet
+    bool            m_dualCursor = false;
+    //! Far seeks of the playback within the detection window
+    int             m_farSeeks = 0;
+    //! Bytes read at the start of the detection window
+    uint64_t        m_farSeeksWindow = 0;
+    //! Jumps made by seek() are not the playback ones
+    bool            m_seeking = false;
+    ReadCursor      m_cursors[2];
+    uint64_t        m_cursorTick = 0;
+    uint64_t        m_cursorSeeks = 0;
+    uint64_t        m_cursorSourceSeeks = 0;
+
+    //! Switch to the dual cursor reading if the demuxer keeps jumping far
+    void cursorDetect(int64_t offset, int whence);
+    ReadCursor *cursorFind(int64_t pos);
+    int64_t cursorSeek(int64_t offset, int whence);
+    int  cursorRead(uint8_t *buf, int buf_size);
+
+    //! Cache of the stream information (not owned)
+    ProbeCache      *m_probeCache = nullptr;
+    //! Path of the loaded file, used as the probe cache key (empty if not a file)
+    std::string     m_probePath;
+
+    //! Cache of decoded short clips (not owned)
+    ClipCache       *m_clipCache = nullptr;
+    //! Name of the loaded clip at the clip cache
+    std::string     m_clipKey;
+    //! Clip being recorded while it gets decoded (nullptr if not recording)
+    std::shared_ptr<CachedClip> m_clipRecord;
+    //! Pixels of the last recorded frame
+    std::vector<uint8_t> m_clipRecordPrev;
+    //! Clip being played from the cache, no demuxing or decoding is done then
+    std::shared_ptr<const CachedClip> m_clipPlay;
+    size_t          m_clipPcmPos = 0;
+    size_t          m_clipFrame = 0;
+    //! Output samples played from the clip, the clock of the clip
+    int64_t         m_clipSamples = 0;
+
+    /**
+     * @brief Start playing the clip from the clip cache
+     * @param key Name of the clip
+     * @return true on cache hit
+     */
+    bool loadCachedClip(const std::string &key);
+    //! Start recording of the just opened clip if it's eligible for the cache
+    void clipRecordStart(const std::string &key);
+    void clipRecordFrame(double time);
+    void clipRecordPcm(const Uint8 *data, int len);
+    //! Drop the incomplete recording
+    void clipRecordAbort();
+    //! Feed the output from the cached clip
+    int  runClip(Uint8 *stream, int len);
+
+    /**
+     * @brief Open the input from the current source
+     * @param size Size of the source in bytes (or negative if unknown)
+     * @return true on success
+     */
+    bool openInput(int64_t size);
 
     SwsContext      *m_video_cvt = nullptr;
 
@@ -68,6 +204,12 @@ class DerVideoPlayer
     int             m_dst_h = 0;
 
     double          m_time = 0.0;
+    //! End timestamp of the last decoded audio frame (in the audio stream's time base)
+    int64_t         m_audioPtsEnd = 0;
+    //! Currently audible position of the audio stream (in the audio stream's time base)
+    int64_t         m_audioClock = 0;
+    //! Number of silence samples produced while there is no audio stream
+    int64_t         m_silentSamples = 0;
     double          m_timeNextFrame = 0.0;
     bool            m_atEnd = false;
     bool            m_hasVideoFrame = false;
@@ -120,35 +262,401 @@ class DerVideoPlayer
     int             m_srate = 0;
     int             m_schannels = 0;
     bool            m_planar = false;
+    //! Planar audio is interleaved by built-in kernels instead of swresample
+    bool            m_interleaveFast = false;
 
     enum AVSampleFormat m_dst_sample_fmt = AV_SAMPLE_FMT_NONE;
     std::vector<uint8_t> m_merge_buffer;
 
     SDL_AudioSpec   m_dstSpec;
+
+    //! Output device opened by the player itself (0 when the device is managed outside)
+    SDL_AudioDeviceID m_audioDev = 0;
+    //! Spec originally requested for the output device
+    SDL_AudioSpec   m_wantSpec;
+    //! Reopen the output device at the content's native rate when idle
+    bool            m_audioNativeRate = false;
+    //! Output device managed by the playlist, used for locking
+    SDL_AudioDeviceID m_sharedDev = 0;
+    //! Player is prepared at the background and isn't fed by the device yet, no locking needed
+    bool            m_offline = false;
     /* ------------------------------------------ */
 
+    /**
+     * @brief Reopen the audio device to match the loaded audio stream
+     * @return true if device matches the stream or resampling fallback is used
+     *
+     * Does nothing while the device is playing: reopening it in the middle of playback
+     * would cause a gap, so the SDL_AudioStream resampling will be used instead.
+     */
+    bool updateAudioDevice();
+
+    //! Converted audio left from the previous converter after the format change
+    std::vector<uint8_t> m_audioCarry;
+    size_t          m_audioCarryPos = 0;
+
     /**
      * @brief Synchronise audio converters with the stream
+     * @param frame Decoded frame to check, or nullptr to use stream's codec parameters
      * @return true if all okay, or false if error happen
      *
      * Synchronises all the audio converters if stream changes the content (this might happen if stream is a Frankenstein).
+     * Audio already converted by the previous converter is kept and will be played first.
      */
-    bool updateAudioStream();
+    bool updateAudioStream(const AVFrame *frame = nullptr);
+
+    //! Move converted audio from the converter into the carry-over buffer
+    void audioStreamCarryOver();
+    //! Drop all the converted audio
+    void audioStreamClear();
+    int  audioStreamGet(Uint8 *stream, int len);
+    int  audioStreamAvailable();
     bool updateVideoStream();
 
+    /**
+     * @brief Recalculate the audio clock
+     *
+     * The clock is the end timestamp of the last decoded frame minus everything that is
+     * still buffered: converted samples in the audio stream and the device's buffer.
+     */
+    void updateAudioClock();
+
+    //! Playback speed
+    double          m_speed = 1.0;
+    //! Decode key frames of the video only
+    bool            m_videoKeysOnly = false;
+    //! Skip video packets until the next key frame
+    bool            m_videoWaitKey = false;
+    //! Don't decode audio, just advance the clock
+    bool            m_audioMuted = false;
+
+    //! Audio time-stretching filter (used when speed isn't 1.0)
+    AVFilterGraph   *m_atempo_graph = nullptr;
+    AVFilterContext *m_atempo_src = nullptr;
+    AVFilterContext *m_atempo_sink = nullptr;
+    AVFrame         *m_atempo_frame = nullptr;
+    int             m_atempo_fmt = -1;
+    int             m_atempo_rate = 0;
+    bool            m_atempoDirty = false;
+
+    /**
+     * @brief Rebuild the tempo filter if speed or audio format has been changed
+     * @param frame Decoded audio frame
+     * @return true if filter is ready or not needed
+     */
+    bool updateAudioTempo(const AVFrame *frame);
+    void closeAudioTempo();
+
+    //! Apply the current speed to decoders
+    void applySpeed();
+
+    //! Amount of audio to buffer before the playback start, in milliseconds
+    int             m_preRollMs = 100;
+    //! Time spent for the last pre-roll, in milliseconds
+    double          m_preRollDuration = 0.0;
+
+    //! Audio clock position to continue from after the audio track switch or the seek (in the audio stream's time base)
+    int64_t         m_audioResumePts = 0;
+
+    //! Presentation time of the last decoded video frame, in seconds
+    double          m_videoFrameTime = 0.0;
+    //! Don't convert video frames earlier than this time (accurate seek), in seconds
+    double          m_videoSkipUntil = -1.0;
+    //! Time spent by the last seek, in milliseconds
+    double          m_seekDuration = 0.0;
+
+    //! Seek the clip played from the clip cache
+    bool seekClip(double time);
+
+    //! Directory of the key frame index sidecars (empty to disable)
+    std::string     m_keyIndexDir;
+    //! Key frame index of the loaded file, used by seeks once ready
+    KeyframeIndex   m_keyIndex;
+    //! Index is complete and has been put into the demuxer
+    bool            m_keyIndexApplied = false;
+    //! Background indexing pass
+    SDL_Thread      *m_keyIndexThread = nullptr;
+    //! Set by the thread when m_keyIndex is complete
+    SDL_atomic_t    m_keyIndexReady;
+    //! Makes the indexing pass give up
+    SDL_atomic_t    m_keyIndexAbort;
+    KeyframeIndex::BuildStats m_keyIndexStats;
+
+    //! Load the index sidecar, or start the indexing pass if the demuxer has no index
+    void keyIndexStart();
+    //! Put the index built at the background into the demuxer
+    void keyIndexApply();
+    void keyIndexStop();
+    static int SDLCALL keyindex_thread(void *self);
+
+    /**
+     * @brief Open decoder of the audio stream
+     * @param stream Index of the stream
+     * @return true on success
+     */
+    bool openAudioDecoder(int stream);
+    int audioSilenceToStream(int64_t samples);
+
+    void lockAudio();
+    void unlockAudio();
+
+    /**
+     * @brief Fill the output buffer until the end of the video
+     * @param stream Output buffer
+     * @param len Size of the buffer
+     * @return number of bytes filled, less than len at the end
+     */
+    int fillAudio(Uint8 *stream, int len);
+
+    int audioFrameToStream(AVFrame *frame);
     int decode_audio_packet(bool &got);
-    int decode_video_packet(AVPacket &paquet, bool &got);
+    int decode_video_packet(AVPacket &paquet, bool &got, bool convert = true);
 
 public:
+    struct AudioTrack
+    {
+        //! Index of the stream at the container
+        int         stream = -1;
+        std::string language;
+        std::string title;
+        std::string codec;
+        int         sample_rate = 0;
+        int         channels = 0;
+    };
+
+    enum SeekMode
+    {
+        //! Land on the closest key frame before the target
+        SEEK_FAST = 0,
+        //! Decode from the key frame up to the exact target
+        SEEK_ACCURATE
+    };
+
     explicit DerVideoPlayer(SDL_Renderer *dst = nullptr);
     ~DerVideoPlayer();
 
     void setAudioSpec(SDL_AudioSpec &spec);
+
+    /**
+     * @brief Open the audio output device which will be fed by this player
+     * @param want Desired output spec (callback and userdata will be set by the player)
+     * @return true if device has been opened
+     */
+    bool openAudioDevice(const SDL_AudioSpec &want);
+    void closeAudioDevice();
+    void setAudioPaused(bool paused);
+
+    /**
+     * @brief Open the output device at the native rate and channels count of every loaded file
+     * @param enable Enable the native rate mode
+     *
+     * Works only with the device opened by openAudioDevice() call. The device gets reopened
+     * only while it's paused, otherwise the audio gets resampled as usual. Players of
+     * DerVideoPlaylist share its device, which stays at the fixed rate, so the mode doesn't apply there.
+     */
+    void setNativeAudioRate(bool enable);
     void setRender(SDL_Renderer *dst);
 
     void close();
 
-    bool loadVideo(struct SDL_RWops *src, bool freesrc);
+    /**
+     * @brief Make the blocking input give up, can be called from any thread
+     *
+     * Reads of the demuxer, probing and the playback stop at the next check instead of
+     * waiting for slow storage, the player ends. The token stays set until resetCancel(),
+     * so a load running at the same time fails rather than starting over.
+     */
+    void cancel();
+
+    /**
+     * @brief Clear the cancellation token, so the player can load again
+     *
+     * Must not race with cancel(): the owner calls it when no other thread can cancel this load.
+     */
+    void resetCancel();
+
+    /**
+     * @brief Time from the cancel() call to the end of the first close() after it
+     * @return duration in milliseconds, or 0 if the last close() wasn't cancelled
+     */
+    double stopDuration() const;
+
+    /**
+     * @brief Load video from the RWops
+     * @param src Source of the file data
+     * @param freesrc Close the source at close()
+     * @param path Path of the file to look up at the probe cache (optional)
+     * @return true on success
+     */
+    bool loadVideo(struct SDL_RWops *src, bool freesrc, const std::string &path = std::string());
+
+    /**
+     * @brief Load video from the source which can only be read forward (pipe, FIFO, standard input)
+     * @param src Source of the file data
+     * @param freesrc Close the source at close()
+     * @return true on success
+     *
+     * Probing is limited to the small amount of data kept in memory, seeking is unavailable,
+     * and no caches are used. loadVideo() switches to this mode itself when the source can't be seeked.
+     */
+    bool loadVideoStream(struct SDL_RWops *src, bool freesrc);
+
+    /**
+     * @brief Use the cache of the stream information to open files faster
+     * @param cache Cache instance, must stay valid while in use, or nullptr to disable
+     */
+    void setProbeCache(ProbeCache *cache);
+
+    /**
+     * @brief Keep decoded frames and audio of short clips in memory to replay them without decoding
+     * @param cache Cache instance, must stay valid while in use, or nullptr to disable
+     *
+     * Clips loaded by the name (assets) or with a path get recorded when played at the normal speed
+     * from the beginning to the end. Cached clips always play at the normal speed. Clips of files
+     * are not replayed once the size or the modification time of the file changes.
+     */
+    void setClipCache(ClipCache *cache);
+
+    /**
+     * @brief Open the local file and load video from it
+     * @param path Path to the file
+     * @return true on success
+     *
+     * Files on the local storage are memory-mapped. Network and FUSE storage, or files which
+     * can't be mapped, are read with the background read-ahead. FIFOs and devices are opened
+     * once and read as the non-seekable stream, so does the "-" path (the standard input). Files inside of
+     * ZIP archives ("@pack.zip:/dir/file.avi") are played in place, see Archives.
+     */
+    bool loadVideoFile(const std::string &path);
+
+    /**
+     * @brief Load video from the memory without copying it
+     * @param data Pointer to the file data, must stay valid until close()
+     * @param size Size of the data
+     * @return true on success
+     */
+    bool loadVideoMemory(const void *data, size_t size);
+
+    /**
+     * @brief Register the named in-memory file (for example, embedded into executable)
+     * @param name Name of the asset
+     * @param data Pointer to the file data, must stay valid while registered
+     * @param size Size of the data
+     *
+     * Should be called at startup, before any player uses the assets.
+     */
+    static void registerMemoryAsset(const std::string &name, const void *data, size_t size);
+    static bool hasMemoryAsset(const std::string &name);
+
+    /**
+     * @brief Load the registered in-memory file
+     * @param name Name of the asset
+     * @return true on success
+     */
+    bool loadVideoAsset(const std::string &name);
+
+    /**
+     * @brief Set playback speed
+     * @param speed Speed factor from 0.5 to 16.0
+     *
+     * Audio gets time-stretched at moderate speeds. At higher speeds the audio gets muted
+     * and only key frames of the video get decoded. close() resets the speed to normal.
+     */
+    void setSpeed(double speed);
+    double speed() const;
+
+    /**
+     * @brief Set size of the input buffer
+     * @param bytes Size in bytes (from 32 KB to 4 MB), or 0 to choose by the size of the file
+     */
+    void setIOBufferSize(size_t bytes);
+
+    /**
+     * @brief Input statistics of the loaded file
+     */
+    IOStats ioStats() const;
+
+    /**
+     * @brief List of audio tracks of the loaded file
+     */
+    std::vector<AudioTrack> audioTracks() const;
+
+    /**
+     * @brief Index of the currently playing audio stream
+     * @return stream index or -1 if no audio
+     */
+    int audioTrack() const;
+
+    /**
+     * @brief Switch the audio track without reopening the file
+     * @param stream Index of the audio stream at the container
+     * @return true if track has been switched
+     *
+     * Only the audio decoder and audio buffers get reset, playback continues from the current clock position.
+     */
+    bool setAudioTrack(int stream);
+
+    /**
+     * @brief Seek to the time position
+     * @param time Position in seconds
+     * @param mode SEEK_FAST to jump to the key frame, SEEK_ACCURATE to land on the exact frame
+     * @return true on success
+     *
+     * Packet queues, decoders, buffered audio and the clock get reset, the frame at the new
+     * position gets decoded before return.
+     */
+    bool seek(double time, SeekMode mode = SEEK_FAST);
+
+    /**
+     * @brief Time spent by the last seek() call
+     * @return duration in milliseconds
+     */
+    double seekDuration() const;
+
+    //! Current playback position in seconds
+    double position() const;
+
+    /**
+     * @brief Keep key frame indices of files without the own index (AVI without idx1, MPEG-PS)
+     * @param dir Directory of index sidecars (must exist), or empty string to disable
+     *
+     * The index gets built by the background pass when the file is played the first time,
+     * and then gets loaded with the file, so seeks don't need to scan.
+     */
+    void setKeyframeIndexDir(const std::string &dir);
+
+    /**
+     * @brief Number of key frames of the index in use by seeks
+     * @return number of entries, or 0 if seeks use the demuxer's own means
+     */
+    size_t keyframeIndexSize() const;
+
+    /**
+     * @brief Statistics of the indexing pass of the loaded file
+     * @return statistics, empty if the index wasn't built for this file
+     */
+    KeyframeIndex::BuildStats keyframeIndexStats() const;
+
+    /**
+     * @brief Set the amount of audio to decode by the preRoll() call
+     * @param ms Duration in milliseconds
+     */
+    void setPreRollTarget(int ms);
+
+    /**
+     * @brief Decode the first video frame and buffer the audio before unpausing the device
+     * @return true on success
+     *
+     * Must be called after loadVideo() while the audio device is paused. Buffering of the audio
+     * stops early once the video queued meanwhile goes beyond the target or takes 8 MB.
+     */
+    bool preRoll();
+
+    /**
+     * @brief Time spent by the last preRoll() call
+     * @return duration in milliseconds
+     */
+    double preRollDuration() const;
 
     bool atEnd() const;
     bool hasVideoFrame() const;
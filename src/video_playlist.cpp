@@ -0,0 +1,462 @@
+#include <SDL2/SDL_log.h>
+#include <SDL2/SDL_timer.h>
+
+#include "video_playlist.h"
+
+DerVideoPlaylist::DerVideoPlaylist(SDL_Renderer *render)
+{
+    SDL_zero(m_spec);
+
+    m_players[0].setRender(render);
+    m_players[1].setRender(render);
+
+    m_mutex = SDL_CreateMutex();
+    m_cond = SDL_CreateCond();
+}
+
+DerVideoPlaylist::~DerVideoPlaylist()
+{
+    close();
+
+    if(m_cond)
+        SDL_DestroyCond(m_cond);
+    if(m_mutex)
+        SDL_DestroyMutex(m_mutex);
+}
+
+bool DerVideoPlaylist::openAudioDevice(const SDL_AudioSpec &want)
+{
+    SDL_AudioSpec wantSpec;
+
+    closeAudioDevice();
+
+    wantSpec = want;
+    wantSpec.callback = &DerVideoPlaylist::audio_out;
+    wantSpec.userdata = this;
+
+    m_audioDev = SDL_OpenAudioDevice(nullptr, 0, &wantSpec, &m_spec, 0);
+    if(!m_audioDev)
+    {
+        SDL_LogWarn(SDL_LOG_CATEGORY_AUDIO, "Failed to open audio: %s", SDL_GetError());
+        return false;
+    }
+
+    for(auto &p : m_players)
+    {
+        p.setAudioSpec(m_spec);
+        p.m_sharedDev = m_audioDev;
+    }
+
+    return true;
+}
+
+void DerVideoPlaylist::closeAudioDevice()
+{
+    if(m_audioDev)
+    {
+        SDL_CloseAudioDevice(m_audioDev);
+        m_audioDev = 0;
+    }
+
+    for(auto &p : m_players)
+        p.m_sharedDev = 0;
+}
+
+void DerVideoPlaylist::setAudioPaused(bool paused)
+{
+    if(m_audioDev)
+        SDL_PauseAudioDevice(m_audioDev, paused ? 1 : 0);
+}
+
+void DerVideoPlaylist::setProbeCache(ProbeCache *cache)
+{
+    for(auto &p : m_players)
+        p.setProbeCache(cache);
+}
+
+void DerVideoPlaylist::setClipCache(ClipCache *cache)
+{
+    for(auto &p : m_players)
+        p.setClipCache(cache);
+}
+
+void DerVideoPlaylist::setKeyframeIndexDir(const std::string &dir)
+{
+    for(auto &p : m_players)
+        p.setKeyframeIndexDir(dir);
+}
+
+void DerVideoPlaylist::append(const std::string &item)
+{
+    SDL_LockMutex(m_mutex);
+    m_items.push_back(item);
+    SDL_CondSignal(m_cond);
+    SDL_UnlockMutex(m_mutex);
+}
+
+size_t DerVideoPlaylist::pending() const
+{
+    size_t ret;
+
+    SDL_LockMutex(m_mutex);
+    ret = m_items.size() - m_nextItem;
+    if(m_preparing || m_next)
+        ++ret;
+    SDL_UnlockMutex(m_mutex);
+
+    return ret;
+}
+
+bool DerVideoPlaylist::prepare(DerVideoPlayer *player, const std::string &item)
+{
+    Uint64 start = SDL_GetPerformanceCounter();
+    double took;
+    bool ok;
+
+    // Isn't fed by the device yet, so, the pre-roll must not block the playing one
+    player->m_offline = true;
+
+    if(DerVideoPlayer::hasMemoryAsset(item))
+        ok = player->loadVideoAsset(item);
+    else
+        ok = player->loadVideoFile(item);
+
+    if(ok)
+        ok = player->preRoll();
+
+    if(!ok)
+    {
+        SDL_LogWarn(SDL_LOG_CATEGORY_ERROR, "Playlist: failed to open %s, skipping", item.c_str());
+        player->close();
+    }
+
+    took = (double)(SDL_GetPerformanceCounter() - start) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+
+    SDL_LockMutex(m_mutex);
+    m_stats.lastPrepareMs = took;
+    if(!ok && !m_quit) // Not a failure if cancelled by close()
+        m_stats.failed++;
+    SDL_UnlockMutex(m_mutex);
+
+    return ok;
+}
+
+bool DerVideoPlaylist::start()
+{
+    std::string item;
+    bool ok = false;
+
+    close();
+
+    SDL_LockMutex(m_mutex);
+
+    while(!ok && m_nextItem < m_items.size())
+    {
+        item = m_items[m_nextItem++];
+        SDL_UnlockMutex(m_mutex);
+        ok = prepare(&m_players[0], item);
+        SDL_LockMutex(m_mutex);
+    }
+
+    if(ok)
+    {
+        m_players[0].m_offline = false;
+        m_current = &m_players[0];
+        m_currentItem = item;
+        m_free = &m_players[1];
+        m_switched = true;
+    }
+
+    SDL_UnlockMutex(m_mutex);
+
+    if(!ok)
+        return false;
+
+    m_thread = SDL_CreateThread(&DerVideoPlaylist::prepare_thread, "PlaylistPrepare", this);
+    if(!m_thread)
+    {
+        SDL_LogWarn(SDL_LOG_CATEGORY_ERROR, "Playlist: failed to start the thread: %s", SDL_GetError());
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+int SDLCALL DerVideoPlaylist::prepare_thread(void *self)
+{
+    DerVideoPlaylist *p = (DerVideoPlaylist *)self;
+
+    SDL_LockMutex(p->m_mutex);
+
+    while(!p->m_quit)
+    {
+        DerVideoPlayer *player;
+        std::string item;
+        bool ok;
+
+        if(!p->m_free || p->m_next || p->m_nextItem >= p->m_items.size())
+        {
+            SDL_CondWait(p->m_cond, p->m_mutex);
+            continue;
+        }
+
+        player = p->m_free;
+        p->m_free = nullptr;
+        item = p->m_items[p->m_nextItem++];
+        p->m_preparing = true;
+
+        // Might be cancelled by skip(). Done under the mutex: close() sets m_quit before cancelling
+        player->resetCancel();
+
+        SDL_UnlockMutex(p->m_mutex);
+        ok = p->prepare(player, item);
+        SDL_LockMutex(p->m_mutex);
+
+        p->m_preparing = false;
+
+        if(ok)
+        {
+            p->m_next = player;
+            p->m_nextName = item;
+        }
+        else
+            p->m_free = player;
+    }
+
+    SDL_UnlockMutex(p->m_mutex);
+
+    return 0;
+}
+
+bool DerVideoPlaylist::switchToNext()
+{
+    if(!m_next)
+    {
+        // Count the stall once, while there is anything to wait for
+        if(m_current && !m_stallStart && (m_preparing || m_nextItem < m_items.size()))
+        {
+            m_stallStart = SDL_GetPerformanceCounter();
+            m_stats.stalls++;
+        }
+
+        return false;
+    }
+
+    if(m_stallStart)
+    {
+        m_stats.stallMs += (double)(SDL_GetPerformanceCounter() - m_stallStart) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+        m_stallStart = 0;
+    }
+    else
+        m_stats.gapless++;
+
+    // The next one can't be prepared until update() frees the retired player, so, this slot is always empty here
+    m_retired = m_current;
+    m_current = m_next;
+    m_currentItem = m_nextName;
+    m_next = nullptr;
+
+    m_current->m_offline = false;
+    m_switched = true;
+
+    return true;
+}
+
+void SDLCALL DerVideoPlaylist::audio_out(void *self, Uint8 *stream, int bytes)
+{
+    DerVideoPlaylist *p = (DerVideoPlaylist *)self;
+    bool switched;
+    int got;
+
+    while(bytes > 0)
+    {
+        // Only this thread changes the current player while the device is running
+        DerVideoPlayer *cur = p->m_current;
+
+        if(cur && !cur->atEnd())
+        {
+            got = cur->fillAudio(stream, bytes);
+            stream += got;
+            bytes -= got;
+            continue;
+        }
+
+        SDL_LockMutex(p->m_mutex);
+        switched = p->switchToNext();
+        SDL_UnlockMutex(p->m_mutex);
+
+        if(!switched)
+        {
+            SDL_memset(stream, p->m_spec.silence, bytes);
+            break;
+        }
+    }
+}
+
+bool DerVideoPlaylist::update()
+{
+    DerVideoPlayer *retired;
+    bool switched;
+
+    SDL_LockMutex(m_mutex);
+    retired = m_retired;
+    m_retired = nullptr;
+    switched = m_switched;
+    m_switched = false;
+    SDL_UnlockMutex(m_mutex);
+
+    if(retired)
+    {
+        double stopMs;
+
+        // Must be closed at this thread: it owns the texture
+        retired->close();
+        stopMs = retired->stopDuration();
+
+        SDL_LockMutex(m_mutex);
+        if(stopMs > 0.0)
+            m_stats.lastStopMs = stopMs;
+        m_free = retired;
+        SDL_CondSignal(m_cond);
+        SDL_UnlockMutex(m_mutex);
+    }
+
+    return switched;
+}
+
+void DerVideoPlaylist::skip()
+{
+    DerVideoPlayer *cur = current();
+
+    if(!cur)
+        return;
+
+    // The callback might be stuck reading the current item, so, cancel before locking the device
+    cur->cancel();
+
+    if(m_audioDev)
+        SDL_LockAudioDevice(m_audioDev);
+
+    // Incomplete clip must not get into the cache
+    cur->clipRecordAbort();
+    cur->m_atEnd = true;
+
+    if(m_audioDev)
+        SDL_UnlockAudioDevice(m_audioDev);
+}
+
+void DerVideoPlaylist::stopThread()
+{
+    if(!m_thread)
+        return;
+
+    SDL_LockMutex(m_mutex);
+    m_quit = true;
+    SDL_CondBroadcast(m_cond);
+    SDL_UnlockMutex(m_mutex);
+
+    SDL_WaitThread(m_thread, nullptr);
+    m_thread = nullptr;
+    m_quit = false;
+}
+
+void DerVideoPlaylist::close()
+{
+    Uint64 start = SDL_GetPerformanceCounter();
+    bool wasActive = m_thread || current();
+
+    // The prepare thread must not start another item (and reset the token) after the cancel
+    SDL_LockMutex(m_mutex);
+    m_quit = true;
+    SDL_CondBroadcast(m_cond);
+    SDL_UnlockMutex(m_mutex);
+
+    // Make the callback and the preparation give up reading before waiting for them
+    for(auto &p : m_players)
+        p.cancel();
+
+    setAudioPaused(true);
+    stopThread();
+
+    for(auto &p : m_players)
+    {
+        p.close();
+        p.resetCancel();
+        p.m_offline = false;
+    }
+
+    SDL_LockMutex(m_mutex);
+    if(wasActive)
+        m_stats.lastStopMs = (double)(SDL_GetPerformanceCounter() - start) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+    m_current = nullptr;
+    m_currentItem.clear();
+    m_next = nullptr;
+    m_nextName.clear();
+    m_retired = nullptr;
+    m_free = nullptr;
+    m_preparing = false;
+    m_switched = false;
+    m_stallStart = 0;
+    m_quit = false; // Not reset by stopThread() when there was no thread
+    SDL_UnlockMutex(m_mutex);
+}
+
+DerVideoPlayer *DerVideoPlaylist::current()
+{
+    DerVideoPlayer *ret;
+
+    SDL_LockMutex(m_mutex);
+    ret = m_current;
+    SDL_UnlockMutex(m_mutex);
+
+    return ret;
+}
+
+std::string DerVideoPlaylist::currentItem() const
+{
+    std::string ret;
+
+    SDL_LockMutex(m_mutex);
+    ret = m_currentItem;
+    SDL_UnlockMutex(m_mutex);
+
+    return ret;
+}
+
+bool DerVideoPlaylist::atEnd() const
+{
+    bool ret;
+
+    SDL_LockMutex(m_mutex);
+    ret = (!m_current || m_current->atEnd()) &&
+          !m_next && !m_preparing && m_nextItem >= m_items.size();
+    SDL_UnlockMutex(m_mutex);
+
+    return ret;
+}
+
+bool DerVideoPlaylist::hasVideoFrame()
+{
+    DerVideoPlayer *cur = current();
+    return cur && cur->hasVideoFrame();
+}
+
+void DerVideoPlaylist::drawVideoFrame()
+{
+    DerVideoPlayer *cur = current();
+
+    if(cur)
+        cur->drawVideoFrame();
+}
+
+DerVideoPlaylist::Stats DerVideoPlaylist::stats() const
+{
+    Stats ret;
+
+    SDL_LockMutex(m_mutex);
+    ret = m_stats;
+    SDL_UnlockMutex(m_mutex);
+
+    return ret;
+}
@@ -0,0 +1,149 @@
+#ifndef VIDEO_PLAYLIST_H
+#define VIDEO_PLAYLIST_H
+
+#include <SDL2/SDL_audio.h>
+#include <SDL2/SDL_mutex.h>
+#include <SDL2/SDL_thread.h>
+
+#include <string>
+#include <vector>
+
+#include "video_player.h"
+
+class ProbeCache;
+class ClipCache;
+
+/**
+ * @brief Plays a sequence of videos without gaps
+ *
+ * Owns the output device and two players. While one plays, the next item gets opened,
+ * probed and pre-rolled at the background thread. The audio callback switches to the
+ * prepared player right at the end of the current one, in the middle of the output buffer.
+ *
+ * Items are names of registered memory assets or paths to local files.
+ */
+class DerVideoPlaylist
+{
+public:
+    struct Stats
+    {
+        //! Items switched to with the next item ready
+        uint64_t gapless = 0;
+        //! Items which weren't ready when the previous one ended
+        uint64_t stalls = 0;
+        //! Total time of the output silence caused by stalls, in milliseconds
+        double   stallMs = 0.0;
+        //! Items which failed to open
+        uint64_t failed = 0;
+        //! Time spent to open and pre-roll the last item, in milliseconds
+        double   lastPrepareMs = 0.0;
+        //! Time from the last skip() or close() call until the stopped players were closed, in milliseconds
+        double   lastStopMs = 0.0;
+    };
+
+    explicit DerVideoPlaylist(SDL_Renderer *render);
+    ~DerVideoPlaylist();
+
+    /**
+     * @brief Open the output device fed by the playlist
+     * @param want Desired output spec (callback and userdata will be set by the playlist)
+     * @return true if device has been opened
+     *
+     * The device keeps this spec for all items, so switching between them needs no reopening.
+     * Items are resampled to it, the native rate mode of DerVideoPlayer isn't available here.
+     */
+    bool openAudioDevice(const SDL_AudioSpec &want);
+    void closeAudioDevice();
+    void setAudioPaused(bool paused);
+
+    //! Caches to use by both players, must be set before start()
+    void setProbeCache(ProbeCache *cache);
+    void setClipCache(ClipCache *cache);
+    //! Directory of key frame index sidecars for both players, see DerVideoPlayer::setKeyframeIndexDir()
+    void setKeyframeIndexDir(const std::string &dir);
+
+    /**
+     * @brief Add the item to the end of the playlist, can be called while playing
+     * @param item Name of the memory asset or path to the file
+     */
+    void append(const std::string &item);
+
+    //! Number of items not started yet (including the one being prepared)
+    size_t pending() const;
+
+    /**
+     * @brief Load the first item and start the background preparation of the next one
+     * @return true if anything can be played
+     */
+    bool start();
+
+    /**
+     * @brief Maintenance, must be called periodically from the rendering thread
+     * @return true if the current item has been changed since the last call
+     */
+    bool update();
+
+    //! Skip to the next item, the input of the current one gets cancelled
+    void skip();
+
+    //! Stop the playback and close everything, must be called before the renderer is destroyed
+    void close();
+
+    /**
+     * @brief Currently playing player (to control the speed, the audio tracks, etc.)
+     * @return player or nullptr if nothing plays
+     */
+    DerVideoPlayer *current();
+    //! Item being played
+    std::string currentItem() const;
+
+    bool atEnd() const;
+    bool hasVideoFrame();
+    void drawVideoFrame();
+
+    Stats stats() const;
+
+private:
+    static void SDLCALL audio_out(void *self, Uint8 *stream, int bytes);
+    static int SDLCALL prepare_thread(void *self);
+
+    //! Load the item into the player
+    bool prepare(DerVideoPlayer *player, const std::string &item);
+    //! Switch to the prepared player, called from the audio callback
+    bool switchToNext();
+    void stopThread();
+
+    DerVideoPlayer  m_players[2];
+
+    SDL_AudioDeviceID m_audioDev = 0;
+    SDL_AudioSpec   m_spec;
+
+    //! Protects everything below
+    SDL_mutex       *m_mutex = nullptr;
+    SDL_cond        *m_cond = nullptr;
+    SDL_Thread      *m_thread = nullptr;
+    bool            m_quit = false;
+
+    std::vector<std::string> m_items;
+    //! Index of the next item to prepare
+    size_t          m_nextItem = 0;
+
+    DerVideoPlayer  *m_current = nullptr;
+    std::string     m_currentItem;
+    //! Prepared player which goes next
+    DerVideoPlayer  *m_next = nullptr;
+    std::string     m_nextName;
+    //! Player finished by the audio callback, gets closed by update()
+    DerVideoPlayer  *m_retired = nullptr;
+    //! Player to prepare the next item into
+    DerVideoPlayer  *m_free = nullptr;
+    bool            m_preparing = false;
+    bool            m_switched = false;
+
+    //! When the current item has ended without the next one ready (0 if not stalled)
+    Uint64          m_stallStart = 0;
+
+    Stats           m_stats;
+};
+
+#endif // VIDEO_PLAYLIST_H
@@ -0,0 +1,782 @@
+#include <SDL2/SDL_rwops.h>
+#include <SDL2/SDL_error.h>
+#include <SDL2/SDL_stdinc.h>
+
+#include <set>
+
+#include "zip_archive.h"
+
+#if !defined(_WIN32) && !defined(__vita__)
+#   define ZIP_MMAP_SUPPORTED
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <fcntl.h>
+#   include <unistd.h>
+#endif
+
+#ifdef DERVIDEO_HAS_ZLIB
+#   include <zlib.h>
+#endif
+
+#define ZIP_SIG_LOCAL       0x04034b50
+#define ZIP_SIG_CENTRAL     0x02014b50
+#define ZIP_SIG_EOCD        0x06054b50
+#define ZIP_SIG_EOCD64      0x06064b50
+#define ZIP_SIG_EOCD64_LOC  0x07064b50
+
+#define ZIP_METHOD_STORED   0
+#define ZIP_METHOD_DEFLATED 8
+
+//! End of central directory record is at most this far from the end (the comment is up to 64 KB)
+#define ZIP_EOCD_SEARCH     (0xFFFF + 22)
+
+//! Output distance between restart points of the deflated entry
+#define ZIP_INFLATE_SPAN    (2 * 1024 * 1024)
+//! Deflate window size, needed to restart decompression at the point
+#define ZIP_INFLATE_WINDOW  32768
+#define ZIP_INFLATE_INPUT   (64 * 1024)
+
+static inline uint16_t zip_get16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static inline uint32_t zip_get32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint64_t zip_get64(const uint8_t *p)
+{
+    return (uint64_t)zip_get32(p) | ((uint64_t)zip_get32(p + 4) << 32);
+}
+
+static std::string zip_clean_name(const std::string &name)
+{
+    size_t begin = 0, end = name.size();
+
+    while(begin < end && name[begin] == '/')
+        ++begin;
+    while(end > begin && name[end - 1] == '/')
+        --end;
+
+    return name.substr(begin, end - begin);
+}
+
+ZipArchive::ZipArchive()
+{}
+
+ZipArchive::~ZipArchive()
+{
+    close();
+}
+
+bool ZipArchive::open(const std::string &path)
+{
+    close();
+
+#ifdef ZIP_MMAP_SUPPORTED
+    struct stat st;
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+    if(fd >= 0)
+    {
+        if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 &&
+           (uint64_t)st.st_size <= (uint64_t)SIZE_MAX)
+        {
+            void *data = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(data != MAP_FAILED)
+            {
+                m_data = (const uint8_t *)data;
+                m_size = (uint64_t)st.st_size;
+            }
+        }
+
+        ::close(fd); // The mapping keeps the file referenced
+    }
+#endif
+
+    if(!m_data)
+    {
+        Sint64 size;
+
+        m_file = SDL_RWFromFile(path.c_str(), "rb");
+        if(!m_file)
+            return false;
+
+        size = SDL_RWsize(m_file);
+        if(size <= 0)
+        {
+            close();
+            return false;
+        }
+
+        m_size = (uint64_t)size;
+    }
+
+    if(!readCentralDirectory())
+    {
+        SDL_SetError("%s is not a valid ZIP archive", path.c_str());
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+void ZipArchive::close()
+{
+#ifdef ZIP_MMAP_SUPPORTED
+    if(m_data)
+        munmap((void *)m_data, (size_t)m_size);
+#endif
+    m_data = nullptr;
+
+    if(m_file)
+    {
+        SDL_RWclose(m_file);
+        m_file = nullptr;
+    }
+
+    m_size = 0;
+    m_entries.clear();
+    m_index.clear();
+}
+
+size_t ZipArchive::readAt(uint64_t offset, void *buf, size_t len) const
+{
+    if(offset >= m_size)
+        return 0;
+
+    if(len > m_size - offset)
+        len = (size_t)(m_size - offset);
+
+    if(m_data)
+    {
+        SDL_memcpy(buf, m_data + offset, len);
+        return len;
+    }
+
+    std::lock_guard<std::mutex> guard(m_fileMutex);
+
+    if(!m_file || SDL_RWseek(m_file, (Sint64)offset, RW_SEEK_SET) < 0)
+        return 0;
+
+    return SDL_RWread(m_file, buf, 1, len);
+}
+
+uint64_t ZipArchive::fileSize() const
+{
+    return m_size;
+}
+
+bool ZipArchive::readCentralDirectory()
+{
+    std::vector<uint8_t> tail, cd;
+    uint64_t tailOffset, cdOffset, cdSize, count;
+    const uint8_t *eocd = nullptr, *p, *end;
+    size_t tailSize;
+
+    tailSize = (size_t)(m_size < ZIP_EOCD_SEARCH ? m_size : ZIP_EOCD_SEARCH);
+    tailOffset = m_size - tailSize;
+    tail.resize(tailSize);
+
+    if(tailSize < 22 || readAt(tailOffset, tail.data(), tailSize) != tailSize)
+        return false;
+
+    for(size_t i = tailSize - 22 + 1; i-- > 0;)
+    {
+        if(zip_get32(tail.data() + i) == ZIP_SIG_EOCD)
+        {
+            eocd = tail.data() + i;
+            break;
+        }
+    }
+
+    if(!eocd)
+        return false;
+
+    count = zip_get16(eocd + 10);
+    cdSize = zip_get32(eocd + 12);
+    cdOffset = zip_get32(eocd + 16);
+
+    // ZIP64: real values are at the ZIP64 end of central directory record
+    if(count == 0xFFFF || cdSize == 0xFFFFFFFF || cdOffset == 0xFFFFFFFF)
+    {
+        uint64_t eocdPos = tailOffset + (uint64_t)(eocd - tail.data());
+        uint8_t loc[20], rec[56];
+
+        if(eocdPos < 20 || readAt(eocdPos - 20, loc, 20) != 20 || zip_get32(loc) != ZIP_SIG_EOCD64_LOC)
+            return false;
+
+        if(readAt(zip_get64(loc + 8), rec, 56) != 56 || zip_get32(rec) != ZIP_SIG_EOCD64)
+            return false;
+
+        count = zip_get64(rec + 32);
+        cdSize = zip_get64(rec + 40);
+        cdOffset = zip_get64(rec + 48);
+    }
+
+    if(cdOffset > m_size || cdSize > m_size - cdOffset)
+        return false;
+
+    cd.resize((size_t)cdSize);
+    if(cdSize > 0 && readAt(cdOffset, cd.data(), (size_t)cdSize) != cdSize)
+        return false;
+
+    p = cd.data();
+    end = p + cd.size();
+    m_entries.reserve((size_t)count);
+
+    while(p + 46 <= end && zip_get32(p) == ZIP_SIG_CENTRAL)
+    {
+        uint16_t flags = zip_get16(p + 8);
+        uint16_t nameLen = zip_get16(p + 28);
+        uint16_t extraLen = zip_get16(p + 30);
+        uint16_t commentLen = zip_get16(p + 32);
+        const uint8_t *extra = p + 46 + nameLen;
+        Entry e;
+
+        if(p + 46 + nameLen + extraLen + commentLen > end)
+            return false;
+
+        e.method = zip_get16(p + 10);
+        e.compSize = zip_get32(p + 20);
+        e.size = zip_get32(p + 24);
+        e.headerOffset = zip_get32(p + 42);
+        e.name.assign((const char *)p + 46, nameLen);
+
+        // ZIP64 extended information: only the fields saturated at the main header are present
+        for(const uint8_t *x = extra; x + 4 <= extra + extraLen;)
+        {
+            uint16_t id = zip_get16(x), len = zip_get16(x + 2);
+            const uint8_t *v = x + 4, *vEnd = x + 4 + len;
+
+            if(vEnd > extra + extraLen)
+                break;
+
+            if(id == 0x0001)
+            {
+                if(e.size == 0xFFFFFFFF && v + 8 <= vEnd)
+                {
+                    e.size = zip_get64(v);
+                    v += 8;
+                }
+                if(e.compSize == 0xFFFFFFFF && v + 8 <= vEnd)
+                {
+                    e.compSize = zip_get64(v);
+                    v += 8;
+                }
+                if(e.headerOffset == 0xFFFFFFFF && v + 8 <= vEnd)
+                    e.headerOffset = zip_get64(v);
+            }
+
+            x = vEnd;
+        }
+
+        p += 46 + nameLen + extraLen + commentLen;
+
+        // Directories are implied by file names, encrypted entries can't be read
+        if(e.name.empty() || e.name.back() == '/' || (flags & 1))
+            continue;
+
+        e.name = zip_clean_name(e.name);
+        m_index[e.name] = m_entries.size();
+        m_entries.push_back(std::move(e));
+    }
+
+    return true;
+}
+
+bool ZipArchive::resolveData(const Entry &e) const
+{
+    std::lock_guard<std::mutex> guard(m_resolveMutex);
+    uint8_t local[30];
+
+    if(e.dataOffset > 0)
+        return true;
+
+    if(readAt(e.headerOffset, local, 30) != 30 || zip_get32(local) != ZIP_SIG_LOCAL)
+    {
+        SDL_SetError("Broken local header of %s", e.name.c_str());
+        return false;
+    }
+
+    e.dataOffset = e.headerOffset + 30 + zip_get16(local + 26) + zip_get16(local + 28);
+
+    if(e.dataOffset > m_size || e.compSize > m_size - e.dataOffset)
+    {
+        e.dataOffset = 0;
+        SDL_SetError("Data of %s is out of the archive", e.name.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+const ZipArchive::Entry *ZipArchive::find(const std::string &name) const
+{
+    auto it = m_index.find(zip_clean_name(name));
+    return it != m_index.end() ? &m_entries[it->second] : nullptr;
+}
+
+bool ZipArchive::isDir(const std::string &name) const
+{
+    std::string prefix = zip_clean_name(name);
+
+    if(prefix.empty())
+        return true;
+
+    prefix.push_back('/');
+
+    for(const auto &e : m_entries)
+    {
+        if(e.name.compare(0, prefix.size(), prefix) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+void ZipArchive::list(const std::string &dir, std::vector<std::string> &files, std::vector<std::string> &dirs) const
+{
+    std::string prefix = zip_clean_name(dir);
+    std::set<std::string> seenDirs;
+
+    files.clear();
+    dirs.clear();
+
+    if(!prefix.empty())
+        prefix.push_back('/');
+
+    for(const auto &e : m_entries)
+    {
+        size_t slash;
+
+        if(e.name.size() <= prefix.size() || e.name.compare(0, prefix.size(), prefix) != 0)
+            continue;
+
+        slash = e.name.find('/', prefix.size());
+
+        if(slash == std::string::npos)
+            files.push_back(e.name.substr(prefix.size()));
+        else if(seenDirs.insert(e.name.substr(prefix.size(), slash - prefix.size())).second)
+            dirs.push_back(e.name.substr(prefix.size(), slash - prefix.size()));
+    }
+}
+
+const uint8_t *ZipArchive::storedData(const Entry &e) const
+{
+    if(!m_data || e.method != ZIP_METHOD_STORED || e.compSize != e.size || !resolveData(e))
+        return nullptr;
+
+    return m_data + e.dataOffset;
+}
+
+/* ------------------------------------------------------------------------- */
+
+struct ZipEntryReader
+{
+    std::shared_ptr<ZipArchive> archive;
+    uint64_t    dataOffset;
+    uint64_t    compSize;
+    uint64_t    size;
+    uint64_t    pos;
+    //! Entry data at the mapping (nullptr if the archive isn't mapped)
+    const uint8_t *mapped;
+    bool        deflated;
+
+#ifdef DERVIDEO_HAS_ZLIB
+    struct Point
+    {
+        //! Offset of the output
+        uint64_t    out;
+        //! Offset of the input (the byte containing the first bit of the block)
+        uint64_t    in;
+        //! Bits of the previous byte which belong to the block
+        int         bits;
+        std::vector<uint8_t> window;
+    };
+
+    z_stream    strm;
+    bool        strmReady;
+    //! Position of the decompressor output
+    uint64_t    outPos;
+    //! Position of the next compressed byte to read
+    uint64_t    inPos;
+    std::vector<uint8_t> input;
+    //! Last ZIP_INFLATE_WINDOW bytes of the output (ring)
+    std::vector<uint8_t> ring;
+    size_t      ringPos;
+    bool        ringFull;
+    std::vector<Point> points;
+#endif
+};
+
+static Sint64 SDLCALL zip_entry_size(SDL_RWops *ctx)
+{
+    ZipEntryReader *r = (ZipEntryReader *)ctx->hidden.unknown.data1;
+    return (Sint64)r->size;
+}
+
+static Sint64 SDLCALL zip_entry_seek(SDL_RWops *ctx, Sint64 offset, int whence)
+{
+    ZipEntryReader *r = (ZipEntryReader *)ctx->hidden.unknown.data1;
+    Sint64 newPos;
+
+    switch(whence)
+    {
+    case RW_SEEK_SET:
+        newPos = offset;
+        break;
+    case RW_SEEK_CUR:
+        newPos = (Sint64)r->pos + offset;
+        break;
+    case RW_SEEK_END:
+        newPos = (Sint64)r->size + offset;
+        break;
+    default:
+        return SDL_SetError("Unknown value for 'whence'");
+    }
+
+    if(newPos < 0)
+        return SDL_SetError("Attempt to seek before the beginning of the file");
+
+    if((Uint64)newPos > r->size)
+        newPos = (Sint64)r->size;
+
+    // Decompression is repositioned lazily by the next read
+    r->pos = (uint64_t)newPos;
+
+    return newPos;
+}
+
+static size_t SDLCALL zip_entry_write(SDL_RWops *, const void *, size_t, size_t)
+{
+    SDL_SetError("Archive entry is read-only");
+    return 0;
+}
+
+static size_t zip_stored_read(ZipEntryReader *r, uint8_t *buf, size_t len)
+{
+    if(r->mapped)
+    {
+        SDL_memcpy(buf, r->mapped + r->pos, len);
+        return len;
+    }
+
+    return r->archive->readAt(r->dataOffset + r->pos, buf, len);
+}
+
+#ifdef DERVIDEO_HAS_ZLIB
+
+static void zip_ring_put(ZipEntryReader *r, const uint8_t *data, size_t len)
+{
+    if(len >= ZIP_INFLATE_WINDOW)
+    {
+        SDL_memcpy(r->ring.data(), data + len - ZIP_INFLATE_WINDOW, ZIP_INFLATE_WINDOW);
+        r->ringPos = 0;
+        r->ringFull = true;
+        return;
+    }
+
+    while(len > 0)
+    {
+        size_t chunk = ZIP_INFLATE_WINDOW - r->ringPos;
+        if(chunk > len)
+            chunk = len;
+
+        SDL_memcpy(r->ring.data() + r->ringPos, data, chunk);
+        r->ringPos += chunk;
+        data += chunk;
+        len -= chunk;
+
+        if(r->ringPos == ZIP_INFLATE_WINDOW)
+        {
+            r->ringPos = 0;
+            r->ringFull = true;
+        }
+    }
+}
+
+static void zip_add_point(ZipEntryReader *r)
+{
+    ZipEntryReader::Point pt;
+    size_t have = r->ringFull ? ZIP_INFLATE_WINDOW : r->ringPos;
+
+    pt.out = r->outPos;
+    pt.in = r->inPos - r->strm.avail_in;
+    pt.bits = r->strm.data_type & 7;
+
+    // Linear copy of the window, oldest bytes first
+    pt.window.resize(have);
+    if(r->ringFull)
+    {
+        SDL_memcpy(pt.window.data(), r->ring.data() + r->ringPos, ZIP_INFLATE_WINDOW - r->ringPos);
+        SDL_memcpy(pt.window.data() + ZIP_INFLATE_WINDOW - r->ringPos, r->ring.data(), r->ringPos);
+    }
+    else
+        SDL_memcpy(pt.window.data(), r->ring.data(), have);
+
+    r->points.push_back(std::move(pt));
+}
+
+//! Restart the decompression at the restart point
+static bool zip_restart(ZipEntryReader *r, const ZipEntryReader::Point *pt)
+{
+    if(r->strmReady)
+        inflateEnd(&r->strm);
+
+    SDL_zero(r->strm);
+    r->strmReady = false;
+
+    if(inflateInit2(&r->strm, -15) != Z_OK)
+        return false;
+
+    r->strmReady = true;
+    r->ringPos = 0;
+    r->ringFull = false;
+
+    if(!pt)
+    {
+        r->inPos = 0;
+        r->outPos = 0;
+        return true;
+    }
+
+    r->inPos = pt->in;
+    r->outPos = pt->out;
+
+    if(pt->bits)
+    {
+        uint8_t b;
+
+        if(r->archive->readAt(r->dataOffset + pt->in - 1, &b, 1) != 1)
+            return false;
+
+        inflatePrime(&r->strm, pt->bits, b >> (8 - pt->bits));
+    }
+
+    if(!pt->window.empty())
+    {
+        inflateSetDictionary(&r->strm, pt->window.data(), (uInt)pt->window.size());
+        zip_ring_put(r, pt->window.data(), pt->window.size());
+    }
+
+    return true;
+}
+
+//! Decompress up to len bytes at the current output position
+static size_t zip_inflate(ZipEntryReader *r, uint8_t *buf, size_t len)
+{
+    size_t total = 0;
+
+    while(total < len && r->outPos < r->size)
+    {
+        size_t produced;
+        int ret;
+
+        if(r->strm.avail_in == 0)
+        {
+            size_t want = r->input.size();
+            uint64_t left = r->compSize - r->inPos;
+
+            if(want > left)
+                want = (size_t)left;
+
+            if(want == 0)
+                break; // Truncated
+
+            if(r->mapped)
+                SDL_memcpy(r->input.data(), r->mapped + r->inPos, want);
+            else if(r->archive->readAt(r->dataOffset + r->inPos, r->input.data(), want) != want)
+                break;
+
+            r->inPos += want;
+            r->strm.next_in = r->input.data();
+            r->strm.avail_in = (uInt)want;
+        }
+
+        r->strm.next_out = buf + total;
+        r->strm.avail_out = (uInt)(len - total);
+
+        // Stop at every block end to see where the restart point can be placed
+        ret = inflate(&r->strm, Z_BLOCK);
+        if(ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR)
+        {
+            SDL_SetError("Broken deflate stream: %s", r->strm.msg ? r->strm.msg : "unknown error");
+            break;
+        }
+
+        produced = (len - total) - r->strm.avail_out;
+        zip_ring_put(r, buf + total, produced);
+        total += produced;
+        r->outPos += produced;
+
+        if(ret == Z_STREAM_END)
+            break;
+
+        // At the end of the block and not at the last one
+        if((r->strm.data_type & 128) && !(r->strm.data_type & 64) &&
+           (r->points.empty() ? r->outPos >= ZIP_INFLATE_SPAN : r->outPos >= r->points.back().out + ZIP_INFLATE_SPAN))
+            zip_add_point(r);
+
+        if(ret == Z_BUF_ERROR && produced == 0 && r->strm.avail_in > 0)
+            break;
+    }
+
+    return total;
+}
+
+//! Move the decompressor to the read position
+static bool zip_reposition(ZipEntryReader *r)
+{
+    const ZipEntryReader::Point *best = nullptr;
+    uint8_t skip[4096];
+
+    for(const auto &pt : r->points)
+    {
+        if(pt.out <= r->pos)
+            best = &pt;
+        else
+            break;
+    }
+
+    // Restart when going backward, or when the restart point is ahead of the decompressor
+    if(!r->strmReady || r->pos < r->outPos || (best && best->out > r->outPos))
+    {
+        if(!zip_restart(r, best))
+            return false;
+    }
+
+    while(r->outPos < r->pos)
+    {
+        size_t want = r->pos - r->outPos < sizeof(skip) ? (size_t)(r->pos - r->outPos) : sizeof(skip);
+        if(zip_inflate(r, skip, want) == 0)
+            return false;
+    }
+
+    return true;
+}
+
+#endif // DERVIDEO_HAS_ZLIB
+
+static size_t SDLCALL zip_entry_read(SDL_RWops *ctx, void *ptr, size_t size, size_t maxnum)
+{
+    ZipEntryReader *r = (ZipEntryReader *)ctx->hidden.unknown.data1;
+    size_t total, got;
+
+    if(size == 0 || maxnum == 0 || r->pos >= r->size)
+        return 0;
+
+    total = size * maxnum;
+    if(total > r->size - r->pos)
+        total = (size_t)(r->size - r->pos);
+
+#ifdef DERVIDEO_HAS_ZLIB
+    if(r->deflated)
+    {
+        if(r->outPos != r->pos && !zip_reposition(r))
+            return 0;
+
+        got = zip_inflate(r, (uint8_t *)ptr, total);
+    }
+    else
+#endif
+        got = zip_stored_read(r, (uint8_t *)ptr, total);
+
+    r->pos += got;
+
+    return got / size;
+}
+
+static int SDLCALL zip_entry_close(SDL_RWops *ctx)
+{
+    if(ctx)
+    {
+        ZipEntryReader *r = (ZipEntryReader *)ctx->hidden.unknown.data1;
+        if(r)
+        {
+#ifdef DERVIDEO_HAS_ZLIB
+            if(r->strmReady)
+                inflateEnd(&r->strm);
+#endif
+            delete r;
+        }
+        SDL_FreeRW(ctx);
+    }
+
+    return 0;
+}
+
+SDL_RWops *ZipArchive::openEntry(const Entry &e)
+{
+    ZipEntryReader *r;
+    SDL_RWops *ctx;
+
+    if(e.method != ZIP_METHOD_STORED && e.method != ZIP_METHOD_DEFLATED)
+    {
+        SDL_SetError("Compression method %u of %s is not supported", (unsigned)e.method, e.name.c_str());
+        return nullptr;
+    }
+
+#ifndef DERVIDEO_HAS_ZLIB
+    if(e.method == ZIP_METHOD_DEFLATED)
+    {
+        SDL_SetError("Deflated entries are not supported by this build (%s)", e.name.c_str());
+        return nullptr;
+    }
+#endif
+
+    if(!resolveData(e))
+        return nullptr;
+
+    ctx = SDL_AllocRW();
+    if(!ctx)
+    {
+        SDL_OutOfMemory();
+        return nullptr;
+    }
+
+    r = new ZipEntryReader();
+    r->archive = shared_from_this();
+    r->dataOffset = e.dataOffset;
+    r->compSize = e.compSize;
+    r->size = e.size;
+    r->pos = 0;
+    r->mapped = m_data ? m_data + e.dataOffset : nullptr;
+    r->deflated = e.method == ZIP_METHOD_DEFLATED;
+
+#ifdef DERVIDEO_HAS_ZLIB
+    SDL_zero(r->strm);
+    r->strmReady = false;
+    r->outPos = 0;
+    r->inPos = 0;
+    r->ringPos = 0;
+    r->ringFull = false;
+
+    if(e.method == ZIP_METHOD_DEFLATED)
+    {
+        r->input.resize(ZIP_INFLATE_INPUT);
+        r->ring.resize(ZIP_INFLATE_WINDOW);
+
+        if(!zip_restart(r, nullptr))
+        {
+            SDL_SetError("Failed to initialise the decompressor");
+            delete r;
+            SDL_FreeRW(ctx);
+            return nullptr;
+        }
+    }
+#endif
+
+    ctx->size = zip_entry_size;
+    ctx->seek = zip_entry_seek;
+    ctx->read = zip_entry_read;
+    ctx->write = zip_entry_write;
+    ctx->close = zip_entry_close;
+    ctx->type = SDL_RWOPS_UNKNOWN;
+    ctx->hidden.unknown.data1 = r;
+
+    return ctx;
+}
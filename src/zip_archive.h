@@ -0,0 +1,108 @@
+#ifndef ZIP_ARCHIVE_H
+#define ZIP_ARCHIVE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+
+struct SDL_RWops;
+
+/**
+ * @brief Read-only ZIP archive (including ZIP64)
+ *
+ * The archive is memory-mapped where possible. Stored entries can be read straight
+ * from the mapping without copying. Deflated entries are read through the decompressing
+ * RWops which keeps the index of restart points, so seeks don't decompress from the beginning.
+ */
+class ZipArchive : public std::enable_shared_from_this<ZipArchive>
+{
+public:
+    struct Entry
+    {
+        //! Full name inside of the archive, without the leading slash
+        std::string name;
+        //! 0 - stored, 8 - deflated
+        uint16_t    method = 0;
+        uint64_t    compSize = 0;
+        uint64_t    size = 0;
+        //! Offset of the local header
+        uint64_t    headerOffset = 0;
+        //! Offset of the data (resolved on first use)
+        mutable uint64_t dataOffset = 0;
+    };
+
+    ZipArchive();
+    ~ZipArchive();
+
+    ZipArchive(const ZipArchive &) = delete;
+    ZipArchive &operator=(const ZipArchive &) = delete;
+
+    /**
+     * @brief Open the archive and read its central directory
+     * @param path Path to the archive file
+     * @return true on success
+     */
+    bool open(const std::string &path);
+    void close();
+
+    /**
+     * @brief Find the file entry
+     * @param name Name inside of the archive (leading slashes are ignored)
+     * @return entry or nullptr
+     */
+    const Entry *find(const std::string &name) const;
+
+    //! Is there any entry inside of this directory
+    bool isDir(const std::string &name) const;
+
+    /**
+     * @brief List the directory
+     * @param dir Directory inside of the archive (empty for the root)
+     * @param files Names of files directly inside of the directory
+     * @param dirs Names of subdirectories
+     */
+    void list(const std::string &dir, std::vector<std::string> &files, std::vector<std::string> &dirs) const;
+
+    /**
+     * @brief Data of the stored entry without copying
+     * @param e Entry
+     * @return pointer valid while the archive is open, or nullptr if the entry is compressed or the archive isn't mapped
+     */
+    const uint8_t *storedData(const Entry &e) const;
+
+    /**
+     * @brief Open the entry for reading
+     * @param e Entry
+     * @return seekable RWops (keeps the archive alive), or nullptr on error
+     */
+    SDL_RWops *openEntry(const Entry &e);
+
+    /**
+     * @brief Read raw bytes of the archive
+     * @return number of bytes read
+     */
+    size_t readAt(uint64_t offset, void *buf, size_t len) const;
+
+    uint64_t fileSize() const;
+
+private:
+    bool readCentralDirectory();
+    bool resolveData(const Entry &e) const;
+
+    uint64_t        m_size = 0;
+    //! Mapping of the whole archive (nullptr if not mapped)
+    const uint8_t   *m_data = nullptr;
+    //! Fallback access when mapping isn't available, serialised by m_fileMutex
+    SDL_RWops       *m_file = nullptr;
+    mutable std::mutex m_fileMutex;
+    //! Serialises resolving of data offsets
+    mutable std::mutex m_resolveMutex;
+
+    std::vector<Entry> m_entries;
+    std::unordered_map<std::string, size_t> m_index;
+};
+
+#endif // ZIP_ARCHIVE_H
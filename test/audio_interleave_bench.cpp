@@ -0,0 +1,217 @@
+/*
+ * Microbenchmark of audio_interleave() kernels against swr_convert()
+ * at 1024-sample frames, with the correctness check against the scalar reference.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include <vector>
+
+extern "C"
+{
+#include <libavutil/opt.h>
+#include <libavutil/channel_layout.h>
+#include <libswresample/swresample.h>
+}
+
+#include "audio_interleave.h"
+
+#if LIBAVUTIL_VERSION_INT >= AV_VERSION_INT(57, 24, 100)
+#define BENCH_NEW_CHANNEL_LAYOUT
+#endif
+
+#define BENCH_SAMPLES   1024
+#define BENCH_FRAMES    20000
+
+struct BenchCase
+{
+    enum AVSampleFormat in;
+    enum AVSampleFormat out;
+    int channels;
+};
+
+static const BenchCase s_cases[] =
+{
+    {AV_SAMPLE_FMT_FLTP, AV_SAMPLE_FMT_S16, 2},
+    {AV_SAMPLE_FMT_FLTP, AV_SAMPLE_FMT_FLT, 2},
+    {AV_SAMPLE_FMT_FLTP, AV_SAMPLE_FMT_S16, 6},
+    {AV_SAMPLE_FMT_FLTP, AV_SAMPLE_FMT_FLT, 6},
+    {AV_SAMPLE_FMT_S16P, AV_SAMPLE_FMT_S16, 2},
+};
+
+static double now_ms()
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//! Plain loops, the expected output
+static void reference(const BenchCase &c, const uint8_t *const *src, uint8_t *dst, int samples)
+{
+    for(int i = 0; i < samples; ++i)
+    {
+        for(int ch = 0; ch < c.channels; ++ch)
+        {
+            size_t o = (size_t)i * c.channels + ch;
+
+            if(c.in == AV_SAMPLE_FMT_S16P)
+                ((int16_t *)dst)[o] = ((const int16_t *)src[ch])[i];
+            else if(c.out == AV_SAMPLE_FMT_FLT)
+                ((float *)dst)[o] = ((const float *)src[ch])[i];
+            else
+            {
+                double s = floor((double)((const float *)src[ch])[i] * 32768.0 + 0.5);
+                ((int16_t *)dst)[o] = (int16_t)(s > 32767.0 ? 32767.0 : (s < -32768.0 ? -32768.0 : s));
+            }
+        }
+    }
+}
+
+//! Float to integer conversion may round halves differently, one step is allowed
+static bool compare(const BenchCase &c, const uint8_t *got, const uint8_t *want, int samples, int *at)
+{
+    size_t count = (size_t)samples * c.channels;
+
+    for(size_t i = 0; i < count; ++i)
+    {
+        bool ok;
+
+        if(c.out == AV_SAMPLE_FMT_FLT)
+            ok = ((const float *)got)[i] == ((const float *)want)[i];
+        else if(c.in == AV_SAMPLE_FMT_S16P)
+            ok = ((const int16_t *)got)[i] == ((const int16_t *)want)[i];
+        else
+            ok = abs((int)((const int16_t *)got)[i] - (int)((const int16_t *)want)[i]) <= 1;
+
+        if(!ok)
+        {
+            *at = (int)i;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static SwrContext *open_swr(const BenchCase &c)
+{
+    SwrContext *swr = swr_alloc();
+
+    if(!swr)
+        return nullptr;
+
+#if defined(BENCH_NEW_CHANNEL_LAYOUT)
+    AVChannelLayout layout;
+    av_channel_layout_default(&layout, c.channels);
+    av_opt_set_chlayout(swr, "in_chlayout",  &layout, 0);
+    av_opt_set_chlayout(swr, "out_chlayout", &layout, 0);
+    av_channel_layout_uninit(&layout);
+#else
+    int64_t layout = av_get_default_channel_layout(c.channels);
+    av_opt_set_int(swr, "in_channel_layout",  layout, 0);
+    av_opt_set_int(swr, "out_channel_layout", layout, 0);
+#endif
+    av_opt_set_int(swr, "in_sample_rate",  44100, 0);
+    av_opt_set_int(swr, "out_sample_rate", 44100, 0);
+    av_opt_set_sample_fmt(swr, "in_sample_fmt",  c.in, 0);
+    av_opt_set_sample_fmt(swr, "out_sample_fmt", c.out, 0);
+
+    if(swr_init(swr) < 0)
+        swr_free(&swr);
+
+    return swr;
+}
+
+int main(int argc, char **argv)
+{
+    int frames = argc > 1 ? atoi(argv[1]) : BENCH_FRAMES;
+    int failed = 0;
+
+    if(frames <= 0)
+        frames = BENCH_FRAMES;
+
+    printf("%d frames of %d samples\n", frames, BENCH_SAMPLES);
+
+    for(const BenchCase &c : s_cases)
+    {
+        int inSize = av_get_bytes_per_sample(c.in);
+        int outSize = av_get_bytes_per_sample(c.out) * c.channels * BENCH_SAMPLES;
+        std::vector<std::vector<uint8_t> > planes(c.channels, std::vector<uint8_t>((size_t)inSize * BENCH_SAMPLES));
+        std::vector<const uint8_t *> src(c.channels);
+        std::vector<uint8_t> want(outSize), got(outSize), swrOut(outSize);
+        uint8_t *swrDst = swrOut.data();
+        SwrContext *swr;
+        double start, fastMs, swrMs;
+        int at = 0;
+
+        srand(c.channels * 31 + c.out);
+
+        for(int ch = 0; ch < c.channels; ++ch)
+        {
+            for(int i = 0; i < BENCH_SAMPLES; ++i)
+            {
+                // Slightly over the full scale to check clipping
+                float v = ((float)rand() / (float)RAND_MAX) * 2.2f - 1.1f;
+
+                if(c.in == AV_SAMPLE_FMT_S16P)
+                    ((int16_t *)planes[ch].data())[i] = (int16_t)(rand() & 0xFFFF);
+                else
+                    ((float *)planes[ch].data())[i] = v;
+            }
+
+            src[ch] = planes[ch].data();
+        }
+
+        printf("%s -> %s, %d channels: ", av_get_sample_fmt_name(c.in), av_get_sample_fmt_name(c.out), c.channels);
+
+        reference(c, src.data(), want.data(), BENCH_SAMPLES);
+        if(!audio_interleave(c.in, c.out, c.channels, src.data(), got.data(), BENCH_SAMPLES) ||
+           !compare(c, got.data(), want.data(), BENCH_SAMPLES, &at))
+        {
+            printf("FAILED (mismatch at %d)\n", at);
+            failed++;
+            continue;
+        }
+
+        // Odd length goes through the tail loops
+        reference(c, src.data(), want.data(), BENCH_SAMPLES - 5);
+        audio_interleave(c.in, c.out, c.channels, src.data(), got.data(), BENCH_SAMPLES - 5);
+        if(!compare(c, got.data(), want.data(), BENCH_SAMPLES - 5, &at))
+        {
+            printf("FAILED (mismatch at %d, odd length)\n", at);
+            failed++;
+            continue;
+        }
+
+        start = now_ms();
+        for(int f = 0; f < frames; ++f)
+            audio_interleave(c.in, c.out, c.channels, src.data(), got.data(), BENCH_SAMPLES);
+        fastMs = now_ms() - start;
+
+        swr = open_swr(c);
+        if(!swr)
+        {
+            printf("kernel %.3f us/frame, swresample unavailable\n", fastMs * 1000.0 / frames);
+            continue;
+        }
+
+        start = now_ms();
+        for(int f = 0; f < frames; ++f)
+            swr_convert(swr, &swrDst, BENCH_SAMPLES, src.data(), BENCH_SAMPLES);
+        swrMs = now_ms() - start;
+
+        swr_free(&swr);
+
+        printf("kernel %.3f us/frame, swresample %.3f us/frame (%.1fx)\n",
+               fastMs * 1000.0 / frames, swrMs * 1000.0 / frames, fastMs > 0.0 ? swrMs / fastMs : 0.0);
+    }
+
+    if(failed)
+        printf("%d kernels FAILED!\n", failed);
+    else
+        printf("All kernels Ok!\n");
+
+    return failed ? 1 : 0;
+}